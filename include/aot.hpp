@@ -0,0 +1,169 @@
+#pragma once
+
+#include "chip8.hpp"
+#include <cstdint>
+
+// Ahead-of-time recompiled programs
+// The chip8aot tool translates a ROM into a C++ source file at build time (see the
+// chip8_add_aot_rom() CMake function). The generated file registers an AotProgram holding the ROM
+// image and a function that runs the translated code natively against a Chip8 instance.
+//
+// The Aot engine picks the registered program whose ROM is loaded at START_ADDRESS. Code the
+// translator could not reach (targets of Bnnn computed jumps, code outside the ROM image) and any
+// program whose translated code was overwritten by Fx33/Fx55 runs on the interpreter instead,
+// so the machine state is always exactly the one Chip8::cycle() produces.
+
+struct AotProgram
+{
+    const char* name;
+    const uint8_t* rom;         // ROM image the program was translated from
+    uint32_t romSize;
+    const uint8_t* covered;     // Bitmap of the memory bytes holding translated code (MEMORY_SIZE / 8 bytes)
+
+    // Runs translated code from the current pc for at most `budget` instructions and returns how
+    // many were run; returns 0 when there is no translation for pc
+    uint32_t (*run)(Chip8& chip8, uint32_t budget);
+};
+
+class Aot
+{
+public:
+    Aot();
+
+    // Registers a program for every Chip8 instance; called by the generated files at startup
+    static void registerProgram(const AotProgram& program);
+    static unsigned int programCount();
+
+    void run(Chip8& chip8, unsigned long long cycles);
+    void flush();
+
+    const AotProgram* program() const { return program_; }
+
+    // Registers a program from a static object in a generated file
+    struct Registration
+    {
+        explicit Registration(const AotProgram& program) { Aot::registerProgram(program); }
+    };
+
+    class Context;
+
+private:
+    const AotProgram* program_; // Program matching the loaded ROM, or null to use the interpreter
+    bool selected_;             // program_ has been looked up since the last flush
+    bool codeWritten_;          // Fx33/Fx55 wrote into translated code during the last run
+
+    static void dispatch(Chip8& chip8);
+    void select(const Chip8& chip8);
+    bool matches(const Chip8& chip8, const AotProgram& program) const;
+    bool codeIntact(const Chip8& chip8, const AotProgram& program) const;
+};
+
+// State of a translated program while it runs
+// The registers and I are kept in locals so the compiler can hold them in host registers; they are
+// written back before calling into the interpreter and when the program exits. The cycle counter
+// is advanced at the same points; the timers are read and written at the cycle of their instruction.
+class Aot::Context
+{
+public:
+    Context(Chip8& chip8, uint32_t budget)
+        : chip8_(chip8), budget_(budget), executed_(0), startCycle_(chip8.cycleCount), opcode_(chip8.opcode)
+    {
+        load();
+    }
+
+    uint8_t V[REGISTER_COUNT];
+    uint16_t I;
+
+    uint16_t pc() const { return chip8_.pc; }
+    bool done() const { return executed_ == budget_; }
+
+    // Completes an instruction, counting it
+    void retire(uint16_t opcode)
+    {
+        opcode_ = opcode;
+        ++executed_;
+    }
+
+    uint8_t delayTimer() { syncCycles(); return chip8_.getDelayTimer(); }
+    void setDelayTimer(uint8_t value) { syncCycles(); chip8_.setDelayTimer(value); }
+    void setSoundTimer(uint8_t value) { syncCycles(); chip8_.setSoundTimer(value); }
+
+    bool keyDown(uint8_t key) const { return chip8_.keypad[key & 0x0F] != 0; }
+
+    // Pushes a return address; false on stack overflow, which is left to the interpreter to report
+    bool call(uint16_t returnAddress)
+    {
+        if (chip8_.sp >= STACK_LEVELS - 1) {
+            return false;
+        }
+        ++chip8_.sp;
+        chip8_.stack[chip8_.sp] = returnAddress;
+        return true;
+    }
+
+    // Runs the instruction at `address` through the interpreter and returns the new pc
+    uint16_t execute(uint16_t address, uint16_t opcode)
+    {
+        store(static_cast<uint16_t>(address + 2));
+        chip8_.opcode = opcode;
+        Aot::dispatch(chip8_);
+        load();
+        return chip8_.pc;
+    }
+
+    // Runs Fx33 or Fx55 and returns true if the write hit translated code
+    bool executeStore(uint16_t address, uint16_t opcode)
+    {
+        uint16_t start = I;
+        execute(address, opcode);
+        unsigned int length = (opcode & 0x00FFu) == 0x33 ? 3 : ((opcode & 0x0F00u) >> 8) + 1;
+
+        const uint8_t* covered = chip8_.aot->program_->covered;
+        for (unsigned int i = start; i < start + length && i < MEMORY_SIZE; ++i) {
+            if (covered[i >> 3] & (1u << (i & 7))) {
+                chip8_.aot->codeWritten_ = true;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Leaves the program with pc at `address` and returns the number of instructions run
+    uint32_t exit(uint16_t address)
+    {
+        store(address);
+        chip8_.opcode = opcode_;
+        return executed_;
+    }
+
+private:
+    Chip8& chip8_;
+    uint32_t budget_;
+    uint32_t executed_;
+    unsigned long long startCycle_; // Chip8::cycleCount when the program was entered
+    uint16_t opcode_;       // Last opcode run, as the interpreter leaves it in Chip8::opcode
+
+    void load()
+    {
+        for (unsigned int i = 0; i < REGISTER_COUNT; ++i) {
+            V[i] = chip8_.registers[i];
+        }
+        I = chip8_.index;
+    }
+
+    void store(uint16_t pc)
+    {
+        syncCycles();
+        for (unsigned int i = 0; i < REGISTER_COUNT; ++i) {
+            chip8_.registers[i] = V[i];
+        }
+        chip8_.index = I;
+        chip8_.pc = pc;
+    }
+
+    // Sets the cycle counter to the instruction being run, as Chip8::cycle() sees it
+    void syncCycles()
+    {
+        chip8_.cycleCount = startCycle_ + executed_;
+    }
+};
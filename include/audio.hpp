@@ -0,0 +1,114 @@
+#pragma once
+
+#include "chip8.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+const unsigned int AUDIO_SAMPLE_RATE = 48000;   // Hz, mono signed 16-bit samples
+const unsigned int AUDIO_DEVICE_SAMPLES = 256;  // Samples the device asks for at a time (5.3 ms)
+const unsigned int AUDIO_LATENCY_MS = 16;       // Default cap on the samples waiting in the ring
+const unsigned int AUDIO_TONE = 440;            // Hz, the CHIP-8 buzzer
+const int16_t AUDIO_AMPLITUDE = 6000;
+
+// Lock-free single-producer single-consumer ring of samples
+// The producer only writes head_ and the consumer only writes tail_; each side reads the other's
+// index with acquire ordering, so no locks are taken and nothing is allocated after construction.
+class SampleRing
+{
+public:
+    // The capacity is rounded up to a power of two
+    explicit SampleRing(size_t capacity);
+
+    // Producer: copies up to `count` samples in; returns how many fitted
+    size_t write(const int16_t* samples, size_t count);
+
+    // Consumer: copies up to `count` samples out; returns how many there were
+    size_t read(int16_t* samples, size_t count);
+
+    // Samples waiting; exact from either side for its own purposes, approximate from anywhere else
+    size_t size() const { return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire); }
+    size_t capacity() const { return buffer_.size(); }
+
+private:
+    std::vector<int16_t> buffer_;
+    size_t mask_;
+    alignas(64) std::atomic<size_t> head_;  // Samples ever written
+    alignas(64) std::atomic<size_t> tail_;  // Samples ever read
+};
+
+// Sound of the emulated machine
+// The emulation thread calls produce() after running the CPU; it generates the samples for the
+// emulated time since the previous call (AUDIO_SAMPLE_RATE per CHIP8_CLOCK_SPEED cycles) from the
+// sound timer: a square wave on CHIP-8 and SUPER-CHIP, the audio pattern at its pitch on XO-CHIP.
+// The audio thread takes them with consume(), which never blocks, locks or allocates.
+//
+// At most `latencyMs` of samples are kept waiting; what the producer makes beyond that is dropped,
+// so a device that runs slower than the emulated clock can't build up delay. When the ring runs dry
+// the missing samples are played as silence and counted as an underrun, and playback waits for half
+// the latency to build up again before resuming, so a starved device doesn't crackle on every callback.
+class AudioStream
+{
+public:
+    explicit AudioStream(unsigned int latencyMs = AUDIO_LATENCY_MS);
+
+    // Producer: generates the samples up to chip8.cycles()
+    void produce(const Chip8& chip8);
+
+    // Producer: continues from chip8.cycles() without generating the gap, e.g. after a rewind or a pause
+    void resync(const Chip8& chip8);
+
+    // Consumer: fills `samples` completely, with silence for whatever is missing; returns how many
+    // samples came from the ring
+    size_t consume(int16_t* samples, size_t count);
+
+    // Statistics, safe to read from any thread
+    unsigned long long samplesProduced() const { return produced_.load(std::memory_order_relaxed); }
+    unsigned long long samplesDropped() const { return dropped_.load(std::memory_order_relaxed); }      // Over the latency cap
+    unsigned long long underruns() const { return underruns_.load(std::memory_order_relaxed); }         // Times the ring ran dry
+    unsigned long long underrunSamples() const { return underrunSamples_.load(std::memory_order_relaxed); }
+    size_t buffered() const { return ring_.size(); }
+    double latencyMs() const { return buffered() * 1000.0 / AUDIO_SAMPLE_RATE; }   // Of the samples waiting now
+    size_t maxBuffered() const { return maxBuffered_; }
+
+private:
+    static constexpr size_t CHUNK = 256;    // Samples generated at a time
+
+    SampleRing ring_;
+    size_t maxBuffered_;
+    size_t primeLevel_;
+
+    // Producer only
+    unsigned long long nextSample_;     // Index of the next sample on the emulated clock
+    uint32_t phase_;                    // Square wave: a full period is 2^32; pattern: 2^25 per bit
+    int16_t chunk_[CHUNK];
+
+    // Consumer only
+    bool primed_;
+
+    std::atomic<unsigned long long> produced_;
+    std::atomic<unsigned long long> dropped_;
+    std::atomic<unsigned long long> underruns_;
+    std::atomic<unsigned long long> underrunSamples_;
+};
+
+// Audio sink that plays nothing
+// Headless runs drain the stream through it after producing, so the producer path costs the same
+// as with a device and can be benchmarked.
+class NullAudioSink
+{
+public:
+    explicit NullAudioSink(AudioStream& stream) : stream_(stream), samples_(0) {}
+
+    // Consumes the samples waiting, a device buffer at a time as a device would; returns how many
+    // there were. Less than a device buffer is left for the next call.
+    size_t drain();
+
+    unsigned long long samples() const { return samples_; }
+
+private:
+    AudioStream& stream_;
+    unsigned long long samples_;
+    int16_t buffer_[AUDIO_DEVICE_SAMPLES];
+};
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <SDL.h>
+#include "audio.hpp"
+
+// Plays an AudioStream on the default SDL audio device
+// The device's callback runs on SDL's audio thread and only calls AudioStream::consume(), which
+// neither locks nor allocates. Without an audio device the emulator runs silently.
+class AudioOutput {
+public:
+    explicit AudioOutput(AudioStream& stream);
+    ~AudioOutput();
+    AudioOutput(const AudioOutput&) = delete;
+    AudioOutput& operator=(const AudioOutput&) = delete;
+
+    bool isOpen() const { return device_ != 0; }
+
+private:
+    AudioStream& stream_;
+    SDL_AudioDeviceID device_;  // 0 if no device could be opened
+
+    static void callback(void* userdata, Uint8* stream, int length);
+};
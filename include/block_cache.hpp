@@ -0,0 +1,64 @@
+#pragma once
+
+#include "chip8.hpp"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Predecoded basic-block cache
+// Straight-line runs of CHIP-8 code are decoded once into blocks of micro-ops with their operands
+// already extracted, so running them skips the fetch, the nibble extraction and the table hops of
+// Chip8::cycle(). Common instruction pairs are fused into a single superinstruction:
+//   Annn + Dxyn          (point I at a sprite and draw it)
+//   6xkk + 6xkk          (load two registers)
+//   7xkk + 3xkk / 4xkk   (loop counter increment and test)
+// A block ends after any instruction that can change the program counter, and after Fx33/Fx55,
+// which may write into code: if such a write hits a cached block, the whole cache is flushed.
+
+struct MicroOp
+{
+    typedef void (*Handler)(Chip8& chip8, const MicroOp& op);
+
+    Handler handler;
+    uint16_t address;   // Address of the (first) instruction
+    uint16_t opcode;    // Opcode of the last instruction covered, as the interpreter leaves it in Chip8::opcode
+    uint16_t nnn;       // 12-bit address operand of the first instruction
+    uint8_t x;          // Register operands and byte constant of the first instruction
+    uint8_t y;
+    uint8_t kk;
+    uint8_t x2;         // Register operand and byte constant of the second instruction of a fused pair
+    uint8_t kk2;
+    uint8_t length;     // Number of CHIP-8 instructions covered (2 for fused pairs)
+};
+
+struct Block
+{
+    uint16_t start;                 // Address of the first instruction
+    uint16_t end;                   // Address after the last instruction
+    std::vector<MicroOp> ops;
+};
+
+class BlockCache
+{
+public:
+    BlockCache();
+
+    void run(Chip8& chip8, unsigned long long cycles);
+    void flush();
+
+    unsigned long long blocksCompiled() const { return compiled_; }
+    unsigned long long flushes() const { return flushes_; }
+
+private:
+    std::vector<std::unique_ptr<Block>> blocks_;    // Owns every cached block
+    Block* lookup_[MEMORY_SIZE];                    // Block starting at each address, if any
+    uint8_t covered_[MEMORY_SIZE];                  // Non-zero for every byte of code in a cached block
+    unsigned long long compiled_;
+    unsigned long long flushes_;
+    bool flushPending_;                             // A write hit cached code; flush once the block ends
+
+    struct Ops;     // Micro-op handlers, defined in block_cache.cpp
+
+    Block* compile(const Chip8& chip8, uint16_t start);
+    void checkCodeWrite(uint16_t address, unsigned int length);
+};
@@ -1,41 +1,360 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
-#include <random>
-#include <chrono>
+#include <memory>
 #include <string>
 
+// Builds configured with -DCHIP8_PROFILE=ON count every instruction the interpreter runs (see Profiler)
+// Off by default: the hooks and the profiler itself are compiled out
+#ifndef CHIP8_PROFILE
+#define CHIP8_PROFILE 0
+#endif
+
 const unsigned int KEY_COUNT = 16;
-const unsigned int MEMORY_SIZE = 4096;
+const unsigned int MEMORY_SIZE = 0x1000; // CHIP-8 and SUPER-CHIP have 4KB
+const unsigned int XOCHIP_MEMORY_SIZE = 0x10000; // XO-CHIP has 64KB, only allocated for that machine
+const unsigned int START_ADDRESS = 0x200; // ROMs are loaded and start running here
+const unsigned int MAX_ROM_SIZE = MEMORY_SIZE - START_ADDRESS;
+const unsigned int XOCHIP_MAX_ROM_SIZE = XOCHIP_MEMORY_SIZE - START_ADDRESS;
 const unsigned int REGISTER_COUNT = 16;
 const unsigned int STACK_LEVELS = 16;
-const unsigned int VIDEO_HEIGHT = 32;
+const unsigned int FLAG_REGISTERS = 16;   // SUPER-CHIP's RPL user flags (Fx75/Fx85); XO-CHIP has 16, SUPER-CHIP 8
+const unsigned int VIDEO_HEIGHT = 32;     // CHIP-8 display, and the low resolution of the later machines
 const unsigned int VIDEO_WIDTH = 64;
+const unsigned int HIRES_HEIGHT = 64;     // SUPER-CHIP and XO-CHIP high resolution
+const unsigned int HIRES_WIDTH = 128;
+const unsigned int VIDEO_ROW_WORDS = HIRES_WIDTH / 64;
+const unsigned int VIDEO_PLANES = 2;      // XO-CHIP bitplanes
+const unsigned int AUDIO_PATTERN_SIZE = 16; // XO-CHIP audio pattern buffer (F002), 128 one-bit samples
+
+// Set the clock speed of the CHIP-8 CPU
+// This value determines how many CPU cycles are executed per second
+// Adjust this value to change the overall speed of the emulation
+const unsigned int CHIP8_CLOCK_SPEED = 500; // Hz
+
+// Rate at which the display is refreshed and the timers count down
+const unsigned int CHIP8_FRAME_RATE = 60; // Hz
+
+// Number of CPU cycles executed before the given frame starts
+inline unsigned long long frameStartCycle(unsigned long long frame)
+{
+    return frame * CHIP8_CLOCK_SPEED / CHIP8_FRAME_RATE;
+}
+
+// Number of frame boundaries crossed once `cycle` instructions have run: the largest frame whose
+// frameStartCycle is not after `cycle`
+inline unsigned long long frameAtCycle(unsigned long long cycle)
+{
+    return ((cycle + 1) * CHIP8_FRAME_RATE - 1) / CHIP8_CLOCK_SPEED;
+}
+
+// The delay or sound timer, which counts down at 60 Hz
+// Nothing decrements it: it keeps the value it was last set to and the frame that happened in, and
+// its current value is derived from the CPU's cycle counter when it is read.
+struct Chip8Timer
+{
+    uint8_t value;              // Value written by Fx15/Fx18
+    unsigned long long frame;   // frameAtCycle() when it was written
+
+    uint8_t at(unsigned long long now) const
+    {
+        unsigned long long elapsed = now - frame;
+        return elapsed < value ? static_cast<uint8_t>(value - elapsed) : 0;
+    }
+
+    void set(uint8_t newValue, unsigned long long now)
+    {
+        value = newValue;
+        frame = now;
+    }
+};
+
+// Small xorshift32 generator used by RND (Cxkk)
+// It keeps the random state of an instance to 4 bytes and has no shared state, so thousands of
+// Chip8 instances can run side by side on different threads without contention.
+struct Chip8Random
+{
+    uint32_t state;
+
+    void seed(uint32_t value)
+    {
+        // xorshift must never be seeded with zero
+        state = value != 0 ? value : 0x2545F491u;
+    }
+
+    uint8_t nextByte()
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return static_cast<uint8_t>(state >> 24); // The high bits have the best quality
+    }
+};
+
+// The machine a ROM is written for
+enum class Machine
+{
+    Chip8,      // The original: 64x32, 4KB
+    SuperChip,  // SUPER-CHIP 1.1: adds 128x64, scrolling, 16x16 sprites, a large font and RPL flags
+    XoChip      // XO-CHIP: SUPER-CHIP plus 64KB, two bitplanes, F000 nnnn, register ranges and audio patterns
+};
+
+bool parseMachine(const std::string& name, Machine& machine);
+
+// Quirk policies
+// The CHIP-8 variants disagree on a handful of instructions. A quirk set is a type whose constants
+// the affected op_* handlers are specialised on, so every set gets its own dispatch loop with the
+// behaviours it does not have compiled out; the loop is picked when the machine or quirk set is
+// selected, never per instruction.
+struct OriginalQuirks   // What this interpreter always did; the only set the engines other than the interpreter implement
+{
+    static constexpr bool shiftUsesVy = false;      // 8xy6/8xyE shift Vy into Vx, instead of shifting Vx in place
+    static constexpr bool indexIncrements = true;   // Fx55/Fx65 leave I after the last register, instead of unchanged
+    static constexpr bool jumpUsesVx = false;       // Bxnn jumps to xnn + Vx, instead of Bnnn to nnn + V0
+    static constexpr bool wrapSprites = false;      // Dxyn wraps sprites around the edges, instead of clipping them
+    static constexpr bool logicResetsVf = false;    // 8xy1, 8xy2 and 8xy3 clear VF
+};
+
+struct VipQuirks        // COSMAC VIP
+{
+    static constexpr bool shiftUsesVy = true;
+    static constexpr bool indexIncrements = true;
+    static constexpr bool jumpUsesVx = false;
+    static constexpr bool wrapSprites = false;
+    static constexpr bool logicResetsVf = true;
+};
+
+struct SuperChipQuirks  // SUPER-CHIP 1.1
+{
+    static constexpr bool shiftUsesVy = false;
+    static constexpr bool indexIncrements = false;
+    static constexpr bool jumpUsesVx = true;
+    static constexpr bool wrapSprites = false;
+    static constexpr bool logicResetsVf = false;
+};
+
+struct XoChipQuirks     // XO-CHIP, as Octo runs it
+{
+    static constexpr bool shiftUsesVy = true;
+    static constexpr bool indexIncrements = true;
+    static constexpr bool jumpUsesVx = false;
+    static constexpr bool wrapSprites = true;
+    static constexpr bool logicResetsVf = false;
+};
+
+enum class QuirkSet
+{
+    Auto,       // The machine's own set: Original for CHIP-8, SuperChip and XoChip for the others
+    Original,
+    Vip,
+    SuperChip,
+    XoChip
+};
+
+bool parseQuirkSet(const std::string& name, QuirkSet& quirks);
+
+// The display, as the CPU draws it and frontends present it
+// One bit per pixel; bit 63 of the first word of a row is its leftmost pixel. In low resolution
+// (64x32) only the first word of the first VIDEO_HEIGHT rows is used, in high resolution (128x64) two
+// words per row. XO-CHIP draws into two planes, whose pixels combine into four colours.
+struct Display
+{
+    uint64_t planes[VIDEO_PLANES][HIRES_HEIGHT][VIDEO_ROW_WORDS];
+    bool hires;
+    uint8_t planeCount;     // Planes shown: 2 on XO-CHIP, 1 otherwise
+
+    unsigned int width() const { return hires ? HIRES_WIDTH : VIDEO_WIDTH; }
+    unsigned int height() const { return hires ? HIRES_HEIGHT : VIDEO_HEIGHT; }
+    unsigned int words() const { return hires ? VIDEO_ROW_WORDS : 1; }
+};
+
+// Execution engines that can run the CPU
+// All of them produce exactly the same machine state as repeated calls to Chip8::cycle()
+enum class Engine
+{
+    Interpreter,    // Fetch, decode and dispatch every instruction through the function pointer tables
+    Threaded,       // Decode through a 64K opcode table and dispatch with threaded code (see threaded.hpp)
+    BlockCache,     // Run predecoded straight-line blocks of micro-ops (see block_cache.hpp)
+    Jit,            // Run blocks translated to native x86-64 code (see jit.hpp)
+    JitVerify,      // Jit, checked in lockstep against Chip8::cycle()
+    Aot             // Run the ahead-of-time recompiled program matching the ROM, if one is linked in (see aot.hpp)
+};
+// The SUPER-CHIP and XO-CHIP machines and the quirk sets other than Original always run through the
+// interpreter, whatever the engine
+
+bool parseEngine(const std::string& name, Engine& engine);
+
+// Save states
+// A snapshot is a fixed-size block holding the complete machine state, including the display, the
+// keypad and the random number generator, in host byte order behind a small versioned header.
+// Snapshots are meant for rollback, search and crash reproduction on the same build, not as a
+// portable file format.
+const uint32_t SNAPSHOT_MAGIC = 0x53533843; // "C8SS" in little endian
+// Only the active machine's address space is stored, so XO-CHIP snapshots are larger.
+const uint16_t SNAPSHOT_VERSION = 4;
+const size_t SNAPSHOT_HEADER_SIZE = 8;      // Magic, version, machine, and a reserved byte
+const size_t SNAPSHOT_SIZE = SNAPSHOT_HEADER_SIZE
+    + MEMORY_SIZE + REGISTER_COUNT + sizeof(uint16_t) * 2 // memory, V0-VF, I, pc
+    + sizeof(uint16_t) * STACK_LEVELS + 1 + sizeof(uint16_t) // stack, sp, opcode
+    + sizeof(uint32_t)                                      // random number generator
+    + sizeof(uint64_t) + 2 * (1 + sizeof(uint64_t))         // cycle counter, timers
+    + KEY_COUNT                                             // keypad
+    + sizeof(uint64_t) * VIDEO_PLANES * HIRES_HEIGHT * VIDEO_ROW_WORDS + 1 + 1 // display planes, resolution, plane mask
+    + FLAG_REGISTERS + AUDIO_PATTERN_SIZE + 1               // RPL flags, audio pattern, pitch
+    + 1 + sizeof(uint64_t);                                 // drawFlag, dirty rows (flags are stored as one byte)
+const size_t XOCHIP_SNAPSHOT_SIZE = SNAPSHOT_SIZE - MEMORY_SIZE + XOCHIP_MEMORY_SIZE;
+
+class BlockCache;
+class Jit;
+class Aot;
+class Profiler;
+class TraceWriter;
 
 class Chip8
 {
 public:
     Chip8();
-    void loadROM(const std::string& filename);
-    void setupTable();
+    ~Chip8();
+    Chip8(const Chip8&) = delete;
+    Chip8& operator=(const Chip8&) = delete;
+
+    // Both return false, leaving memory untouched, if the ROM can't be read or doesn't fit in the
+    // selected machine's memory (see maxRomSize)
+    bool loadROM(const std::string& filename);
+    bool loadROM(const uint8_t* data, size_t size);
+    static void setupTable();
     void cycle();
+    void run(unsigned long long cycles);
+    unsigned long long runUnpaced(unsigned long long cycle, unsigned long long endCycle);
+    void setEngine(Engine engine);
+    Engine getEngine() const { return engine; }
+
+    // Selects the machine the ROM is written for; call before loading it, as it clears the display
+    void setMachine(Machine machine);
+    Machine getMachine() const { return machine; }
+
+    // Size of the selected machine's address space, the largest ROM it takes, and its snapshot size
+    unsigned int memorySize() const { return addressMask + 1u; }
+    unsigned int maxRomSize() const { return memorySize() - START_ADDRESS; }
+    size_t snapshotSize() const { return machine == Machine::XoChip ? XOCHIP_SNAPSHOT_SIZE : SNAPSHOT_SIZE; }
+
+    // Selects the quirk set (Auto by default); call before loading the ROM, like setMachine
+    // Sets other than Original always run through the interpreter, whatever the engine.
+    void setQuirks(QuirkSet quirks);
+    QuirkSet getQuirks() const { return quirks; }   // The set in effect, never Auto
+    const Jit* getJit() const { return jit.get(); }
+    const Aot* getAot() const { return aot.get(); }
+#if CHIP8_PROFILE
+    Profiler& getProfiler() { return *profiler; }
+#endif
+
+    // Reseeds RND (Cxkk); by default every instance is seeded from the clock
+    // Runs with the same ROM, seed and input (see InputMovie) are bit-exact on every engine
+    void seedRandom(uint32_t seed) { randGen.seed(seed); }
+
+    // Instructions executed since the machine was created; the emulated clock
+    unsigned long long cycles() const { return cycleCount; }
+
+    // Current timer values, derived from the cycle counter (see Chip8Timer)
+    uint8_t getDelayTimer() const { return delayTimer.at(frameAtCycle(cycleCount)); }
+    uint8_t getSoundTimer() const { return soundTimer.at(frameAtCycle(cycleCount)); }
+    void setDelayTimer(uint8_t value) { delayTimer.set(value, frameAtCycle(cycleCount)); }
+    void setSoundTimer(uint8_t value) { soundTimer.set(value, frameAtCycle(cycleCount)); }
+
+    // XO-CHIP sound: the 128-bit pattern played while the sound timer runs, and its pitch (Fx3A)
+    const uint8_t* getAudioPattern() const { return audioPattern; }
+    uint8_t getPitch() const { return pitch; }
+
+    // Idle-loop skipping (on by default)
+    // run() recognises loops that can only end on a timer or keypad change (a jump to itself, Fx0A
+    // with no key down, Ex9E/ExA1 + 1nnn polling a key, Fx07 + 3xkk/4xkk + 1nnn polling the delay
+    // timer) and advances the clock over their iterations at once, leaving the same state behind.
+    void setIdleSkip(bool enabled) { idleSkip = enabled; }
+    unsigned long long idleSkips() const { return idleSkipCount; }           // Loops skipped
+    unsigned long long idleCyclesSkipped() const { return idleSkippedCycles; } // Instructions not executed
+
+    // Records every instruction run() executes into `writer` until it is set back to nullptr
+    // While a trace is attached every instruction goes through the interpreter and idle loops are
+    // executed rather than skipped, whatever the engine, so the trace is complete.
+    void setTrace(TraceWriter* writer) { trace = writer; }
+
     bool drawFlag;
-    uint8_t delayTimer; // Delay timer
-    uint8_t soundTimer; // Sound timer
     uint8_t keypad[KEY_COUNT];
-    uint32_t video[VIDEO_WIDTH * VIDEO_HEIGHT];
+    Display video;
+
+    // Returns the rows (bit y for row y) the CPU has drawn to, cleared or scrolled since the last call
+    // A frontend only needs to look at these rows to find what changed since it last presented; a
+    // change of resolution marks every row
+    uint64_t takeDirtyRows() { uint64_t rows = dirtyRows; dirtyRows = 0; return rows; }
+
+    // Writes the complete machine state into `buffer` without allocating
+    // Returns the number of bytes written (snapshotSize()), or 0 if the buffer is too small
+    size_t saveState(void* buffer, size_t size) const;
+
+    // Restores a state written by saveState; the selected engine is kept
+    // Returns false, leaving the machine untouched, if the buffer does not hold a snapshot of this
+    // version and of the selected machine
+    bool loadState(const void* buffer, size_t size);
 
 private:
-    uint8_t memory[MEMORY_SIZE]; // Chip-8 has 4KB of memory
+    uint8_t* memory; // The selected machine's address space: chip8Memory, or xoChipMemory on XO-CHIP
+    uint16_t addressMask; // Address space size - 1; addresses computed from I or PC wrap around it
+    uint8_t chip8Memory[MEMORY_SIZE]; // Chip-8 and SUPER-CHIP have 4KB of memory
+    std::unique_ptr<uint8_t[]> xoChipMemory; // Only allocated while XO-CHIP is selected
     uint8_t registers[REGISTER_COUNT]; // 16 general-purpose registers (V0 to VF)
     uint16_t index; // Index register (I)
     uint16_t pc; // Program counter (PC)
     uint16_t stack[STACK_LEVELS]; // Stack for subroutine calls
     uint8_t sp; // Stack pointer
     uint16_t opcode;
-
-    std::default_random_engine randGen;
-    std::uniform_int_distribution<unsigned int> randByte;
+    uint64_t dirtyRows; // Rows changed by Dxyn, 00E0 or a scroll since the last takeDirtyRows()
+    uint8_t planeMask; // Planes Dxyn, 00E0 and the scrolls work on (XO-CHIP Fn01); bit p is plane p
+    uint8_t flags[FLAG_REGISTERS]; // RPL user flags (Fx75/Fx85)
+    uint8_t audioPattern[AUDIO_PATTERN_SIZE]; // XO-CHIP audio pattern (F002)
+    uint8_t pitch; // XO-CHIP playback pitch of the audio pattern (Fx3A)
+    Machine machine;
+    QuirkSet requestedQuirks;                           // As given to setQuirks
+    QuirkSet quirks;                                    // requestedQuirks with Auto resolved for the machine
+    void (Chip8::*stepQuirks)();                        // step<> and interpret<> for `quirks`
+    void (Chip8::*interpretQuirks)(unsigned long long);
+    unsigned long long cycleCount; // Instructions executed; engines keep it exact whenever a timer is accessed
+    Chip8Timer delayTimer; // Delay timer
+    Chip8Timer soundTimer; // Sound timer
+
+    Chip8Random randGen;
+
+    bool idleSkip;
+    unsigned long long idleSkipCount;     // Statistics, not machine state: never part of a snapshot
+    unsigned long long idleSkippedCycles;
+    TraceWriter* trace;                   // Not owned; nullptr unless tracing
+
+    Engine engine;
+    std::unique_ptr<BlockCache> blockCache; // Only allocated while the block cache engine is selected
+    std::unique_ptr<Jit> jit;               // Only allocated while a JIT engine is selected
+    std::unique_ptr<Aot> aot;               // Only allocated while the AOT engine is selected
+#if CHIP8_PROFILE
+    std::unique_ptr<Profiler> profiler;
+#endif
+
+    friend class BlockCache;
+    friend class Jit;
+    friend class Aot;
+    friend class Threaded;
+
+    void invalidateCode();
+    void selectQuirks();
+    void selectMemory();
+    template <typename Quirks> void step();
+    template <typename Quirks> void interpret(unsigned long long cycles);
+    void skip();
+    void clearDisplay();
+    void drawExtended(bool wrap);
+    void scroll(int rows, int pixels);
+    unsigned long long skipIdleLoop(unsigned long long cycles);
+    void tracedCycle();
+    void copyStateFrom(const Chip8& other);
+    template <typename Transfer> void transferState(Transfer& transfer);
 
     //CLS
     void op_00E0();
@@ -68,13 +387,13 @@ private:
     void op_8xy0();
 
     //OR Vx, Vy
-    void op_8xy1();
+    template <typename Quirks> void op_8xy1();
 
     //AND Vx, vy
-    void op_8xy2();
+    template <typename Quirks> void op_8xy2();
 
     //XOR Vx, Vy
-    void op_8xy3();
+    template <typename Quirks> void op_8xy3();
 
     //ADD Vx, Vy
     void op_8xy4();
@@ -83,13 +402,13 @@ private:
     void op_8xy5();
 
     //SHR Vx {, Vy}
-    void op_8xy6();
+    template <typename Quirks> void op_8xy6();
 
     //SUBN Vx, Vy
     void op_8xy7();
 
     //SHL Vx {, Vy}
-    void op_8xyE();
+    template <typename Quirks> void op_8xyE();
 
     //SNE Vx, Vy
     void op_9xy0();
@@ -98,13 +417,13 @@ private:
     void op_Annn();
 
     //Vp V0, addr
-    void op_Bnnn();
+    template <typename Quirks> void op_Bnnn();
 
     //RND Vx, byte
     void op_Cxkk();
 
     //DRW Vx, Vy, nibble
-    void op_Dxyn();
+    template <typename Quirks> void op_Dxyn();
 
     //SKP Vx
     void op_Ex9E();
@@ -134,20 +453,75 @@ private:
     void op_Fx33();
 
     //LD [I], Vx
-    void op_Fx55();
+    template <typename Quirks> void op_Fx55();
 
     //LD Vx, [I]
-    void op_Fx65();
+    template <typename Quirks> void op_Fx65();
+
+    //SUPER-CHIP and XO-CHIP
+
+    //SCD n (scroll down n rows)
+    void op_00Cn();
+
+    //SCU n (XO-CHIP: scroll up n rows)
+    void op_00Dn();
+
+    //SCR (scroll right 4 pixels)
+    void op_00FB();
+
+    //SCL (scroll left 4 pixels)
+    void op_00FC();
+
+    //EXIT
+    void op_00FD();
+
+    //LOW
+    void op_00FE();
+
+    //HIGH
+    void op_00FF();
+
+    //LD [I], Vx-Vy (XO-CHIP)
+    void op_5xy2();
+
+    //LD Vx-Vy, [I] (XO-CHIP)
+    void op_5xy3();
+
+    //LD I, nnnn (XO-CHIP, followed by the 16-bit address)
+    void op_F000();
+
+    //PLANE n (XO-CHIP)
+    void op_Fn01();
+
+    //AUDIO (XO-CHIP: load the audio pattern from [I])
+    void op_F002();
+
+    //LD HF, Vx (large font)
+    void op_Fx30();
+
+    //PITCH Vx (XO-CHIP)
+    void op_Fx3A();
+
+    //LD R, Vx
+    void op_Fx75();
+
+    //LD Vx, R
+    void op_Fx85();
+
+    //Unknown opcode
+    void op_NULL();
 
     void Table0();
     void Table8();
     void TableE();
     void TableF();
 
+    // The dispatch tables are shared by all instances, so they are only set up once
     typedef void (Chip8::*Chip8Func)();
-    Chip8Func table[0xF + 1];
-    Chip8Func table0[0xE + 1];
-    Chip8Func table8[0xE + 1];
-    Chip8Func tableE[0xE + 1];
-    Chip8Func tableF[0x65 + 1];
+    static Chip8Func table[0xF + 1];
+    static Chip8Func table0[0xF + 1];
+    static Chip8Func table00[0xFF + 1];    // 00nn on SUPER-CHIP and XO-CHIP, which decode the whole byte
+    static Chip8Func table8[0xF + 1];
+    static Chip8Func tableE[0xF + 1];
+    static Chip8Func tableF[0xFF + 1];
 };
\ No newline at end of file
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "chip8.hpp"
+#include "offscreen_renderer.hpp"
+#include "pixel_expand.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Video formats the frame exporter writes
+enum class ExportFormat
+{
+    Y4m,    // YUV4MPEG2, 4:4:4 (BT.601, studio range), 60 fps; what most encoders read from a pipe
+    Rgba    // Raw frames of R, G, B, A bytes, no header; the size is reported by the frontends
+};
+
+bool parseExportFormat(const std::string& name, ExportFormat& format);
+
+const size_t EXPORT_QUEUE_SIZE = 64;            // Frames waiting for the writer; a power of two
+const size_t EXPORT_BATCH_SIZE = 1 << 20;       // Bytes of converted frames collected before a write
+
+// Frame exporter
+// Streams emulated frames to a file or to stdout ("-") for recordings and regression runs. The
+// emulation thread only copies the display into a lock-free single-producer single-consumer queue;
+// a writer thread scales it and converts the palette straight into a batch buffer, which is written
+// with one call when it is full or when no frame is waiting.
+//
+// Every frame is written, unless a timecodes file is given: then only frames that differ from the
+// previous one are, and each gets a line with its time in milliseconds (Matroska timecode format v2,
+// e.g. for mkvmerge --timestamps), so the recording keeps its timing without the repeated frames.
+class FrameExporter
+{
+public:
+    FrameExporter();
+    ~FrameExporter();
+    FrameExporter(const FrameExporter&) = delete;
+    FrameExporter& operator=(const FrameExporter&) = delete;
+
+    // Starts writing to `filename`, or to stdout for "-"; returns false, with the reason in error(),
+    // if a file can't be created. The frame size follows OffscreenRenderer with the same arguments.
+    bool open(const std::string& filename, ExportFormat format, unsigned int scale, const Palette& palette,
+              bool highResolution, const std::string& timecodesFilename = std::string());
+
+    // Writes everything submitted so far and closes the files; also done by the destructor
+    void close();
+
+    // Queues the frame for writing; waits only while the queue is full, which a writer that keeps
+    // up at 60 frames per second never lets happen
+    void submit(const Display& video);
+
+    const std::string& error() const { return error_; }
+    unsigned int width() const { return renderer_->width(); }
+    unsigned int height() const { return renderer_->height(); }
+
+    // Statistics, complete once close() returns
+    unsigned long long framesSubmitted() const { return submitted_; }
+    unsigned long long framesWritten() const { return written_; }
+    unsigned long long bytesWritten() const { return bytes_; }
+    unsigned long long writes() const { return writes_; }         // Calls to fwrite
+    unsigned long long stalls() const { return stalls_; }         // Times submit() found the queue full
+    bool failed() const { return failed_; }                       // A write failed; later frames were discarded
+
+private:
+    struct Slot
+    {
+        Display video;
+        unsigned long long frame;
+    };
+
+    std::vector<Slot> slots_;
+    alignas(64) std::atomic<size_t> head_;      // Frames ever submitted
+    alignas(64) std::atomic<size_t> tail_;      // Frames ever converted
+    std::atomic<bool> stop_;
+    std::thread writer_;
+
+    FILE* file_;
+    FILE* timecodes_;
+    ExportFormat format_;
+    std::unique_ptr<OffscreenRenderer> renderer_;   // Scales RGBA frames, with the colours in byte order
+    uint8_t yuv_[4][3];                         // Y, U and V of the off, on, second and both colours
+    size_t frameSize_;                          // Bytes per frame, header included
+    std::string error_;
+
+    // Producer only
+    unsigned long long submitted_;
+    unsigned long long stalls_;
+
+    // Writer only
+    std::vector<uint8_t> batch_;
+    size_t batchUsed_;
+    std::vector<uint8_t> lineColors_;           // Y4M: palette index of every pixel of an output line
+    Display last_;
+    unsigned long long written_;
+    unsigned long long bytes_;
+    unsigned long long writes_;
+    bool failed_;
+
+    void writerLoop();
+    bool drain();
+    void convert(const Display& video, uint8_t* out);
+    void flushBatch();
+};
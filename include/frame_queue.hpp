@@ -0,0 +1,42 @@
+#pragma once
+
+#include "chip8.hpp"
+#include <atomic>
+#include <cstdint>
+
+// Lock-free triple buffer of completed frames
+// One thread (the emulation) writes frames, another (the presentation) reads the most recent one.
+// Of the three slots the producer owns one, the consumer owns one, and the third is swapped between
+// them with a single atomic exchange, so neither side ever waits for the other: the producer always
+// has a free slot to write into and the consumer always gets the newest published frame.
+//
+// Frames the consumer never picked up are dropped, but their dirty rows are carried into the next
+// published frame, so the consumer can still upload only the rows that changed since its last frame.
+class FrameQueue
+{
+public:
+    struct Frame
+    {
+        Display video;
+        uint64_t dirtyRows;         // Rows changed since the frame the consumer acquired before
+        unsigned long long cycle;   // Chip8::cycles() at the end of the frame
+    };
+
+    FrameQueue();
+
+    // Producer: fill in every field of back(), then publish() it; back() is a different slot afterwards
+    Frame& back() { return frames_[back_]; }
+    void publish();
+
+    // Consumer: returns the newest published frame, or nullptr if nothing was published since the
+    // last call. The frame stays valid until the next call.
+    const Frame* acquire();
+
+private:
+    static const uint8_t FRESH = 0x4;   // Set in middle_ when it holds a frame the consumer has not seen
+
+    Frame frames_[3];
+    alignas(64) std::atomic<uint8_t> middle_;   // Slot index of the swapped slot, plus FRESH
+    alignas(64) uint8_t back_;                  // Producer only
+    alignas(64) uint8_t front_;                 // Consumer only
+};
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "chip8.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// x86-64 dynamic recompiler
+// Translates the straight-line block of CHIP-8 code starting at pc into native code the first time
+// it is reached. Register and index operations are emitted as native instructions working directly
+// on the Chip8 object; Annn and Fx1E store I right away. pc is known at compile time inside a block,
+// so it is only stored before calling back into the interpreter and when the block exits. Complex
+// instructions such as Dxyn, Fx0A or 2nnn/00EE call back into the interpreter's op_* handlers, and
+// so do the timer instructions, with their offset into the block so they see the exact cycle count
+// the timers are derived from. Blocks end like the block cache's: at any instruction that can
+// change pc and after Fx33/Fx55; a write that hits translated code flushes all translations.
+//
+// Every translated block checks the remaining cycle budget before each instruction, so a run stops
+// on exactly the same instruction as Chip8::cycle() would.
+//
+// In verify mode a shadow Chip8 runs the same instructions through Chip8::cycle() in lockstep; any
+// difference in machine state after a block is reported on std::cerr and counted as a divergence.
+//
+// On other architectures the JIT is not available and runs the interpreter instead.
+class Jit
+{
+public:
+    explicit Jit(bool verify);
+    ~Jit();
+    Jit(const Jit&) = delete;
+    Jit& operator=(const Jit&) = delete;
+
+    static bool available();
+
+    void run(Chip8& chip8, unsigned long long cycles);
+    void flush();
+
+    unsigned long long blocksCompiled() const { return compiled_; }
+    unsigned long long flushes() const { return flushes_; }
+    unsigned long long divergences() const { return divergences_; }
+
+private:
+    // Translated block: runs at most `budget` instructions and returns how many it ran
+    typedef uint32_t (*BlockFunc)(Chip8* chip8, uint32_t budget);
+
+    uint8_t* arena_;                    // Executable memory holding the translations
+    size_t arenaSize_;
+    size_t arenaUsed_;
+    BlockFunc entries_[MEMORY_SIZE];    // Translation starting at each address, if any
+    uint8_t covered_[MEMORY_SIZE];      // Non-zero for every byte of translated code
+    bool flushPending_;                 // A write hit translated code; flush once the block returns
+
+    unsigned long long compiled_;
+    unsigned long long flushes_;
+
+    bool verify_;
+    std::unique_ptr<Chip8> shadow_;     // Interpreter copy used in verify mode
+    unsigned long long divergences_;
+
+    struct Ops;     // Native code emitter and interpreter callbacks, defined in jit.cpp
+
+    BlockFunc compile(const Chip8& chip8, uint16_t start);
+    void checkCodeWrite(uint16_t address, unsigned int length);
+    void verify(const Chip8& chip8, uint16_t start, uint32_t executed);
+};
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+// Lowest level compiled in: 0 trace, 1 debug, 2 info, 3 warn, 4 error, 5 nothing
+// Calls below it are removed at compile time, arguments included. CMake sets it from the
+// CHIP8_LOG_LEVEL cache option (trace, debug, info, warn, error or off).
+#ifndef CHIP8_LOG_LEVEL
+#define CHIP8_LOG_LEVEL 1
+#endif
+
+enum LogLevel : uint8_t
+{
+    LOG_LEVEL_TRACE = 0,
+    LOG_LEVEL_DEBUG = 1,
+    LOG_LEVEL_INFO = 2,
+    LOG_LEVEL_WARN = 3,
+    LOG_LEVEL_ERROR = 4,
+};
+
+// Logs a message at the given level, e.g. LOG_DEBUG("Key {} pressed", key)
+// `format` must be a string literal: only the pointer is stored. Each {} takes the next argument,
+// {x} prints an integer in hex. Arguments can be integers, enums, bools, doubles and C strings.
+#define CHIP8_LOG(level, ...) \
+    do { \
+        if ((level) >= CHIP8_LOG_LEVEL) { \
+            Logger::instance().write((level), __VA_ARGS__); \
+        } \
+    } while (0)
+
+#define LOG_TRACE(...) CHIP8_LOG(LOG_LEVEL_TRACE, __VA_ARGS__)
+#define LOG_DEBUG(...) CHIP8_LOG(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...) CHIP8_LOG(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARN(...) CHIP8_LOG(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_ERROR(...) CHIP8_LOG(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+const unsigned int LOG_MAX_ARGS = 4;
+const unsigned int LOG_TEXT_SIZE = 48;     // Bytes for the string arguments of one message, terminators included
+const size_t LOG_RING_SIZE = 1024;         // Messages that can be waiting for the writer; a power of two
+
+// A message as it waits in the ring: the format pointer and the raw argument values
+// Nothing is formatted on the logging thread.
+struct LogRecord
+{
+    enum ArgType : uint8_t { ARG_SIGNED, ARG_UNSIGNED, ARG_DOUBLE, ARG_TEXT };
+
+    const char* format;
+    LogLevel level;
+    uint8_t count;
+    uint8_t textUsed;
+    ArgType types[LOG_MAX_ARGS];
+    union
+    {
+        int64_t i;
+        uint64_t u;
+        double d;
+    } values[LOG_MAX_ARGS];                 // ARG_TEXT holds the offset of the string in `text`
+    char text[LOG_TEXT_SIZE];
+};
+
+// Asynchronous logger
+// Messages are written into a preallocated bounded ring (Vyukov's multi-producer queue: one atomic
+// claim and one release store per message, no locks and no allocation), and a background thread
+// formats them and writes them out. When the ring is full the message is dropped and counted
+// rather than making the caller wait, so logging never stalls input handling or emulation.
+class Logger
+{
+public:
+    static Logger& instance();
+
+    template <typename... Args>
+    void write(LogLevel level, const char* format, const Args&... args)
+    {
+        Cell* cell = claim();
+        if (cell == nullptr) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        LogRecord& record = cell->record;
+        record.format = format;
+        record.level = level;
+        record.count = 0;
+        record.textUsed = 0;
+        int expand[] = { 0, (addArg(record, args), 0)... };
+        (void)expand;
+
+        publish(cell);
+    }
+
+    // Blocks until every message logged so far has been written
+    void flush();
+
+    // Messages lost because the ring was full
+    unsigned long long dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    // Where messages go; stdout by default. Not thread safe: call before logging starts.
+    void setOutput(FILE* output) { output_ = output; }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        LogRecord record;
+    };
+
+    Cell ring_[LOG_RING_SIZE];
+    alignas(64) std::atomic<size_t> enqueuePos_;
+    alignas(64) size_t dequeuePos_;             // Writer thread only
+    std::atomic<unsigned long long> dropped_;
+    std::atomic<bool> stop_;
+    FILE* output_;
+
+    std::mutex flushMutex_;                     // Only used by flush(), never by write()
+    std::condition_variable flushed_;
+    size_t written_;                            // Messages written, guarded by flushMutex_
+    std::thread writer_;
+
+    Logger();
+    ~Logger();
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+
+    Cell* claim();
+    void publish(Cell* cell);
+    void writerLoop();
+    bool drain();
+    void format(const LogRecord& record, char* line, size_t size) const;
+
+    template <typename T>
+    static void addArg(LogRecord& record, const T& value)
+    {
+        if (record.count == LOG_MAX_ARGS) {
+            return;
+        }
+        unsigned int n = record.count++;
+
+        if constexpr (std::is_convertible<T, const char*>::value) {
+            // Strings are copied, truncated to what is left of the text buffer
+            const char* text = value;
+            if (text == nullptr) {
+                text = "(null)";
+            }
+            size_t room = LOG_TEXT_SIZE - record.textUsed;
+            size_t length = room > 0 ? strnlen(text, room - 1) : 0;
+            record.types[n] = LogRecord::ARG_TEXT;
+            record.values[n].u = record.textUsed;
+            if (room > 0) {
+                memcpy(record.text + record.textUsed, text, length);
+                record.text[record.textUsed + length] = '\0';
+                record.textUsed = static_cast<uint8_t>(record.textUsed + length + 1);
+            }
+        } else if constexpr (std::is_floating_point<T>::value) {
+            record.types[n] = LogRecord::ARG_DOUBLE;
+            record.values[n].d = static_cast<double>(value);
+        } else if constexpr (std::is_signed<T>::value) {
+            record.types[n] = LogRecord::ARG_SIGNED;
+            record.values[n].i = static_cast<int64_t>(value);
+        } else {
+            // Unsigned integers, bools and enums
+            record.types[n] = LogRecord::ARG_UNSIGNED;
+            record.values[n].u = static_cast<uint64_t>(value);
+        }
+    }
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "chip8.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A change of one keypad key, applied before the CPU executes instruction number `cycle`
+struct InputEvent
+{
+    unsigned long long cycle;
+    uint8_t key;
+    bool pressed;
+};
+
+// Input movie
+// Records keypad changes keyed by CPU cycle, together with the RND seed, the machine, the quirk set
+// and a checksum of the ROM, so a session can be replayed bit-exactly by a headless run.
+//
+// File format (all integers little endian):
+//   "C8MV", uint16 version, uint8 machine, uint8 quirk set, uint32 seed, uint32 ROM checksum
+//   then one record per event: varint cycles since the previous event, one byte key | pressed << 4
+//   and a final varint cycles since the last event followed by the byte 0xFF, which ends the movie
+class InputMovie
+{
+public:
+    InputMovie();
+
+    uint32_t seed;
+    Machine machine;
+    QuirkSet quirks;            // The set in effect (Chip8::getQuirks), never Auto
+    uint32_t romChecksum;       // FNV-1a of the ROM file, 0 if unknown
+    unsigned long long length;  // Number of cycles the movie covers
+    std::vector<InputEvent> events;
+
+    // Recording: adds an event for every key that changed since the previous capture
+    void capture(unsigned long long cycle, const uint8_t* keypad);
+
+    // Playback: applies the events up to and including `cycle`
+    // Returns the cycle of the next event, or UINT64_MAX when there is none
+    unsigned long long apply(unsigned long long cycle, uint8_t* keypad);
+    unsigned long long nextEventCycle() const;
+    void rewindPlayback() { position_ = 0; }
+
+    bool save(const std::string& filename) const;
+    bool load(const std::string& filename);
+
+    static uint32_t checksumFile(const std::string& filename);
+
+private:
+    uint8_t captured_[KEY_COUNT];   // Keypad at the previous capture
+    size_t position_;               // Next event to apply
+};
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "chip8.hpp"
+#include "pixel_expand.hpp"
+#include <cstddef>
+#include <cstdint>
+
+// Software renderer for machines without a display or GPU
+// Scales the display up by an integer factor into a caller-provided buffer of 32-bit pixels
+// (nearest neighbour, see expandDisplayScaled), for thumbnails, visual diffs and recordings.
+// Like Renderer::update, update() only redraws the rows that changed since the previous frame.
+// With `highResolution` the buffer is sized for the 128x64 display and the 64x32 one is drawn at
+// twice the scale; it is needed for every machine that can switch to high resolution.
+class OffscreenRenderer
+{
+public:
+    explicit OffscreenRenderer(unsigned int scale, const Palette& palette = Palette(), bool highResolution = false);
+
+    unsigned int width() const { return (highResolution_ ? HIRES_WIDTH : VIDEO_WIDTH) * scale_; }
+    unsigned int height() const { return (highResolution_ ? HIRES_HEIGHT : VIDEO_HEIGHT) * scale_; }
+
+    // Renders the whole display into `pixels`: height() lines of width() pixels, `pitch` bytes apart
+    void render(const Display& video, uint32_t* pixels, size_t pitch) const;
+
+    // Redraws the rows that changed since the last update into the same buffer
+    // Returns false, leaving the buffer untouched, when the frame has no net change
+    bool update(const Display& video, uint64_t dirtyRows, uint32_t* pixels, size_t pitch);
+
+    unsigned long long framesRendered() const { return framesRendered_; }
+    unsigned long long framesSkipped() const { return framesSkipped_; }
+
+private:
+    unsigned int scale_;
+    Palette palette_;
+    bool highResolution_;
+    Display shown_;                 // Display currently in the buffer
+
+    // Output lines per display row
+    unsigned int rowScale(const Display& video) const { return highResolution_ && !video.hires ? 2 * scale_ : scale_; }
+    bool rendered_;                 // The buffer has been fully rendered once
+    unsigned long long framesRendered_;
+    unsigned long long framesSkipped_;
+};
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "chip8.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Colours as 0xRRGGBBAA (the SDL_PIXELFORMAT_RGBA8888 layout): `on` and `off` for lit and unlit
+// pixels, and on XO-CHIP `second` for pixels lit only in the second plane and `both` for pixels lit
+// in both
+struct Palette
+{
+    uint32_t on = 0xFFFFFFFF;
+    uint32_t off = 0x000000FF;
+    uint32_t second = 0xAAAAAAFF;
+    uint32_t both = 0x555555FF;
+};
+
+// Parses "ON,OFF" or "ON,OFF,SECOND,BOTH" where each colour is RRGGBB or RRGGBBAA in hex,
+// e.g. "33FF66,002200"
+bool parsePalette(const std::string& text, Palette& palette);
+
+// Expansion of the display into 32-bit pixels
+// Each display row is one 64-bit word per 64 pixels whose bit 63 is the leftmost pixel (see
+// Display). Rows `first` to `first + count - 1` are written to `pixels` row by row, `pitch` bytes
+// apart, each Display::width() pixels wide, so the output can go straight into locked texture memory.
+//
+// The kernel is picked once at run time: AVX2 (8 pixels per step) when the CPU supports it,
+// SSE2 (4 pixels per step) on other x86 CPUs, and a scalar loop elsewhere. Rows where the second
+// XO-CHIP plane has pixels lit pick one of four colours per pixel and always take the scalar loop.
+void expandDisplay(const Display& display, unsigned int first, unsigned int count, const Palette& palette, void* pixels, size_t pitch);
+
+// Same as expandDisplay, with every display pixel scaled up to a `scale` x `scale` block
+// (nearest neighbour); each output line holds Display::width() * scale pixels
+void expandDisplayScaled(const Display& display, unsigned int first, unsigned int count, unsigned int scale, const Palette& palette, void* pixels, size_t pitch);
+
+// Name of the kernels used by expandDisplay and expandDisplayScaled ("avx2", "sse2" or "scalar")
+const char* expandKernelName();
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "chip8.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <vector>
+
+// Number of opcode families counted: one per handler of the threaded engine (see Threaded::Op), then
+// the SUPER-CHIP and XO-CHIP additions
+const unsigned int PROFILE_EXTENDED_FAMILIES = 16;
+const unsigned int PROFILE_FAMILIES = 35 + PROFILE_EXTENDED_FAMILIES;
+
+// Execution profiler
+// Counts what the interpreter spends its cycles on: every instruction by opcode family and by
+// address, the sprite work of Dxyn, and the stack depth at every CALL. Chip8 only owns one and calls
+// it in builds configured with -DCHIP8_PROFILE=ON; in every other build the hooks are compiled out.
+//
+// The hooks sit in Chip8::cycle() and the op_* handlers, so instructions run natively by the
+// threaded, cached, JIT or AOT engines are only seen where those call back into the interpreter, and
+// idle loop iterations skipped by Chip8::run are not seen at all (see Chip8::idleCyclesSkipped).
+// Opcodes are decoded and addresses counted for the machine given to setMachine (Chip8::setMachine
+// does that), so the histogram covers the whole of XO-CHIP's 64KB.
+class Profiler
+{
+public:
+    Profiler();
+    void reset();
+
+    // Decodes for `machine` from now on; the address histogram is resized to its memory and cleared
+    void setMachine(Machine machine);
+
+    // Hooks
+    void instruction(uint16_t pc, uint16_t opcode);
+    void draw() { ++draws_; }
+    // A sprite row as it was XORed into the display: one word, or the two of a high resolution row
+    void drawRow(uint64_t left, uint64_t right = 0) { ++drawRows_; drawPixels_ += popcount(left) + popcount(right); }
+    void call(unsigned int depth) { ++callDepth_[depth <= STACK_LEVELS ? depth : STACK_LEVELS]; }
+    void ret() { ++returns_; }
+
+    unsigned long long instructions() const { return instructions_; }
+
+    // Sorted reports: families and addresses by count, most executed first
+    // The text report lists the `hotspots` hottest addresses; the JSON report lists them all.
+    void writeText(std::ostream& out, size_t hotspots = 16) const;
+    void writeJson(std::ostream& out) const;
+
+private:
+    static unsigned int popcount(uint64_t bits);
+    unsigned int family(uint16_t opcode) const;
+
+    unsigned long long instructions_;
+    unsigned long long families_[PROFILE_FAMILIES];
+    Machine machine_;
+    std::vector<unsigned long long> pcHits_;    // One entry per address of the machine's memory
+    unsigned long long draws_;
+    unsigned long long drawRows_;               // Sprite rows on screen
+    unsigned long long drawPixels_;             // Sprite pixels on screen, each one an XOR and a collision test
+    unsigned long long callDepth_[STACK_LEVELS + 1]; // Stack depth after each CALL
+    unsigned long long returns_;
+};
@@ -1,24 +1,36 @@
 #include <SDL.h>
 #include "chip8.hpp"
-#include <array>
+#include "pixel_expand.hpp"
+#include <atomic>
 
 class Renderer {
 public:
-    Renderer(int scale);
+    Renderer(int scale, const Palette& palette = Palette());
     ~Renderer();
-    void update(const uint32_t* buffer);
-    void handleInput(Chip8& chip8);
-    bool quit() const { return quit_; }
+    bool update(const Display& video, uint64_t dirtyRows);
+    unsigned long long framesPresented() const { return framesPresented_; }
+    unsigned long long framesSkipped() const { return framesSkipped_; }
+    void handleInput();
+
+    // Input state, written by the thread calling handleInput() and safe to read from any thread
+    uint16_t keys() const { return keys_.load(std::memory_order_relaxed); } // Bit k is set while CHIP-8 key k is held
+    bool quit() const { return quit_.load(std::memory_order_relaxed); }
+    bool rewinding() const { return rewinding_.load(std::memory_order_relaxed); } // Backspace is held: play the rewind history backwards
 
 private:
     SDL_Window* window_;       // Pointer to the SDL window
     SDL_Renderer* renderer_;   // Pointer to the SDL renderer
-    std::array<SDL_Texture*, 3> textures_;  // Array of three textures for triple buffering
-    int currentTexture_;       // Index of the current texture being drawn to
+    SDL_Texture* texture_;     // Streaming texture the display is expanded into, sized for high resolution
+    Palette palette_;          // RGBA8888 colours of lit and unlit pixels
+    Display shown_;            // Display currently in the texture
+    bool forcePresent_;        // The window needs repainting even if the display did not change
+    unsigned long long framesPresented_;
+    unsigned long long framesSkipped_;
     int scale_;                // Scale factor for the window size
-    bool quit_;                // Flag to indicate if the application should quit
+    std::atomic<uint16_t> keys_;   // CHIP-8 keys held
+    std::atomic<bool> quit_;       // Flag to indicate if the application should quit
+    std::atomic<bool> rewinding_;  // The rewind key is held
 
-    bool handleKeyEvent(SDL_Keycode key, bool isPressed, Chip8& chip8);
+    bool handleKeyEvent(SDL_Keycode key, bool isPressed);
     void handleWindowEvent(const SDL_WindowEvent& windowEvent);
-    void swapBuffers();        // Method to cycle through the textures
 };
\ No newline at end of file
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "chip8.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Rewind history
+// Records the machine state at every frame boundary into a ring buffer of fixed size, so a session
+// can be scrubbed back frame by frame. Every `keyframeInterval` frames a keyframe is stored; the
+// frames in between only store the bytes of their snapshot (see Chip8::saveState) that differ from
+// that keyframe, XORed with it and run-length encoded, which is usually a few dozen bytes.
+//
+// Because every delta refers to its keyframe and not to the previous frame, stepping back decodes
+// at most one keyframe and one delta, however long the history is. When the buffer is full the
+// oldest keyframe is dropped together with all the frames that depend on it.
+// All memory is allocated by the constructor; recording and stepping back never allocate.
+class Rewind
+{
+public:
+    // `memoryCap` is the total size of the history in bytes, index included; `snapshotSize` is the
+    // snapshot size of the machine that will be recorded (Chip8::snapshotSize)
+    Rewind(size_t memoryCap, size_t snapshotSize, unsigned int keyframeInterval = CHIP8_FRAME_RATE);
+
+    // Records the state at the end of a frame
+    // Returns false if the state did not fit at all (the cap is smaller than a keyframe)
+    bool record(const Chip8& chip8);
+
+    // Restores the most recently recorded frame and removes it from the history
+    // The keypad is left as it is, since it mirrors the keys held right now
+    // Returns false when the history is empty
+    bool stepBack(Chip8& chip8);
+
+    void clear();
+
+    size_t frames() const { return static_cast<size_t>(next_ - first_); }
+    size_t capacity() const { return data_.size() + index_.size() * sizeof(Frame); }
+
+    // Bytes of the history in use: encoded states plus their index entries
+    size_t bytesUsed() const { return contentBytes_ + frames() * sizeof(Frame); }
+
+    // Average bytes per frame since construction, index included
+    double bytesPerFrame() const;
+
+    unsigned long long framesRecorded() const { return framesRecorded_; }
+    unsigned long long keyframesRecorded() const { return keyframesRecorded_; }
+
+private:
+    struct Frame
+    {
+        uint32_t offset;        // Start of the encoded state in data_
+        uint32_t size;          // Encoded size in bytes
+        uint32_t sinceKeyframe; // Frames since the keyframe this one is encoded against; 0 for keyframes
+    };
+
+    Frame& frame(unsigned long long sequence) { return index_[sequence % index_.size()]; }
+
+    size_t encode(const uint8_t* state, const uint8_t* reference);
+    bool allocate(size_t size, unsigned long long keyframe, uint32_t& offset);
+    void dropOldestKeyframe();
+    void decodeKeyframe(unsigned long long sequence);
+
+    std::vector<uint8_t> data_;        // Ring buffer of encoded states
+    std::vector<Frame> index_;         // Ring of frames, indexed by sequence number
+    unsigned long long first_;         // Sequence number of the oldest frame
+    unsigned long long next_;          // Sequence number of the next frame to record
+    uint32_t head_;                    // End of the newest encoded state in data_
+    size_t contentBytes_;              // Sum of the encoded sizes of the frames in the history
+    unsigned int keyframeInterval_;
+    size_t snapshotSize_;
+
+    std::vector<uint8_t> snapshot_;    // State being recorded or restored
+    std::vector<uint8_t> keyframe_;    // Decoded keyframe the current deltas refer to
+    unsigned long long keyframeSequence_;
+    bool keyframeValid_;
+    std::vector<uint8_t> encoded_;     // Scratch space for encoding, before it goes into data_
+    std::vector<uint8_t> zeros_;       // Keyframes are encoded against an all-zero state
+
+    unsigned long long framesRecorded_;
+    unsigned long long keyframesRecorded_;
+    unsigned long long bytesRecorded_;
+};
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// 32-bit FNV-1a of a ROM image; the same checksum an input movie stores (see InputMovie)
+uint32_t romChecksum(const uint8_t* data, size_t size);
+
+// One ROM in a pack; `data` points into the mapped file and stays valid while the pack is open
+struct PackedRom
+{
+    const char* name;           // Not terminated, see nameLength
+    size_t nameLength;
+    const uint8_t* data;
+    size_t size;
+    uint32_t checksum;
+
+    std::string nameString() const { return std::string(name, nameLength); }
+};
+
+const uint32_t ROM_PACK_MAGIC = 0x4B503843;    // "C8PK" in little endian
+const uint16_t ROM_PACK_VERSION = 1;
+
+// File layout (host byte order, like traces):
+//   header: magic, uint16 version, uint16 entry size, uint32 ROM count, uint32 file size
+//   one 16-byte entry per ROM, sorted by name: uint32 name offset, uint32 data offset,
+//   uint16 name length, uint16 size, uint32 checksum
+//   the names, then the ROM images; offsets are from the start of the file, and ROMs with the same
+//   contents share one image
+//
+// ROM pack
+// Many ROMs in one indexed file, mapped read-only once and shared by every instance that loads
+// from it: opening a pack checks the header and that every entry lies inside the file and fits in
+// memory, after which a ROM is loaded with a single copy from the mapping (Chip8::loadROM with
+// `data` and `size`), without opening or reading any file.
+class RomPack
+{
+public:
+    RomPack();
+    ~RomPack();
+    RomPack(const RomPack&) = delete;
+    RomPack& operator=(const RomPack&) = delete;
+
+    // Returns false, with the reason in error(), if the file is missing or not a valid pack
+    bool open(const std::string& filename);
+    void close();
+    const std::string& error() const { return error_; }
+
+    size_t size() const { return count_; }
+    PackedRom rom(size_t index) const;
+
+    // Finds a ROM by name (binary search); returns false if the pack has none by that name
+    bool find(const std::string& name, size_t& index) const;
+
+    // Recomputes the checksum of a ROM's image; this reads the whole image, so open() doesn't
+    bool verify(size_t index) const;
+
+private:
+    const uint8_t* view_;
+    size_t viewSize_;
+    size_t count_;
+    std::string error_;
+
+    bool fail(const std::string& reason);
+};
+
+// Writes ROM packs; chip8pack builds them from directories
+class RomPackBuilder
+{
+public:
+    // Adds a ROM; returns false if it is empty, larger than XOCHIP_MAX_ROM_SIZE or its name is already taken
+    // Whether it fits the machine it is run on is checked when it is loaded (Chip8::loadROM)
+    bool add(const std::string& name, const uint8_t* data, size_t size);
+
+    bool save(const std::string& filename) const;
+
+    size_t size() const { return roms_.size(); }
+    size_t duplicates() const { return duplicates_; }   // ROMs that share the image of an earlier one
+
+private:
+    struct Rom
+    {
+        std::string name;
+        size_t image;
+        uint32_t checksum;
+    };
+
+    std::vector<Rom> roms_;
+    std::vector<std::vector<uint8_t>> images_;
+    std::unordered_multimap<uint32_t, size_t> imagesByChecksum_;
+    std::unordered_set<std::string> names_;
+    size_t duplicates_ = 0;
+};
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "chip8.hpp"
+
+// Cycle-counted event scheduler
+// Drives a Chip8 by its cycle counter and stops the CPU exactly at the cycles where something
+// outside it has to happen: the 60 Hz frame boundaries (present the display, record the rewind
+// history), input sampling, and one user event such as the next key change of an input movie.
+// In between the CPU runs uninterrupted; the timers need no events at all since they are derived
+// from the cycle counter (see Chip8Timer).
+//
+// The event times are computed from Chip8::cycles() on every call, so the scheduler follows the
+// machine through save state loads and rewinds without any state of its own besides the user event.
+class Scheduler
+{
+public:
+    enum Event : unsigned int
+    {
+        EVENT_FRAME = 1u << 0,  // A frame boundary; drawFlag has been cleared
+        EVENT_INPUT = 1u << 1,  // Time to sample the input
+        EVENT_USER = 1u << 2,   // The cycle passed to at()
+    };
+
+    // Input is sampled `inputSamplesPerFrame` times per frame, evenly spread; 0 never samples
+    explicit Scheduler(Chip8& chip8, unsigned int inputSamplesPerFrame = 0);
+
+    // Runs the CPU up to the next event or `endCycle`, whichever comes first
+    // Returns the events due at the cycle it stopped at; 0 if there are none or the CPU is already at `endCycle`
+    unsigned int run(unsigned long long endCycle);
+
+    // Schedules the user event at an absolute cycle, replacing the previous one
+    // A cycle that is not after cycles() never fires; UINT64_MAX cancels the event
+    void at(unsigned long long cycle) { userCycle_ = cycle; }
+
+    // Cycle of the next event after the current one
+    unsigned long long nextEvent() const;
+
+    unsigned long long frames() const { return frameAtCycle(chip8_.cycles()); }
+
+private:
+    Chip8& chip8_;
+    unsigned int inputSamples_;
+    unsigned long long userCycle_;
+
+    unsigned long long nextInput(unsigned long long cycle) const;
+};
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing thread pool
+// Every worker owns a task deque. A worker pushes and pops its own tasks at the back (LIFO, good
+// cache locality), and when its deque runs dry it steals from the front of another worker's deque.
+// Tasks submitted from outside the pool are spread round robin over the workers.
+class ThreadPool
+{
+public:
+    typedef std::function<void()> Task;
+
+    explicit ThreadPool(unsigned int threadCount);
+    ~ThreadPool();
+
+    void submit(Task task);
+    void wait();
+    unsigned int size() const { return static_cast<unsigned int>(workers_.size()); }
+    unsigned long long steals() const { return steals_.load(std::memory_order_relaxed); }
+
+private:
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+        std::thread thread;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::atomic<unsigned long long> pending_;   // Tasks submitted but not finished yet
+    std::atomic<unsigned long long> queued_;    // Tasks in a deque, not taken by a worker yet
+    std::atomic<unsigned int> sleepers_;        // Workers waiting for work; submit() only notifies if there are any
+    std::atomic<unsigned long long> steals_;    // Number of tasks taken from another worker
+    std::atomic<unsigned int> nextWorker_;      // Round robin target for external submissions
+    std::atomic<bool> stop_;
+
+    std::mutex sleepMutex_;                     // Guards idle workers and wait()
+    std::condition_variable workAvailable_;
+    std::condition_variable allDone_;
+
+    void workerLoop(unsigned int self);
+    bool popLocal(unsigned int self, Task& task);
+    bool steal(unsigned int self, Task& task);
+};
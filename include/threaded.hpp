@@ -0,0 +1,94 @@
+#pragma once
+
+#include "chip8.hpp"
+#include <cstdint>
+
+// Threaded-code interpreter
+// Every one of the 65536 opcodes is mapped to its handler by a decode table generated at compile
+// time, so an instruction is decoded with a single table lookup instead of the two function pointer
+// hops of Chip8::cycle() (table[] and then Table0/8/E/F). Opcodes the interpreter does not know map
+// to an explicit illegal-opcode handler, which does nothing, exactly like op_NULL.
+//
+// With GCC and Clang each handler ends with its own copy of the fetch and an indirect goto to the
+// next handler (computed goto), so every handler has its own, well predicted indirect branch.
+// Other compilers, or builds configured with CHIP8_COMPUTED_GOTO=OFF, use a switch in a loop.
+class Threaded
+{
+public:
+    // Handler of every instruction the interpreter implements
+    enum Op : uint8_t
+    {
+        OP_CLS, OP_RET, OP_JP, OP_CALL, OP_SE_BYTE, OP_SNE_BYTE, OP_SE_REG, OP_LD_BYTE, OP_ADD_BYTE,
+        OP_LD_REG, OP_OR, OP_AND, OP_XOR, OP_ADD_REG, OP_SUB, OP_SHR, OP_SUBN, OP_SHL, OP_SNE_REG,
+        OP_LD_I, OP_JP_V0, OP_RND, OP_DRW, OP_SKP, OP_SKNP, OP_LD_VX_DT, OP_LD_VX_K, OP_LD_DT,
+        OP_LD_ST, OP_ADD_I, OP_LD_F, OP_LD_B, OP_LD_MEM_VX, OP_LD_VX_MEM,
+        OP_ILLEGAL,
+        OP_COUNT
+    };
+
+    // Decodes an opcode exactly like the interpreter's dispatch tables
+    static constexpr Op decode(uint16_t opcode)
+    {
+        switch (opcode >> 12) {
+        case 0x0:
+            // Table0 looks at the last nibble only
+            return (opcode & 0x000F) == 0x0 ? OP_CLS : (opcode & 0x000F) == 0xE ? OP_RET : OP_ILLEGAL;
+        case 0x1: return OP_JP;
+        case 0x2: return OP_CALL;
+        case 0x3: return OP_SE_BYTE;
+        case 0x4: return OP_SNE_BYTE;
+        case 0x5: return OP_SE_REG;
+        case 0x6: return OP_LD_BYTE;
+        case 0x7: return OP_ADD_BYTE;
+        case 0x8:
+            switch (opcode & 0x000F) {
+            case 0x0: return OP_LD_REG;
+            case 0x1: return OP_OR;
+            case 0x2: return OP_AND;
+            case 0x3: return OP_XOR;
+            case 0x4: return OP_ADD_REG;
+            case 0x5: return OP_SUB;
+            case 0x6: return OP_SHR;
+            case 0x7: return OP_SUBN;
+            case 0xE: return OP_SHL;
+            default: return OP_ILLEGAL;
+            }
+        case 0x9: return OP_SNE_REG;
+        case 0xA: return OP_LD_I;
+        case 0xB: return OP_JP_V0;
+        case 0xC: return OP_RND;
+        case 0xD: return OP_DRW;
+        case 0xE:
+            // TableE looks at the last nibble only
+            return (opcode & 0x000F) == 0xE ? OP_SKP : (opcode & 0x000F) == 0x1 ? OP_SKNP : OP_ILLEGAL;
+        default:
+            switch (opcode & 0x00FF) {
+            case 0x07: return OP_LD_VX_DT;
+            case 0x0A: return OP_LD_VX_K;
+            case 0x15: return OP_LD_DT;
+            case 0x18: return OP_LD_ST;
+            case 0x1E: return OP_ADD_I;
+            case 0x29: return OP_LD_F;
+            case 0x33: return OP_LD_B;
+            case 0x55: return OP_LD_MEM_VX;
+            case 0x65: return OP_LD_VX_MEM;
+            default: return OP_ILLEGAL;
+            }
+        }
+    }
+
+    // Handler of every opcode, built at compile time
+    struct DecodeTable
+    {
+        uint8_t ops[0x10000];
+
+        constexpr DecodeTable() : ops()
+        {
+            for (uint32_t opcode = 0; opcode < 0x10000; ++opcode) {
+                ops[opcode] = decode(static_cast<uint16_t>(opcode));
+            }
+        }
+    };
+
+    static void run(Chip8& chip8, unsigned long long cycles);
+};
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+// One executed instruction
+// Fixed size, so a trace can be indexed and mapped directly; stored in host byte order.
+struct TraceRecord
+{
+    uint64_t cycle;     // Chip8::cycles() before the instruction ran
+    uint16_t pc;        // Address of the instruction
+    uint16_t opcode;
+    uint16_t index;     // I after the instruction
+    uint8_t reg;        // Lowest register the instruction changed, or TRACE_NO_REGISTER
+    uint8_t value;      // New value of that register
+};
+
+static_assert(sizeof(TraceRecord) == 16, "TraceRecord must stay 16 bytes");
+
+const uint8_t TRACE_NO_REGISTER = 0xFF;
+const uint32_t TRACE_MAGIC = 0x52543843;    // "C8TR" in little endian
+const uint16_t TRACE_VERSION = 1;
+
+// File layout: a header the size of one record (magic, version, record size, record count), then the
+// records. The count is written when the trace is closed.
+const size_t TRACE_HEADER_SIZE = sizeof(TraceRecord);
+
+// Bytes mapped at a time; a multiple of the mapping granularity of every host (64 KB on Windows)
+const size_t TRACE_CHUNK_SIZE = 1 << 20;
+
+// Trace recorder
+// Appends records to a file through a memory-mapped window of TRACE_CHUNK_SIZE bytes. When the window
+// is full the file is extended and the next chunk is mapped, so recording an instruction is a few
+// stores into mapped memory and the operating system writes the pages back in the background.
+// Attach one to a Chip8 with setTrace() for the instructions that should be recorded.
+class TraceWriter
+{
+public:
+    TraceWriter();
+    ~TraceWriter();
+    TraceWriter(const TraceWriter&) = delete;
+    TraceWriter& operator=(const TraceWriter&) = delete;
+
+    // Creates or truncates `filename`; returns false if it can't be created or mapped
+    bool open(const std::string& filename);
+
+    // Unmaps the file and trims it to the records written; also done by the destructor
+    void close();
+
+    // Records an instruction; `before` and `after` are V0-VF before and after it ran
+    void record(unsigned long long cycle, uint16_t pc, uint16_t opcode, uint16_t index, const uint8_t* before, const uint8_t* after)
+    {
+        if (next_ == end_ && !mapNextChunk()) {
+            ++dropped_;
+            return;
+        }
+
+        TraceRecord& record = *next_++;
+        record.cycle = cycle;
+        record.pc = pc;
+        record.opcode = opcode;
+        record.index = index;
+        record.reg = TRACE_NO_REGISTER;
+        record.value = 0;
+        for (unsigned int r = 0; r < 16; ++r) {
+            if (before[r] != after[r]) {
+                record.reg = static_cast<uint8_t>(r);
+                record.value = after[r];
+                break;
+            }
+        }
+    }
+
+    unsigned long long records() const;
+    unsigned long long dropped() const { return dropped_; }    // Records lost because the file could not grow
+
+private:
+#ifdef _WIN32
+    void* file_;
+    void* mapping_;
+#else
+    int file_;
+#endif
+    void* view_;                // Mapped chunk
+    unsigned long long chunk_;  // Index of the next chunk to map
+    unsigned long long slots_;  // Record slots (header included) in the chunks already unmapped
+    TraceRecord* next_;         // Next free record in the chunk
+    TraceRecord* end_;
+    unsigned long long dropped_;
+
+    bool mapNextChunk();
+    void unmapChunk();
+};
+
+// Sequential reader for trace files
+class TraceReader
+{
+public:
+    // Returns false if the file is missing or not a trace of this version
+    bool open(const std::string& filename);
+
+    // Reads the next record; false at the end of the trace
+    bool next(TraceRecord& record);
+
+    unsigned long long records() const { return count_; }
+
+private:
+    std::ifstream file_;
+    unsigned long long count_ = 0;
+    unsigned long long read_ = 0;
+};
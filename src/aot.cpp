@@ -0,0 +1,95 @@
+#include "aot.hpp"
+#include <cstring>
+#include <vector>
+
+// Every program linked into the executable
+// A function-local static, so generated files can register from their static initializers
+static std::vector<const AotProgram*>& registry()
+{
+    static std::vector<const AotProgram*> programs;
+    return programs;
+}
+
+void Aot::registerProgram(const AotProgram& program) {
+    registry().push_back(&program);
+}
+
+unsigned int Aot::programCount() {
+    return static_cast<unsigned int>(registry().size());
+}
+
+Aot::Aot() : program_(nullptr), selected_(false), codeWritten_(false) {}
+
+void Aot::flush() {
+    // Memory was changed from outside the CPU (e.g. a new ROM), so look the program up again
+    program_ = nullptr;
+    selected_ = false;
+    codeWritten_ = false;
+}
+
+void Aot::dispatch(Chip8& chip8) {
+    ((chip8).*(Chip8::table[chip8.opcode >> 12]))();
+}
+
+bool Aot::matches(const Chip8& chip8, const AotProgram& program) const {
+    // Every translated instruction lies inside the ROM image, so comparing the image is enough
+    return START_ADDRESS + program.romSize <= MEMORY_SIZE &&
+           std::memcmp(chip8.memory + START_ADDRESS, program.rom, program.romSize) == 0;
+}
+
+bool Aot::codeIntact(const Chip8& chip8, const AotProgram& program) const {
+    // Only the bytes holding translated code matter; the program may freely change its data
+    for (uint32_t i = 0; i < program.romSize; ++i) {
+        unsigned int address = START_ADDRESS + i;
+        if ((program.covered[address >> 3] & (1u << (address & 7))) && chip8.memory[address] != program.rom[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Aot::select(const Chip8& chip8) {
+    program_ = nullptr;
+    for (const AotProgram* program : registry()) {
+        if (matches(chip8, *program)) {
+            program_ = program;
+            break;
+        }
+    }
+    selected_ = true;
+}
+
+void Aot::run(Chip8& chip8, unsigned long long cycles) {
+    if (!selected_) {
+        select(chip8);
+    }
+
+    while (cycles > 0) {
+        if (program_ != nullptr) {
+            uint32_t budget = cycles < 0xFFFFFFFFull ? static_cast<uint32_t>(cycles) : 0xFFFFFFFFu;
+            uint32_t executed = program_->run(chip8, budget);
+            cycles -= executed;
+
+            // Self-modifying code: once the translated code no longer matches memory, stay on the interpreter
+            if (codeWritten_) {
+                codeWritten_ = false;
+                if (!codeIntact(chip8, *program_)) {
+                    program_ = nullptr;
+                }
+            }
+
+            if (executed > 0) {
+                continue;
+            }
+        }
+
+        // pc is outside the translated code
+        chip8.cycle();
+        --cycles;
+
+        if (program_ != nullptr && ((chip8.opcode & 0xF0FFu) == 0xF033u || (chip8.opcode & 0xF0FFu) == 0xF055u) &&
+            !codeIntact(chip8, *program_)) {
+            program_ = nullptr;
+        }
+    }
+}
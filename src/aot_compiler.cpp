@@ -0,0 +1,461 @@
+#include "chip8.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Ahead-of-time recompiler
+// Translates a ROM into a C++ source file that runs the program natively against a Chip8 instance
+// (see aot.hpp). The control-flow graph is recovered by following every path from START_ADDRESS:
+// jumps, calls and their return sites, and both sides of every skip. The targets of Bnnn computed
+// jumps and of 00EE returns are only known at run time, so those go through a switch over all the
+// translated addresses, and anything the analysis did not reach is left to the interpreter.
+//
+// Every translated instruction is a label in one function, so straight-line code, loops and jumps
+// between translated instructions become plain gotos. Instructions with complex side effects
+// (Dxyn, Cxkk, Fx0A, ...) call back into the interpreter's handlers.
+
+static void printUsage(const char* program)
+{
+    std::cerr << "Usage: " << program << " [--name <Name>] <ROM> <Output.cpp>\n";
+}
+
+// What an instruction does to the control flow, as decoded by the interpreter's tables
+enum class Flow
+{
+    Next,       // Continues at the following instruction
+    Jump,       // 1nnn
+    Call,       // 2nnn: continues at nnn, and at the following instruction once the call returns
+    Skip,       // Continues at the following instruction or the one after it
+    Dynamic     // 00EE, Bnnn, Fx0A: the next pc is only known at run time
+};
+
+static Flow decodeFlow(uint16_t opcode)
+{
+    switch (opcode >> 12)
+    {
+    case 0x0:
+        // Table0 decodes on the last nibble only
+        return (opcode & 0x000F) == 0xE ? Flow::Dynamic : Flow::Next;
+    case 0x1:
+        return Flow::Jump;
+    case 0x2:
+        return Flow::Call;
+    case 0x3: case 0x4: case 0x5: case 0x9:
+        return Flow::Skip;
+    case 0xB:
+        return Flow::Dynamic;
+    case 0xE:
+        return (opcode & 0x000F) == 0x1 || (opcode & 0x000F) == 0xE ? Flow::Skip : Flow::Next;
+    case 0xF:
+        return (opcode & 0x00FF) == 0x0A ? Flow::Dynamic : Flow::Next;
+    default:
+        return Flow::Next;
+    }
+}
+
+static std::string hex(unsigned int value, int digits)
+{
+    char text[16];
+    std::snprintf(text, sizeof(text), "0x%0*X", digits, value);
+    return text;
+}
+
+class Translator
+{
+public:
+    explicit Translator(const std::vector<uint8_t>& rom) : rom_(rom), code_(MEMORY_SIZE, false) {}
+
+    // Marks every instruction reachable from START_ADDRESS
+    void analyze()
+    {
+        std::vector<unsigned int> pending(1, START_ADDRESS);
+        while (!pending.empty())
+        {
+            unsigned int address = pending.back();
+            pending.pop_back();
+            if (!translatable(address) || code_[address])
+            {
+                continue;
+            }
+            code_[address] = true;
+
+            uint16_t opcode = fetch(address);
+            switch (decodeFlow(opcode))
+            {
+            case Flow::Next:
+                pending.push_back(address + 2);
+                break;
+            case Flow::Jump:
+                pending.push_back(opcode & 0x0FFF);
+                break;
+            case Flow::Call:
+                pending.push_back(opcode & 0x0FFF);
+                pending.push_back(address + 2);
+                break;
+            case Flow::Skip:
+                pending.push_back(address + 2);
+                pending.push_back(address + 4);
+                break;
+            case Flow::Dynamic:
+                // Fx0A either waits on itself or continues; stack overflows and underflows continue too
+                pending.push_back(address + 2);
+                break;
+            }
+        }
+    }
+
+    unsigned int instructionCount() const
+    {
+        unsigned int count = 0;
+        for (bool isCode : code_)
+        {
+            count += isCode ? 1 : 0;
+        }
+        return count;
+    }
+
+    void emit(std::ostream& out, const std::string& name, const std::string& romFilename) const
+    {
+        out << "// Generated by chip8aot from " << romFilename << ", do not edit\n"
+            << "#include \"aot.hpp\"\n\n"
+            << "namespace {\n\n";
+
+        // ROM image and the bitmap of the bytes holding translated code
+        out << "const uint8_t rom[] = {";
+        for (size_t i = 0; i < rom_.size(); ++i)
+        {
+            out << (i % 16 == 0 ? "\n    " : " ") << hex(rom_[i], 2) << ",";
+        }
+        out << "\n};\n\n";
+
+        std::vector<uint8_t> covered(MEMORY_SIZE / 8, 0);
+        for (unsigned int address = 0; address < MEMORY_SIZE; ++address)
+        {
+            if (code_[address])
+            {
+                covered[address >> 3] |= static_cast<uint8_t>(1u << (address & 7));
+                covered[(address + 1) >> 3] |= static_cast<uint8_t>(1u << ((address + 1) & 7));
+            }
+        }
+        out << "const uint8_t covered[MEMORY_SIZE / 8] = {";
+        for (size_t i = 0; i < covered.size(); ++i)
+        {
+            out << (i % 16 == 0 ? "\n    " : " ") << hex(covered[i], 2) << ",";
+        }
+        out << "\n};\n\n";
+
+        // The instructions are generated first: the dispatch label is only emitted when something jumps to it
+        std::ostringstream body;
+        for (unsigned int address = 0; address < MEMORY_SIZE; ++address)
+        {
+            if (code_[address])
+            {
+                emitInstruction(body, address);
+            }
+        }
+        bool dispatches = body.str().find("goto dispatch;") != std::string::npos;
+
+        out << "uint32_t run(Chip8& chip8, uint32_t budget)\n"
+            << "{\n"
+            << "    Aot::Context c(chip8, budget);\n"
+            << "    uint16_t pc = c.pc();\n\n"
+            << (dispatches ? "dispatch:\n" : "")
+            << "    switch (pc)\n"
+            << "    {\n";
+        for (unsigned int address = 0; address < MEMORY_SIZE; ++address)
+        {
+            if (code_[address])
+            {
+                out << "    case " << hex(address, 3) << ": goto " << label(address) << ";\n";
+            }
+        }
+        out << "    default: return c.exit(pc);\n"
+            << "    }\n";
+
+        out << body.str()
+            << "}\n\n"
+            << "const AotProgram program = { \"" << name << "\", rom, sizeof(rom), covered, run };\n"
+            << "const Aot::Registration registration(program);\n\n"
+            << "}\n";
+    }
+
+private:
+    const std::vector<uint8_t>& rom_;
+    std::vector<bool> code_;        // Instruction starts reached by the analysis
+
+    // Only instructions fully inside the ROM image are translated; memory outside it is not known
+    // at build time
+    bool translatable(unsigned int address) const
+    {
+        return address >= START_ADDRESS && address + 1 < START_ADDRESS + rom_.size() && address + 1 < MEMORY_SIZE;
+    }
+
+    uint16_t fetch(unsigned int address) const
+    {
+        return static_cast<uint16_t>((rom_[address - START_ADDRESS] << 8) | rom_[address + 1 - START_ADDRESS]);
+    }
+
+    static std::string label(unsigned int address)
+    {
+        char text[8];
+        std::snprintf(text, sizeof(text), "L%03X", address);
+        return text;
+    }
+
+    // Continues at `target`: a goto when it was translated, otherwise through the dispatch switch,
+    // which hands over to the interpreter
+    std::string jump(unsigned int target) const
+    {
+        target &= 0xFFFF;
+        if (target < MEMORY_SIZE && code_[target])
+        {
+            return "goto " + label(target) + ";";
+        }
+        return "{ pc = " + hex(target, 3) + "; goto dispatch; }";
+    }
+
+    void emitInstruction(std::ostream& out, unsigned int address) const
+    {
+        uint16_t opcode = fetch(address);
+        std::string a = hex(address, 3);
+        std::string op = hex(opcode, 4);
+        std::string next = hex(address + 2, 3);
+        std::string x = std::to_string((opcode & 0x0F00) >> 8);
+        std::string y = std::to_string((opcode & 0x00F0) >> 4);
+        std::string kk = hex(opcode & 0x00FF, 2);
+        std::string nnn = hex(opcode & 0x0FFF, 3);
+        std::string Vx = "c.V[" + x + "]";
+        std::string Vy = "c.V[" + y + "]";
+        std::string retire = "c.retire(" + op + ");";
+        std::string interpret = "c.execute(" + a + ", " + op + "); " + retire;
+        std::string interpretDynamic = "pc = c.execute(" + a + ", " + op + "); " + retire + " goto dispatch;";
+        bool fallsThrough = true;
+
+        out << label(address) << ":\n"
+            << "    if (c.done()) return c.exit(" << a << ");\n"
+            << "    ";
+
+        switch (opcode >> 12)
+        {
+        case 0x0:
+            if ((opcode & 0x000F) == 0x0)
+            {
+                out << interpret;                               // CLS
+            }
+            else if ((opcode & 0x000F) == 0xE)
+            {
+                out << interpretDynamic;                        // RET
+                fallsThrough = false;
+            }
+            else
+            {
+                out << retire;                                  // Unknown opcode
+            }
+            break;
+        case 0x1:
+            out << retire << " " << jump(opcode & 0x0FFF);
+            fallsThrough = false;
+            break;
+        case 0x2:
+            out << "if (c.call(" << next << ")) { " << retire << " " << jump(opcode & 0x0FFF) << " } "
+                << interpretDynamic;
+            fallsThrough = false;
+            break;
+        case 0x3:
+            out << "{ bool skip = " << Vx << " == " << kk << "; " << retire << " if (skip) " << jump(address + 4) << " }";
+            break;
+        case 0x4:
+            out << "{ bool skip = " << Vx << " != " << kk << "; " << retire << " if (skip) " << jump(address + 4) << " }";
+            break;
+        case 0x5:
+            out << "{ bool skip = " << Vx << " == " << Vy << "; " << retire << " if (skip) " << jump(address + 4) << " }";
+            break;
+        case 0x6:
+            out << Vx << " = " << kk << "; " << retire;
+            break;
+        case 0x7:
+            out << Vx << " = static_cast<uint8_t>(" << Vx << " + " << kk << "); " << retire;
+            break;
+        case 0x8:
+            // Same statement order as the interpreter, so the results match when x or y is F
+            switch (opcode & 0x000F)
+            {
+            case 0x0: out << Vx << " = " << Vy << "; "; break;
+            case 0x1: out << Vx << " |= " << Vy << "; "; break;
+            case 0x2: out << Vx << " &= " << Vy << "; "; break;
+            case 0x3: out << Vx << " ^= " << Vy << "; "; break;
+            case 0x4:
+                out << "{ unsigned int sum = " << Vx << " + " << Vy << "; c.V[15] = sum > 255 ? 1 : 0; "
+                    << Vx << " = static_cast<uint8_t>(sum); } ";
+                break;
+            case 0x5:
+                out << "c.V[15] = " << Vx << " > " << Vy << " ? 1 : 0; "
+                    << Vx << " = static_cast<uint8_t>(" << Vx << " - " << Vy << "); ";
+                break;
+            case 0x6:
+                out << "c.V[15] = " << Vx << " & 1; " << Vx << " = static_cast<uint8_t>(" << Vx << " >> 1); ";
+                break;
+            case 0x7:
+                out << "c.V[15] = " << Vy << " > " << Vx << " ? 1 : 0; "
+                    << Vx << " = static_cast<uint8_t>(" << Vy << " - " << Vx << "); ";
+                break;
+            case 0xE:
+                out << "c.V[15] = static_cast<uint8_t>(" << Vx << " >> 7); "
+                    << Vx << " = static_cast<uint8_t>(" << Vx << " << 1); ";
+                break;
+            default:
+                break;                                          // Unknown opcode
+            }
+            out << retire;
+            break;
+        case 0x9:
+            out << "{ bool skip = " << Vx << " != " << Vy << "; " << retire << " if (skip) " << jump(address + 4) << " }";
+            break;
+        case 0xA:
+            out << "c.I = " << nnn << "; " << retire;
+            break;
+        case 0xB:
+            out << retire << " pc = static_cast<uint16_t>(c.V[0] + " << nnn << "); goto dispatch;";
+            fallsThrough = false;
+            break;
+        case 0xC:
+        case 0xD:
+            out << interpret;
+            break;
+        case 0xE:
+            if ((opcode & 0x000F) == 0xE)
+            {
+                out << "{ bool skip = c.keyDown(" << Vx << "); " << retire << " if (skip) " << jump(address + 4) << " }";
+            }
+            else if ((opcode & 0x000F) == 0x1)
+            {
+                out << "{ bool skip = !c.keyDown(" << Vx << "); " << retire << " if (skip) " << jump(address + 4) << " }";
+            }
+            else
+            {
+                out << retire;                                  // Unknown opcode
+            }
+            break;
+        case 0xF:
+            switch (opcode & 0x00FF)
+            {
+            case 0x07: out << Vx << " = c.delayTimer(); " << retire; break;
+            case 0x0A: out << interpretDynamic; fallsThrough = false; break;
+            case 0x15: out << "c.setDelayTimer(" << Vx << "); " << retire; break;
+            case 0x18: out << "c.setSoundTimer(" << Vx << "); " << retire; break;
+            case 0x1E: out << "c.I = static_cast<uint16_t>(c.I + " << Vx << "); " << retire; break;
+            case 0x29: case 0x65: out << interpret; break;
+            case 0x33:
+            case 0x55:
+                // A write into translated code leaves the program, which then checks whether it is still valid
+                out << "{ bool hit = c.executeStore(" << a << ", " << op << "); " << retire
+                    << " if (hit) return c.exit(" << next << "); }";
+                break;
+            default: out << retire; break;                      // Unknown opcode
+            }
+            break;
+        }
+        out << "\n";
+
+        // Instructions are emitted in address order, so only jump when the next one isn't adjacent
+        // (for example when code at odd and even addresses overlaps)
+        if (fallsThrough)
+        {
+            unsigned int following = address + 1;
+            while (following < MEMORY_SIZE && !code_[following])
+            {
+                ++following;
+            }
+            if (following != address + 2)
+            {
+                out << "    " << jump(address + 2) << "\n";
+            }
+        }
+    }
+};
+
+int main(int argc, char** argv)
+{
+    std::string name;
+    const char* romFilename = nullptr;
+    const char* outputFilename = nullptr;
+
+    // Parse command-line arguments
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--name") == 0 && i + 1 < argc)
+        {
+            name = argv[++i];
+        }
+        else if (romFilename == nullptr && argv[i][0] != '-')
+        {
+            romFilename = argv[i];
+        }
+        else if (outputFilename == nullptr && argv[i][0] != '-')
+        {
+            outputFilename = argv[i];
+        }
+        else
+        {
+            printUsage(argv[0]);
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
+    if (romFilename == nullptr || outputFilename == nullptr)
+    {
+        printUsage(argv[0]);
+        std::exit(EXIT_FAILURE);
+    }
+
+    if (name.empty())
+    {
+        name = romFilename;
+    }
+
+    // The name ends up in a string literal
+    for (char& c : name)
+    {
+        if (c == '"' || c == '\\' || static_cast<unsigned char>(c) < 0x20)
+        {
+            c = '_';
+        }
+    }
+
+    std::ifstream file(romFilename, std::ios::binary);
+    if (!file)
+    {
+        std::cerr << "Failed to open ROM: " << romFilename << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    std::vector<uint8_t> rom((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    if (rom.empty() || rom.size() > MEMORY_SIZE - START_ADDRESS)
+    {
+        std::cerr << "ROM is empty or too large: " << romFilename << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    Translator translator(rom);
+    translator.analyze();
+
+    // Generate into memory first, so a failed run never leaves a truncated source file behind
+    std::ostringstream source;
+    translator.emit(source, name, romFilename);
+
+    std::ofstream output(outputFilename, std::ios::binary);
+    if (!output || !(output << source.str()))
+    {
+        std::cerr << "Failed to write " << outputFilename << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    std::cout << romFilename << ": translated " << translator.instructionCount() << " instructions" << std::endl;
+    return 0;
+}
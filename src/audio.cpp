@@ -0,0 +1,146 @@
+#include "audio.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// Square wave phase step per sample: a full period is 2^32
+static const uint32_t TONE_STEP = static_cast<uint32_t>((static_cast<uint64_t>(AUDIO_TONE) << 32) / AUDIO_SAMPLE_RATE);
+
+// Samples kept waiting at most, never less than one device buffer
+static size_t samplesForLatency(unsigned int latencyMs) {
+    return std::max<size_t>(static_cast<size_t>(latencyMs) * AUDIO_SAMPLE_RATE / 1000, AUDIO_DEVICE_SAMPLES);
+}
+
+SampleRing::SampleRing(size_t capacity) : head_(0), tail_(0) {
+    size_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    buffer_.assign(size, 0);
+    mask_ = size - 1;
+}
+
+size_t SampleRing::write(const int16_t* samples, size_t count) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    size_t tail = tail_.load(std::memory_order_acquire);
+    size_t n = std::min(count, buffer_.size() - (head - tail));
+
+    // At most two copies: up to the end of the buffer, then from its start
+    size_t start = head & mask_;
+    size_t first = std::min(n, buffer_.size() - start);
+    memcpy(buffer_.data() + start, samples, first * sizeof(int16_t));
+    memcpy(buffer_.data(), samples + first, (n - first) * sizeof(int16_t));
+
+    head_.store(head + n, std::memory_order_release);
+    return n;
+}
+
+size_t SampleRing::read(int16_t* samples, size_t count) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    size_t head = head_.load(std::memory_order_acquire);
+    size_t n = std::min(count, head - tail);
+
+    size_t start = tail & mask_;
+    size_t first = std::min(n, buffer_.size() - start);
+    memcpy(samples, buffer_.data() + start, first * sizeof(int16_t));
+    memcpy(samples + first, buffer_.data(), (n - first) * sizeof(int16_t));
+
+    tail_.store(tail + n, std::memory_order_release);
+    return n;
+}
+
+AudioStream::AudioStream(unsigned int latencyMs)
+    : ring_(samplesForLatency(latencyMs)), maxBuffered_(samplesForLatency(latencyMs)),
+      primeLevel_(samplesForLatency(latencyMs) / 2), nextSample_(0), phase_(0), primed_(false),
+      produced_(0), dropped_(0), underruns_(0), underrunSamples_(0) {
+}
+
+void AudioStream::produce(const Chip8& chip8) {
+    unsigned long long end = chip8.cycles() * AUDIO_SAMPLE_RATE / CHIP8_CLOCK_SPEED;
+    if (end <= nextSample_) {
+        // The clock went back (a state was loaded without resync()); carry on from there
+        nextSample_ = end;
+        return;
+    }
+    size_t total = static_cast<size_t>(end - nextSample_);
+    nextSample_ = end;
+    produced_.fetch_add(total, std::memory_order_relaxed);
+
+    // The sound timer is read once for the whole span: every span is at most a frame
+    bool sounding = chip8.getSoundTimer() > 0;
+    const uint8_t* pattern = nullptr;
+    uint32_t step = TONE_STEP;
+    if (!sounding) {
+        phase_ = 0;
+    } else if (chip8.getMachine() == Machine::XoChip) {
+        // The pattern plays at 4000 * 2^((pitch - 64) / 48) bits per second, 2^25 of phase per bit
+        // Until the program loads a pattern the buzzer tone plays instead
+        const uint8_t* loaded = chip8.getAudioPattern();
+        if (std::any_of(loaded, loaded + AUDIO_PATTERN_SIZE, [](uint8_t byte) { return byte != 0; })) {
+            pattern = loaded;
+            double rate = 4000.0 * std::exp2((chip8.getPitch() - 64) / 48.0);
+            step = static_cast<uint32_t>(rate * 33554432.0 / AUDIO_SAMPLE_RATE);
+        }
+    }
+
+    // Samples beyond the latency cap are dropped here rather than delaying everything after them
+    size_t buffered = ring_.size();
+    size_t room = buffered < maxBuffered_ ? maxBuffered_ - buffered : 0;
+    if (total > room) {
+        dropped_.fetch_add(total - room, std::memory_order_relaxed);
+        total = room;
+    }
+
+    while (total > 0) {
+        size_t n = std::min(total, CHUNK);
+        if (!sounding) {
+            memset(chunk_, 0, n * sizeof(int16_t));
+        } else if (pattern != nullptr) {
+            for (size_t i = 0; i < n; ++i) {
+                unsigned int bit = phase_ >> 25;
+                chunk_[i] = (pattern[bit >> 3] >> (7 - (bit & 7))) & 1 ? AUDIO_AMPLITUDE : -AUDIO_AMPLITUDE;
+                phase_ += step;
+            }
+        } else {
+            for (size_t i = 0; i < n; ++i) {
+                chunk_[i] = phase_ < 0x80000000u ? AUDIO_AMPLITUDE : -AUDIO_AMPLITUDE;
+                phase_ += step;
+            }
+        }
+        ring_.write(chunk_, n);
+        total -= n;
+    }
+}
+
+void AudioStream::resync(const Chip8& chip8) {
+    nextSample_ = chip8.cycles() * AUDIO_SAMPLE_RATE / CHIP8_CLOCK_SPEED;
+}
+
+size_t AudioStream::consume(int16_t* samples, size_t count) {
+    // Wait for half the latency before (re)starting, so playback has some slack
+    if (!primed_) {
+        if (ring_.size() < primeLevel_) {
+            memset(samples, 0, count * sizeof(int16_t));
+            return 0;
+        }
+        primed_ = true;
+    }
+
+    size_t n = ring_.read(samples, count);
+    if (n < count) {
+        memset(samples + n, 0, (count - n) * sizeof(int16_t));
+        underruns_.fetch_add(1, std::memory_order_relaxed);
+        underrunSamples_.fetch_add(count - n, std::memory_order_relaxed);
+        primed_ = false;
+    }
+    return n;
+}
+
+size_t NullAudioSink::drain() {
+    size_t drained = 0;
+    for (size_t buffers = stream_.buffered() / AUDIO_DEVICE_SAMPLES; buffers > 0; --buffers) {
+        drained += stream_.consume(buffer_, AUDIO_DEVICE_SAMPLES);
+    }
+    samples_ += drained;
+    return drained;
+}
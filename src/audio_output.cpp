@@ -0,0 +1,39 @@
+#include "audio_output.hpp"
+#include "log.hpp"
+
+AudioOutput::AudioOutput(AudioStream& stream) : stream_(stream), device_(0) {
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
+        LOG_ERROR("No audio: {}", SDL_GetError());
+        return;
+    }
+
+    // SDL converts to whatever the device really uses, so the stream always sees this format
+    SDL_AudioSpec desired;
+    SDL_zero(desired);
+    desired.freq = AUDIO_SAMPLE_RATE;
+    desired.format = AUDIO_S16SYS;
+    desired.channels = 1;
+    desired.samples = AUDIO_DEVICE_SAMPLES;
+    desired.callback = &AudioOutput::callback;
+    desired.userdata = this;
+
+    device_ = SDL_OpenAudioDevice(nullptr, 0, &desired, nullptr, 0);
+    if (device_ == 0) {
+        LOG_ERROR("Failed to open the audio device: {}", SDL_GetError());
+        SDL_QuitSubSystem(SDL_INIT_AUDIO);
+        return;
+    }
+    SDL_PauseAudioDevice(device_, 0);
+}
+
+AudioOutput::~AudioOutput() {
+    if (device_ != 0) {
+        SDL_CloseAudioDevice(device_);
+        SDL_QuitSubSystem(SDL_INIT_AUDIO);
+    }
+}
+
+void AudioOutput::callback(void* userdata, Uint8* stream, int length) {
+    AudioOutput* output = static_cast<AudioOutput*>(userdata);
+    output->stream_.consume(reinterpret_cast<int16_t*>(stream), static_cast<size_t>(length) / sizeof(int16_t));
+}
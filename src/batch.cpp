@@ -0,0 +1,275 @@
+#include "chip8.hpp"
+#include "rom_pack.hpp"
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Batch runner
+// Hosts many independent Chip8 instances and runs them on a work-stealing thread pool.
+// Each instance gets the same budget and is executed in slices of a few emulated frames;
+// a slice that leaves budget over resubmits the next slice of the same instance, so long and
+// short running instances are balanced across all cores. Aggregate throughput is reported at exit.
+// Every ROM is read once, or mapped once from a ROM pack, and all instances load from that copy.
+
+static void printUsage(const char* program)
+{
+    std::cerr << "Usage: " << program
+              << " --instances <N> (--cycles <N> | --frames <N>) [--slice <Frames>] [--threads <N>] [--engine <Engine>]"
+              << " [--seed <N>] [--pack <Pack>] [--machine <Machine>] [--quirks <Quirks>] <ROM>...\n"
+              << "Engines: interpreter (default), threaded, cached, jit, jit-verify, aot\n"
+              << "Machines: chip8 (default), schip, xochip; the last two always run on the interpreter\n"
+              << "Quirks: original, vip, schip, xochip; the machine's own by default, only original runs on every engine\n"
+              << "With --pack the ROMs are names in the pack, and every ROM in it if none is given\n";
+}
+
+// A ROM image shared read-only by the instances running it
+struct RomImage
+{
+    const uint8_t* data;
+    size_t size;
+};
+
+// One emulated machine and its progress through the budget
+struct Instance
+{
+    Chip8 chip8;
+    const RomImage* rom = nullptr;
+    unsigned long long cycles = 0;
+    unsigned long long frames = 0;
+};
+
+struct Batch
+{
+    ThreadPool* pool = nullptr;
+    std::vector<std::unique_ptr<Instance>> instances;
+    unsigned long long cycleBudget = 0;
+    unsigned long long sliceCycles = 0;
+    std::atomic<unsigned long long> slices{0};
+
+    void runSlice(Instance& instance)
+    {
+        // The ROM is loaded by the first slice, so loading is spread over the workers too
+        if (instance.cycles == 0) {
+            instance.chip8.loadROM(instance.rom->data, instance.rom->size);
+        }
+
+        unsigned long long end = std::min(instance.cycles + sliceCycles, cycleBudget);
+        instance.frames += instance.chip8.runUnpaced(instance.cycles, end);
+        instance.cycles = end;
+        slices.fetch_add(1, std::memory_order_relaxed);
+
+        // Queue the next slice on this worker; idle workers will steal it if they run dry
+        if (instance.cycles < cycleBudget) {
+            pool->submit([this, &instance] { runSlice(instance); });
+        }
+    }
+};
+
+int main(int argc, char** argv)
+{
+    unsigned long long instanceCount = 0;
+    unsigned long long cycleBudget = 0;
+    unsigned long long frameBudget = 0;
+    unsigned long long sliceFrames = 60;
+    unsigned int threadCount = std::thread::hardware_concurrency();
+    Engine engine = Engine::Interpreter;
+    Machine machine = Machine::Chip8;
+    QuirkSet quirks = QuirkSet::Auto;
+    bool seeded = false;
+    uint32_t seed = 0;
+    std::vector<std::string> roms;
+    std::string packFilename;
+
+    // Parse command-line arguments
+    for (int i = 1; i < argc; ++i)
+    {
+        bool hasValue = i + 1 < argc;
+        if (std::strcmp(argv[i], "--instances") == 0 && hasValue)
+        {
+            instanceCount = std::stoull(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--cycles") == 0 && hasValue)
+        {
+            cycleBudget = std::stoull(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--frames") == 0 && hasValue)
+        {
+            frameBudget = std::stoull(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--slice") == 0 && hasValue)
+        {
+            sliceFrames = std::stoull(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--threads") == 0 && hasValue)
+        {
+            threadCount = static_cast<unsigned int>(std::stoul(argv[++i]));
+        }
+        else if (std::strcmp(argv[i], "--engine") == 0 && hasValue && parseEngine(argv[i + 1], engine))
+        {
+            ++i;
+        }
+        else if (std::strcmp(argv[i], "--machine") == 0 && hasValue && parseMachine(argv[i + 1], machine))
+        {
+            ++i;
+        }
+        else if (std::strcmp(argv[i], "--quirks") == 0 && hasValue && parseQuirkSet(argv[i + 1], quirks))
+        {
+            ++i;
+        }
+        else if (std::strcmp(argv[i], "--seed") == 0 && hasValue)
+        {
+            seed = static_cast<uint32_t>(std::stoul(argv[++i]));
+            seeded = true;
+        }
+        else if (std::strcmp(argv[i], "--pack") == 0 && hasValue)
+        {
+            packFilename = argv[++i];
+        }
+        else if (argv[i][0] != '-')
+        {
+            roms.emplace_back(argv[i]);
+        }
+        else
+        {
+            printUsage(argv[0]);
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
+    if (instanceCount == 0 || (roms.empty() && packFilename.empty()) || sliceFrames == 0 || (cycleBudget == 0) == (frameBudget == 0))
+    {
+        printUsage(argv[0]);
+        std::exit(EXIT_FAILURE);
+    }
+
+    if (frameBudget != 0)
+    {
+        cycleBudget = frameStartCycle(frameBudget);
+    }
+
+    // Load the ROM library before anything runs, so a bad ROM is reported up front and no worker
+    // ever touches the file system
+    RomPack pack;
+    std::vector<std::vector<uint8_t>> files;
+    std::vector<RomImage> images;
+    if (!packFilename.empty())
+    {
+        if (!pack.open(packFilename))
+        {
+            std::cerr << "Failed to open ROM pack: " << pack.error() << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        if (roms.empty())
+        {
+            for (size_t i = 0; i < pack.size(); ++i)
+            {
+                roms.push_back(pack.rom(i).nameString());
+            }
+        }
+    }
+    // Every ROM has to fit in the selected machine's memory
+    unsigned int maxRomSize = machine == Machine::XoChip ? XOCHIP_MAX_ROM_SIZE : MAX_ROM_SIZE;
+    for (const std::string& rom : roms)
+    {
+        if (!packFilename.empty())
+        {
+            size_t index;
+            if (!pack.find(rom, index))
+            {
+                std::cerr << "No ROM named " << rom << " in " << packFilename << std::endl;
+                std::exit(EXIT_FAILURE);
+            }
+            PackedRom packed = pack.rom(index);
+            if (packed.size > maxRomSize)
+            {
+                std::cerr << "ROM " << rom << " is larger than " << maxRomSize << " bytes" << std::endl;
+                std::exit(EXIT_FAILURE);
+            }
+            images.push_back(RomImage{ packed.data, packed.size });
+            continue;
+        }
+
+        std::ifstream file(rom, std::ios::binary);
+        files.emplace_back(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        if (!file.is_open() || files.back().size() > maxRomSize)
+        {
+            std::cerr << "Failed to open ROM file (or larger than " << maxRomSize << " bytes): " << rom << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+    }
+    for (const std::vector<uint8_t>& file : files)
+    {
+        images.push_back(RomImage{ file.data(), file.size() });
+    }
+    if (images.empty())
+    {
+        std::cerr << "No ROMs to run" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    ThreadPool pool(threadCount);
+
+    Batch batch;
+    batch.pool = &pool;
+    batch.cycleBudget = cycleBudget;
+    batch.sliceCycles = std::max(1ULL, frameStartCycle(sliceFrames));
+
+    // Create the instances, assigning the ROMs round robin
+    batch.instances.reserve(instanceCount);
+    for (unsigned long long i = 0; i < instanceCount; ++i)
+    {
+        batch.instances.emplace_back(new Instance());
+        batch.instances.back()->rom = &images[i % images.size()];
+        batch.instances.back()->chip8.setEngine(engine);
+        batch.instances.back()->chip8.setMachine(machine);
+        batch.instances.back()->chip8.setQuirks(quirks);
+
+        // With a seed every run executes exactly the same workload
+        if (seeded)
+        {
+            batch.instances.back()->chip8.seedRandom(seed);
+        }
+    }
+
+    auto startTime = std::chrono::steady_clock::now();
+
+    for (auto& instance : batch.instances)
+    {
+        Instance* target = instance.get();
+        pool.submit([&batch, target] { batch.runSlice(*target); });
+    }
+    pool.wait();
+
+    std::chrono::duration<double> wallTime = std::chrono::steady_clock::now() - startTime;
+    double seconds = wallTime.count() > 0.0 ? wallTime.count() : 1e-9;
+
+    unsigned long long totalCycles = 0;
+    unsigned long long totalFrames = 0;
+    for (const auto& instance : batch.instances)
+    {
+        totalCycles += instance->cycles;
+        totalFrames += instance->frames;
+    }
+
+    // Report aggregate throughput
+    std::cout << "Instances: " << instanceCount << "\n"
+              << "Threads: " << pool.size() << "\n"
+              << "Slices: " << batch.slices.load() << " (" << pool.steals() << " stolen)\n"
+              << "Instructions: " << totalCycles << "\n"
+              << "Frames: " << totalFrames << "\n"
+              << "Wall time: " << wallTime.count() << " s\n"
+              << "Instructions/sec: " << static_cast<double>(totalCycles) / seconds << "\n"
+              << "Frames/sec: " << static_cast<double>(totalFrames) / seconds << "\n"
+              << "Instructions/sec per thread: " << static_cast<double>(totalCycles) / seconds / pool.size() << "\n";
+
+    return 0;
+}
@@ -0,0 +1,529 @@
+#include "chip8.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Benchmark suite
+// Microbenchmarks run small generated programs that loop over a single opcode family, so the cost
+// of that family can be compared between engines and between builds. Macrobenchmarks run whole
+// programs (generated ones and any ROM files given on the command line) for a fixed number of
+// cycles with the 60 Hz frames, like chip8headless.
+// Every benchmark is repeated; the report gives the mean throughput, its standard deviation and
+// the fastest and slowest repetition, as text, JSON or CSV.
+
+static void printUsage(const char* program)
+{
+    std::cerr << "Usage: " << program << " [--cycles <N>] [--reps <N>] [--engines <Engine,...>] [--filter <Text>]"
+              << " [--format text|json|csv] [--output <File>] [--write-roms <Directory>] [ROM...]\n"
+              << "Engines: interpreter, threaded, cached, jit, jit-verify, aot (default: interpreter,threaded,cached,jit)\n"
+              << "--write-roms saves the generated programs as <Directory>/<Benchmark>.ch8 instead of running them\n";
+}
+
+// Little assembler for the generated programs, which start at START_ADDRESS
+struct Program
+{
+    std::vector<uint8_t> bytes;
+
+    uint16_t here() const { return static_cast<uint16_t>(START_ADDRESS + bytes.size()); }
+
+    void op(unsigned int opcode)
+    {
+        bytes.push_back(static_cast<uint8_t>(opcode >> 8));
+        bytes.push_back(static_cast<uint8_t>(opcode));
+    }
+
+    // Repeats `body` until the loop holds about `count` instructions, then jumps back to `start`
+    template <typename Body>
+    void loop(uint16_t start, unsigned int count, Body body)
+    {
+        while (static_cast<unsigned int>(here() - start) < count * 2)
+        {
+            body(*this);
+        }
+        op(0x1000 | start);
+    }
+};
+
+// Address of the sprite and register data of the generated programs, well clear of their code
+const uint16_t DATA_ADDRESS = 0xE00;
+const unsigned int LOOP_LENGTH = 256;
+
+struct Benchmark
+{
+    std::string name;
+    bool macro;                 // Runs frame by frame, for the macro cycle count
+    std::vector<uint8_t> rom;
+};
+
+// Sets V0-VE to distinct values so the ALU and skip instructions see varied operands
+static void setRegisters(Program& program)
+{
+    for (unsigned int x = 0; x < 0xF; ++x)
+    {
+        program.op(0x6000 | (x << 8) | (0x11 * x + 3));
+    }
+}
+
+// Sprite data for the Dxyn benchmarks: 15 rows with mixed bit patterns
+static void appendSpriteData(Program& program)
+{
+    program.bytes.resize(DATA_ADDRESS - START_ADDRESS, 0);
+    for (unsigned int row = 0; row < 15; ++row)
+    {
+        program.bytes.push_back(static_cast<uint8_t>(0xA5 ^ (row * 0x1F)));
+    }
+}
+
+static Benchmark drawBenchmark(const std::string& name, unsigned int x, unsigned int y, unsigned int height)
+{
+    Program program;
+    program.op(0x6000 | x);                 // V0 = x
+    program.op(0x6100 | y);                 // V1 = y
+    program.op(0xA000 | DATA_ADDRESS);
+    uint16_t start = program.here();
+    program.loop(start, LOOP_LENGTH, [height](Program& p) { p.op(0xD010 | height); });
+    appendSpriteData(program);
+    return Benchmark{ name, false, program.bytes };
+}
+
+static std::vector<Benchmark> microBenchmarks()
+{
+    std::vector<Benchmark> benchmarks;
+
+    {
+        // Every 8xy* operation, over all register pairs
+        Program program;
+        setRegisters(program);
+        uint16_t start = program.here();
+        const unsigned int operations[] = { 0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0xE };
+        unsigned int step = 0;
+        program.loop(start, LOOP_LENGTH, [&](Program& p) {
+            unsigned int x = step % 15;
+            unsigned int y = (step * 7 + 3) % 15;
+            p.op(0x8000 | (x << 8) | (y << 4) | operations[step % 9]);
+            ++step;
+        });
+        benchmarks.push_back(Benchmark{ "alu-8xy", false, program.bytes });
+    }
+
+    {
+        // 3xkk, 4xkk, 5xy0 and 9xy0 that fall through
+        Program program;
+        setRegisters(program);
+        uint16_t start = program.here();
+        program.loop(start, LOOP_LENGTH, [](Program& p) {
+            p.op(0x3100);   // V1 != 0x00
+            p.op(0x4114);   // V1 == 0x14
+            p.op(0x5120);   // V1 != V2
+            p.op(0x9330);   // V3 == V3
+        });
+        benchmarks.push_back(Benchmark{ "skip-not-taken", false, program.bytes });
+    }
+
+    {
+        // The same skips, taken over a filler instruction
+        Program program;
+        setRegisters(program);
+        uint16_t start = program.here();
+        program.loop(start, LOOP_LENGTH, [](Program& p) {
+            p.op(0x3114); p.op(0x6F00);
+            p.op(0x4100); p.op(0x6F00);
+            p.op(0x5330); p.op(0x6F00);
+            p.op(0x9120); p.op(0x6F00);
+        });
+        benchmarks.push_back(Benchmark{ "skip-taken", false, program.bytes });
+    }
+
+    benchmarks.push_back(drawBenchmark("dxyn-h1", 8, 8, 1));
+    benchmarks.push_back(drawBenchmark("dxyn-h8", 8, 8, 8));
+    benchmarks.push_back(drawBenchmark("dxyn-h15", 8, 8, 15));
+    benchmarks.push_back(drawBenchmark("dxyn-h8-unaligned", 13, 8, 8));
+    benchmarks.push_back(drawBenchmark("dxyn-h8-wrap-x", 60, 8, 8));
+    benchmarks.push_back(drawBenchmark("dxyn-h8-wrap-y", 8, 28, 8));
+
+    {
+        // Stores of all 16 registers
+        Program program;
+        setRegisters(program);
+        uint16_t start = program.here();
+        program.loop(start, LOOP_LENGTH, [](Program& p) {
+            p.op(0xA000 | DATA_ADDRESS);
+            p.op(0xFF55);
+        });
+        benchmarks.push_back(Benchmark{ "fx55", false, program.bytes });
+    }
+
+    {
+        // Loads of all 16 registers
+        Program program;
+        uint16_t start = program.here();
+        program.loop(start, LOOP_LENGTH, [](Program& p) {
+            p.op(0xA000 | DATA_ADDRESS);
+            p.op(0xFF65);
+        });
+        appendSpriteData(program);
+        benchmarks.push_back(Benchmark{ "fx65", false, program.bytes });
+    }
+
+    {
+        // BCD conversion of varied values
+        Program program;
+        setRegisters(program);
+        program.op(0xA000 | DATA_ADDRESS);
+        uint16_t start = program.here();
+        unsigned int x = 0;
+        program.loop(start, LOOP_LENGTH, [&x](Program& p) {
+            p.op(0xF033 | (x << 8));
+            x = (x + 1) % 15;
+        });
+        benchmarks.push_back(Benchmark{ "fx33", false, program.bytes });
+    }
+
+    return benchmarks;
+}
+
+static std::vector<Benchmark> macroBenchmarks()
+{
+    std::vector<Benchmark> benchmarks;
+
+    {
+        // Straight computation: arithmetic, a subroutine call, RND, BCD and memory traffic
+        Program program;
+        setRegisters(program);
+        uint16_t start = program.here();
+        uint16_t subroutine = static_cast<uint16_t>(start + 2 * 16);
+        program.op(0x1000 | static_cast<uint16_t>(subroutine + 2 * 4));    // Jump over the subroutine
+        while (program.here() < subroutine)
+        {
+            program.op(0x6F00);
+        }
+        program.op(0x8014); program.op(0x8125); program.op(0x8236); program.op(0x00EE);
+        program.op(0x7001); program.op(0x7102);
+        program.op(0x2000 | subroutine);
+        program.op(0xC3FF); program.op(0xA000 | DATA_ADDRESS); program.op(0xF333);
+        program.op(0xF255); program.op(0xF265);
+        program.op(0x3000); program.op(0x8456);
+        program.op(0x1000 | start);
+        benchmarks.push_back(Benchmark{ "synthetic-compute", true, program.bytes });
+    }
+
+    {
+        // A game-like frame: clear, draw a row of digits, move, and wait for the delay timer
+        Program program;
+        program.op(0x6A00);                          // VA = x
+        uint16_t frame = program.here();
+        program.op(0x00E0);
+        program.op(0x6B05);                          // VB = y
+        program.op(0x6C00);                          // VC = digit
+        uint16_t digit = program.here();
+        program.op(0xFC29);                          // I = glyph of VC
+        program.op(0xDAB5);
+        program.op(0x7A05);
+        program.op(0x7C01);
+        program.op(0x3C0A);                          // Ten digits
+        program.op(0x1000 | digit);
+        program.op(0x7A03);                          // Scroll the row
+        program.op(0x6D02);
+        program.op(0xFD15);                          // DT = 2
+        uint16_t wait = program.here();
+        program.op(0xFD07);
+        program.op(0x3D00);
+        program.op(0x1000 | wait);
+        program.op(0x1000 | frame);
+        benchmarks.push_back(Benchmark{ "synthetic-game", true, program.bytes });
+    }
+
+    return benchmarks;
+}
+
+static bool readROM(const std::string& filename, std::vector<uint8_t>& rom)
+{
+    std::ifstream file(filename, std::ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+    rom.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return rom.size() <= MAX_ROM_SIZE;
+}
+
+struct Result
+{
+    std::string benchmark;
+    std::string kind;
+    std::string engine;
+    unsigned long long cycles;
+    unsigned int reps;
+    double cyclesPerSecond;         // Mean over the repetitions
+    double cyclesPerSecondStddev;
+    double nsPerInstruction;        // Mean over the repetitions
+    double nsPerInstructionMin;
+    double nsPerInstructionMax;
+};
+
+static Result runBenchmark(const Benchmark& benchmark, const std::string& engineName, Engine engine,
+                           unsigned long long cycles, unsigned int reps)
+{
+    std::vector<double> rates;
+    std::vector<double> nanoseconds;
+
+    for (unsigned int rep = 0; rep < reps; ++rep)
+    {
+        // A fresh machine every time, with a fixed seed, so all repetitions run the same instructions
+        Chip8 chip8;
+        chip8.seedRandom(1);
+        chip8.setEngine(engine);
+        chip8.loadROM(benchmark.rom.data(), benchmark.rom.size());
+
+        // Warm up: translate the code and fault in the memory before timing
+        unsigned long long warmup = std::min<unsigned long long>(cycles / 10, 100000);
+        chip8.runUnpaced(0, warmup);
+
+        auto start = std::chrono::steady_clock::now();
+        if (benchmark.macro)
+        {
+            chip8.runUnpaced(warmup, warmup + cycles);
+        }
+        else
+        {
+            chip8.run(cycles);
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        seconds = std::max(seconds, 1e-9);
+
+        rates.push_back(static_cast<double>(cycles) / seconds);
+        nanoseconds.push_back(seconds * 1e9 / static_cast<double>(cycles));
+    }
+
+    double meanRate = 0.0;
+    double meanNs = 0.0;
+    for (unsigned int rep = 0; rep < reps; ++rep)
+    {
+        meanRate += rates[rep] / reps;
+        meanNs += nanoseconds[rep] / reps;
+    }
+    double variance = 0.0;
+    for (double rate : rates)
+    {
+        variance += (rate - meanRate) * (rate - meanRate);
+    }
+    variance = reps > 1 ? variance / (reps - 1) : 0.0;
+
+    Result result;
+    result.benchmark = benchmark.name;
+    result.kind = benchmark.macro ? "macro" : "micro";
+    result.engine = engineName;
+    result.cycles = cycles;
+    result.reps = reps;
+    result.cyclesPerSecond = meanRate;
+    result.cyclesPerSecondStddev = std::sqrt(variance);
+    result.nsPerInstruction = meanNs;
+    result.nsPerInstructionMin = *std::min_element(nanoseconds.begin(), nanoseconds.end());
+    result.nsPerInstructionMax = *std::max_element(nanoseconds.begin(), nanoseconds.end());
+    return result;
+}
+
+// Benchmark names are ROM file names at worst; escape what JSON needs
+static std::string jsonString(const std::string& text)
+{
+    std::string out = "\"";
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+        {
+            out += '\\';
+        }
+        out += c;
+    }
+    return out + "\"";
+}
+
+static void writeReport(std::ostream& out, const std::string& format, const std::vector<Result>& results)
+{
+    if (format == "json")
+    {
+        out << "{\n  \"results\": [\n";
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const Result& r = results[i];
+            out << "    {\"benchmark\": " << jsonString(r.benchmark) << ", \"kind\": \"" << r.kind
+                << "\", \"engine\": \"" << r.engine << "\", \"cycles\": " << r.cycles << ", \"reps\": " << r.reps
+                << ", \"cycles_per_sec\": " << r.cyclesPerSecond << ", \"cycles_per_sec_stddev\": " << r.cyclesPerSecondStddev
+                << ", \"ns_per_instruction\": " << r.nsPerInstruction << ", \"ns_per_instruction_min\": " << r.nsPerInstructionMin
+                << ", \"ns_per_instruction_max\": " << r.nsPerInstructionMax << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        out << "  ]\n}\n";
+    }
+    else if (format == "csv")
+    {
+        out << "benchmark,kind,engine,cycles,reps,cycles_per_sec,cycles_per_sec_stddev,ns_per_instruction,ns_per_instruction_min,ns_per_instruction_max\n";
+        for (const Result& r : results)
+        {
+            out << r.benchmark << "," << r.kind << "," << r.engine << "," << r.cycles << "," << r.reps << ","
+                << r.cyclesPerSecond << "," << r.cyclesPerSecondStddev << "," << r.nsPerInstruction << ","
+                << r.nsPerInstructionMin << "," << r.nsPerInstructionMax << "\n";
+        }
+    }
+    else
+    {
+        for (const Result& r : results)
+        {
+            out << r.kind << " " << r.benchmark << " [" << r.engine << "]: " << r.cyclesPerSecond / 1e6 << " M instr/s"
+                << " (+/- " << (r.cyclesPerSecond > 0.0 ? 100.0 * r.cyclesPerSecondStddev / r.cyclesPerSecond : 0.0) << "%), "
+                << r.nsPerInstruction << " ns/instr (" << r.nsPerInstructionMin << " - " << r.nsPerInstructionMax << ")\n";
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    unsigned long long microCycles = 2000000;
+    unsigned long long macroCycles = 10000000;
+    unsigned int reps = 5;
+    std::string engineList = "interpreter,threaded,cached,jit";
+    std::string filter;
+    std::string format = "text";
+    std::string outputFilename;
+    std::string romDirectory;
+    std::vector<std::string> romFilenames;
+
+    // Parse command-line arguments
+    for (int i = 1; i < argc; ++i)
+    {
+        bool hasValue = i + 1 < argc;
+        if (std::strcmp(argv[i], "--cycles") == 0 && hasValue)
+        {
+            microCycles = macroCycles = std::stoull(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--reps") == 0 && hasValue)
+        {
+            reps = static_cast<unsigned int>(std::stoul(argv[++i]));
+        }
+        else if (std::strcmp(argv[i], "--engines") == 0 && hasValue)
+        {
+            engineList = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--filter") == 0 && hasValue)
+        {
+            filter = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--format") == 0 && hasValue)
+        {
+            format = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--output") == 0 && hasValue)
+        {
+            outputFilename = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--write-roms") == 0 && hasValue)
+        {
+            romDirectory = argv[++i];
+        }
+        else if (argv[i][0] != '-')
+        {
+            romFilenames.emplace_back(argv[i]);
+        }
+        else
+        {
+            printUsage(argv[0]);
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
+    if (reps == 0 || microCycles == 0 || (format != "text" && format != "json" && format != "csv"))
+    {
+        printUsage(argv[0]);
+        std::exit(EXIT_FAILURE);
+    }
+
+    std::vector<std::pair<std::string, Engine>> engines;
+    std::stringstream names(engineList);
+    std::string name;
+    while (std::getline(names, name, ','))
+    {
+        Engine engine;
+        if (!parseEngine(name, engine))
+        {
+            std::cerr << "Unknown engine: " << name << std::endl;
+            printUsage(argv[0]);
+            std::exit(EXIT_FAILURE);
+        }
+        engines.emplace_back(name, engine);
+    }
+
+    std::vector<Benchmark> benchmarks = microBenchmarks();
+    for (Benchmark& benchmark : macroBenchmarks())
+    {
+        benchmarks.push_back(benchmark);
+    }
+    for (const std::string& filename : romFilenames)
+    {
+        Benchmark benchmark{ filename, true, {} };
+        if (!readROM(filename, benchmark.rom))
+        {
+            std::cerr << "Failed to open ROM file (or larger than " << MAX_ROM_SIZE << " bytes): " << filename << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        benchmarks.push_back(benchmark);
+    }
+
+    // The generated programs double as test ROMs (see tests/engine_checksums.cmake)
+    if (!romDirectory.empty())
+    {
+        for (const Benchmark& benchmark : benchmarks)
+        {
+            if (!filter.empty() && benchmark.name.find(filter) == std::string::npos)
+            {
+                continue;
+            }
+            std::string filename = romDirectory + "/" + benchmark.name + ".ch8";
+            std::ofstream rom(filename, std::ios::binary);
+            rom.write(reinterpret_cast<const char*>(benchmark.rom.data()), static_cast<std::streamsize>(benchmark.rom.size()));
+            if (!rom)
+            {
+                std::cerr << "Failed to write ROM: " << filename << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+        return 0;
+    }
+
+    std::vector<Result> results;
+    for (const Benchmark& benchmark : benchmarks)
+    {
+        if (!filter.empty() && benchmark.name.find(filter) == std::string::npos)
+        {
+            continue;
+        }
+        for (const auto& engine : engines)
+        {
+            results.push_back(runBenchmark(benchmark, engine.first, engine.second,
+                                           benchmark.macro ? macroCycles : microCycles, reps));
+        }
+    }
+
+    if (outputFilename.empty())
+    {
+        writeReport(std::cout, format, results);
+    }
+    else
+    {
+        std::ofstream output(outputFilename);
+        writeReport(output, format, results);
+        if (!output)
+        {
+            std::cerr << "Failed to write report: " << outputFilename << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    return 0;
+}
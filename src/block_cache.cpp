@@ -0,0 +1,409 @@
+#include "block_cache.hpp"
+#include <cstring>
+
+// Longest run of instructions decoded into one block
+const unsigned int MAX_BLOCK_INSTRUCTIONS = 64;
+
+// Micro-op handlers
+// Each handler runs one predecoded instruction (or a fused pair) with its operands taken from the
+// micro-op. When a handler runs, Chip8::pc already points past the instructions it covers and
+// Chip8::opcode holds the last opcode, so the op_* handlers of the interpreter can be reused as is.
+struct BlockCache::Ops
+{
+    // Run the instruction through the interpreter's dispatch tables
+    static void fallback(Chip8& c, const MicroOp& op)
+    {
+        ((c).*(Chip8::table[op.opcode >> 12]))();
+    }
+
+    //CLS
+    static void cls(Chip8& c, const MicroOp&)
+    {
+        c.op_00E0();
+    }
+
+    //JP address
+    static void jump(Chip8& c, const MicroOp& op)
+    {
+        c.pc = op.nnn;
+    }
+
+    //SE Vx, kk
+    static void skipEqual(Chip8& c, const MicroOp& op)
+    {
+        if (c.registers[op.x] == op.kk) {
+            c.pc += 2;
+        }
+    }
+
+    //SNE Vx, kk
+    static void skipNotEqual(Chip8& c, const MicroOp& op)
+    {
+        if (c.registers[op.x] != op.kk) {
+            c.pc += 2;
+        }
+    }
+
+    //SE Vx, Vy
+    static void skipEqualReg(Chip8& c, const MicroOp& op)
+    {
+        if (c.registers[op.x] == c.registers[op.y]) {
+            c.pc += 2;
+        }
+    }
+
+    //SNE Vx, Vy
+    static void skipNotEqualReg(Chip8& c, const MicroOp& op)
+    {
+        if (c.registers[op.x] != c.registers[op.y]) {
+            c.pc += 2;
+        }
+    }
+
+    //LD Vx, byte
+    static void load(Chip8& c, const MicroOp& op)
+    {
+        c.registers[op.x] = op.kk;
+    }
+
+    //ADD Vx, byte
+    static void add(Chip8& c, const MicroOp& op)
+    {
+        c.registers[op.x] += op.kk;
+    }
+
+    //LD Vx, Vy
+    static void move(Chip8& c, const MicroOp& op)
+    {
+        c.registers[op.x] = c.registers[op.y];
+    }
+
+    //OR Vx, Vy
+    static void orReg(Chip8& c, const MicroOp& op)
+    {
+        c.registers[op.x] |= c.registers[op.y];
+    }
+
+    //AND Vx, Vy
+    static void andReg(Chip8& c, const MicroOp& op)
+    {
+        c.registers[op.x] &= c.registers[op.y];
+    }
+
+    //XOR Vx, Vy
+    static void xorReg(Chip8& c, const MicroOp& op)
+    {
+        c.registers[op.x] ^= c.registers[op.y];
+    }
+
+    //ADD Vx, Vy
+    static void addReg(Chip8& c, const MicroOp& op)
+    {
+        uint16_t sum = c.registers[op.x] + c.registers[op.y];
+        c.registers[0xF] = (sum > 255) ? 1 : 0;
+        c.registers[op.x] = sum & 0xFF;
+    }
+
+    //SUB Vx, Vy
+    static void subReg(Chip8& c, const MicroOp& op)
+    {
+        c.registers[0xF] = (c.registers[op.x] > c.registers[op.y]) ? 1 : 0;
+        c.registers[op.x] -= c.registers[op.y];
+    }
+
+    //SHR Vx
+    static void shiftRight(Chip8& c, const MicroOp& op)
+    {
+        c.registers[0xF] = c.registers[op.x] & 0x1;
+        c.registers[op.x] >>= 1;
+    }
+
+    //SUBN Vx, Vy
+    static void subnReg(Chip8& c, const MicroOp& op)
+    {
+        c.registers[0xF] = (c.registers[op.y] > c.registers[op.x]) ? 1 : 0;
+        c.registers[op.x] = c.registers[op.y] - c.registers[op.x];
+    }
+
+    //SHL Vx
+    static void shiftLeft(Chip8& c, const MicroOp& op)
+    {
+        c.registers[0xF] = (c.registers[op.x] & 0x80u) >> 7u;
+        c.registers[op.x] <<= 1;
+    }
+
+    //LD I, addr
+    static void loadIndex(Chip8& c, const MicroOp& op)
+    {
+        c.index = op.nnn;
+    }
+
+    //LD Vx, DT
+    static void readDelay(Chip8& c, const MicroOp& op)
+    {
+        c.registers[op.x] = c.getDelayTimer();
+    }
+
+    //LD DT, Vx
+    static void setDelay(Chip8& c, const MicroOp& op)
+    {
+        c.setDelayTimer(c.registers[op.x]);
+    }
+
+    //LD ST, Vx
+    static void setSound(Chip8& c, const MicroOp& op)
+    {
+        c.setSoundTimer(c.registers[op.x]);
+    }
+
+    //ADD I, Vx
+    static void addIndex(Chip8& c, const MicroOp& op)
+    {
+        c.index += c.registers[op.x];
+    }
+
+    //LD B, Vx and LD [I], Vx: may write into cached code
+    static void storeBcd(Chip8& c, const MicroOp&)
+    {
+        uint16_t address = c.index;
+        c.op_Fx33();
+        c.blockCache->checkCodeWrite(address, 3);
+    }
+
+    static void storeRegisters(Chip8& c, const MicroOp& op)
+    {
+        uint16_t address = c.index;
+        c.op_Fx55<OriginalQuirks>();
+        c.blockCache->checkCodeWrite(address, op.x + 1u);
+    }
+
+    // Superinstructions
+
+    //LD I, addr + DRW Vx, Vy, nibble
+    static void loadIndexDraw(Chip8& c, const MicroOp& op)
+    {
+        c.index = op.nnn;
+        c.op_Dxyn<OriginalQuirks>();
+    }
+
+    //LD Vx, byte + LD Vx, byte
+    static void loadLoad(Chip8& c, const MicroOp& op)
+    {
+        c.registers[op.x] = op.kk;
+        c.registers[op.x2] = op.kk2;
+    }
+
+    //ADD Vx, byte + SE Vx, byte
+    static void addSkipEqual(Chip8& c, const MicroOp& op)
+    {
+        c.registers[op.x] += op.kk;
+        if (c.registers[op.x2] == op.kk2) {
+            c.pc += 2;
+        }
+    }
+
+    //ADD Vx, byte + SNE Vx, byte
+    static void addSkipNotEqual(Chip8& c, const MicroOp& op)
+    {
+        c.registers[op.x] += op.kk;
+        if (c.registers[op.x2] != op.kk2) {
+            c.pc += 2;
+        }
+    }
+
+    // Decodes one opcode into a micro-op
+    // Returns true when the instruction ends the block (it can change pc or write into memory)
+    static bool decode(uint16_t opcode, uint16_t address, MicroOp& op)
+    {
+        op.address = address;
+        op.opcode = opcode;
+        op.nnn = opcode & 0x0FFFu;
+        op.x = (opcode & 0x0F00u) >> 8u;
+        op.y = (opcode & 0x00F0u) >> 4u;
+        op.kk = opcode & 0x00FFu;
+        op.x2 = 0;
+        op.kk2 = 0;
+        op.length = 1;
+        op.handler = nullptr;
+
+        switch (opcode >> 12) {
+            case 0x0:
+                // Decoded on the last nibble only, like Chip8::Table0
+                if ((opcode & 0x000Fu) == 0x0) {
+                    op.handler = &Ops::cls;
+                    return false;
+                }
+                op.handler = &Ops::fallback;
+                return (opcode & 0x000Fu) == 0xE;
+            case 0x1: op.handler = &Ops::jump; return true;
+            case 0x2: op.handler = &Ops::fallback; return true;
+            case 0x3: op.handler = &Ops::skipEqual; return true;
+            case 0x4: op.handler = &Ops::skipNotEqual; return true;
+            case 0x5: op.handler = &Ops::skipEqualReg; return true;
+            case 0x6: op.handler = &Ops::load; return false;
+            case 0x7: op.handler = &Ops::add; return false;
+            case 0x8:
+                switch (opcode & 0x000Fu) {
+                    case 0x0: op.handler = &Ops::move; break;
+                    case 0x1: op.handler = &Ops::orReg; break;
+                    case 0x2: op.handler = &Ops::andReg; break;
+                    case 0x3: op.handler = &Ops::xorReg; break;
+                    case 0x4: op.handler = &Ops::addReg; break;
+                    case 0x5: op.handler = &Ops::subReg; break;
+                    case 0x6: op.handler = &Ops::shiftRight; break;
+                    case 0x7: op.handler = &Ops::subnReg; break;
+                    case 0xE: op.handler = &Ops::shiftLeft; break;
+                    default: op.handler = &Ops::fallback; break;
+                }
+                return false;
+            case 0x9: op.handler = &Ops::skipNotEqualReg; return true;
+            case 0xA: op.handler = &Ops::loadIndex; return false;
+            case 0xB: op.handler = &Ops::fallback; return true;
+            case 0xC: op.handler = &Ops::fallback; return false;
+            case 0xD: op.handler = &Ops::fallback; return false;
+            case 0xE: op.handler = &Ops::fallback; return true;
+            default:
+                switch (opcode & 0x00FFu) {
+                    case 0x07: op.handler = &Ops::readDelay; return false;
+                    case 0x0A: op.handler = &Ops::fallback; return true;
+                    case 0x15: op.handler = &Ops::setDelay; return false;
+                    case 0x18: op.handler = &Ops::setSound; return false;
+                    case 0x1E: op.handler = &Ops::addIndex; return false;
+                    case 0x33: op.handler = &Ops::storeBcd; return true;
+                    case 0x55: op.handler = &Ops::storeRegisters; return true;
+                    default: op.handler = &Ops::fallback; return false;
+                }
+        }
+    }
+
+    // Tries to fuse two decoded instructions into one superinstruction
+    // Returns true when `first` was turned into the fused micro-op
+    static bool fuse(MicroOp& first, const MicroOp& second)
+    {
+        uint8_t a = first.opcode >> 12;
+        uint8_t b = second.opcode >> 12;
+
+        if (a == 0xA && b == 0xD) {
+            first.handler = &Ops::loadIndexDraw;
+        } else if (a == 0x6 && b == 0x6) {
+            first.handler = &Ops::loadLoad;
+        } else if (a == 0x7 && b == 0x3) {
+            first.handler = &Ops::addSkipEqual;
+        } else if (a == 0x7 && b == 0x4) {
+            first.handler = &Ops::addSkipNotEqual;
+        } else {
+            return false;
+        }
+
+        first.opcode = second.opcode;
+        first.x2 = second.x;
+        first.kk2 = second.kk;
+        first.length = 2;
+        return true;
+    }
+};
+
+BlockCache::BlockCache()
+    : compiled_(0), flushes_(0), flushPending_(false)
+{
+    std::memset(lookup_, 0, sizeof(lookup_));
+    std::memset(covered_, 0, sizeof(covered_));
+}
+
+void BlockCache::flush() {
+    blocks_.clear();
+    std::memset(lookup_, 0, sizeof(lookup_));
+    std::memset(covered_, 0, sizeof(covered_));
+    flushPending_ = false;
+    ++flushes_;
+}
+
+void BlockCache::checkCodeWrite(uint16_t address, unsigned int length) {
+    // The block running the write always ends right after it, so the flush can wait until then
+    for (unsigned int i = 0; i < length && address + i < MEMORY_SIZE; ++i) {
+        if (covered_[address + i]) {
+            flushPending_ = true;
+            return;
+        }
+    }
+}
+
+Block* BlockCache::compile(const Chip8& chip8, uint16_t start) {
+    std::unique_ptr<Block> block(new Block());
+    block->start = start;
+
+    uint16_t address = start;
+    unsigned int instructions = 0;
+    bool terminal = false;
+    while (!terminal && address + 1u < MEMORY_SIZE && instructions < MAX_BLOCK_INSTRUCTIONS) {
+        MicroOp op;
+        uint16_t opcode = (chip8.memory[address] << 8) | chip8.memory[address + 1];
+        terminal = Ops::decode(opcode, address, op);
+
+        // Look at the next instruction for a fusion opportunity
+        if (!terminal && address + 3u < MEMORY_SIZE) {
+            MicroOp next;
+            uint16_t nextOpcode = (chip8.memory[address + 2] << 8) | chip8.memory[address + 3];
+            bool nextTerminal = Ops::decode(nextOpcode, address + 2, next);
+            if (Ops::fuse(op, next)) {
+                terminal = nextTerminal;
+            }
+        }
+
+        block->ops.push_back(op);
+        address += 2 * op.length;
+        instructions += op.length;
+    }
+    block->end = address;
+
+    for (uint16_t i = start; i < address; ++i) {
+        covered_[i] = 1;
+    }
+
+    ++compiled_;
+    lookup_[start] = block.get();
+    blocks_.push_back(std::move(block));
+    return lookup_[start];
+}
+
+void BlockCache::run(Chip8& chip8, unsigned long long cycles) {
+    while (cycles > 0) {
+        uint16_t pc = chip8.pc;
+
+        // Code running off the end of memory is left to the interpreter
+        if (pc + 1u >= MEMORY_SIZE) {
+            chip8.cycle();
+            --cycles;
+            continue;
+        }
+
+        Block* block = lookup_[pc];
+        if (block == nullptr) {
+            block = compile(chip8, pc);
+        }
+
+        for (const MicroOp& op : block->ops) {
+            // The budget ends inside this micro-op: finish one instruction at a time.
+            // Chip8::pc already points at the micro-op, since the previous one was sequential.
+            if (op.length > cycles) {
+                for (; cycles > 0; --cycles) {
+                    chip8.cycle();
+                }
+                return;
+            }
+
+            chip8.pc = op.address + 2 * op.length;
+            chip8.opcode = op.opcode;
+            op.handler(chip8, op);
+
+            // Advance the clock as Chip8::cycle() does; timer instructions are never fused, so the
+            // counter is exact when their handlers run
+            chip8.cycleCount += op.length;
+            cycles -= op.length;
+        }
+
+        if (flushPending_) {
+            flush();
+        }
+    }
+}
@@ -1,14 +1,22 @@
 #include "chip8.hpp"
+#include "aot.hpp"
+#include "block_cache.hpp"
+#include "jit.hpp"
+#include "profiler.hpp"
+#include "threaded.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <cassert>
 #include <fstream>
 #include <vector>
 #include <cstdint>
+#include <cstring>
 #include <iostream>
-#include <random>
 #include <chrono>
+#include <mutex>
 
 const unsigned int FONTSET_SIZE = 80;
 const unsigned int FONTSET_START_ADDRESS = 0x50;
-const unsigned int START_ADDRESS = 0x200;
 
 uint8_t fontSet[FONTSET_SIZE] = 
     {
@@ -30,7 +38,48 @@ uint8_t fontSet[FONTSET_SIZE] =
         0xF0, 0x80, 0xF0, 0x80, 0x80   // F
     };
 
+// SUPER-CHIP and XO-CHIP large font (Fx30): 8x10 digits, right after the small one
+const unsigned int BIG_FONTSET_SIZE = 160;
+const unsigned int BIG_FONTSET_START_ADDRESS = FONTSET_START_ADDRESS + FONTSET_SIZE;
+
+uint8_t bigFontSet[BIG_FONTSET_SIZE] =
+    {
+        0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF,  // 0
+        0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF,  // 1
+        0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF,  // 2
+        0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF,  // 3
+        0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03,  // 4
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF,  // 5
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF,  // 6
+        0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18,  // 7
+        0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF,  // 8
+        0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF,  // 9
+        0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3,  // A
+        0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC,  // B
+        0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C,  // C
+        0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC,  // D
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF,  // E
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0   // F
+    };
+
+Chip8::Chip8Func Chip8::table[0xF + 1];
+Chip8::Chip8Func Chip8::table0[0xF + 1];
+Chip8::Chip8Func Chip8::table00[0xFF + 1];
+Chip8::Chip8Func Chip8::table8[0xF + 1];
+Chip8::Chip8Func Chip8::tableE[0xF + 1];
+Chip8::Chip8Func Chip8::tableF[0xFF + 1];
+
 void Chip8::setupTable() {
+    // Point every sub-table entry at op_NULL first, so unknown opcodes are ignored
+    // instead of calling through an empty slot
+    for (auto& entry : table0) entry = &Chip8::op_NULL;
+    for (auto& entry : table00) entry = &Chip8::op_NULL;
+    for (auto& entry : table8) entry = &Chip8::op_NULL;
+    for (auto& entry : tableE) entry = &Chip8::op_NULL;
+    for (auto& entry : tableF) entry = &Chip8::op_NULL;
+
+    // The tables hold the handlers for the original quirks; step() dispatches the instructions with
+    // quirks straight to the handlers for the selected set
     // Initialize main table
     // The main table is used to determine the general category of the opcode
     // based on the first nibble (4 bits) of the opcode.
@@ -46,9 +95,9 @@ void Chip8::setupTable() {
     table[0x8] = &Chip8::Table8;  // Opcodes starting with 0x8 are handled by Table8
     table[0x9] = &Chip8::op_9xy0; // Opcodes starting with 0x9 are handled by op_9xy0
     table[0xA] = &Chip8::op_Annn; // Opcodes starting with 0xA are handled by op_Annn
-    table[0xB] = &Chip8::op_Bnnn; // Opcodes starting with 0xB are handled by op_Bnnn
+    table[0xB] = &Chip8::op_Bnnn<OriginalQuirks>; // Opcodes starting with 0xB are handled by op_Bnnn
     table[0xC] = &Chip8::op_Cxkk; // Opcodes starting with 0xC are handled by op_Cxkk
-    table[0xD] = &Chip8::op_Dxyn; // Opcodes starting with 0xD are handled by op_Dxyn
+    table[0xD] = &Chip8::op_Dxyn<OriginalQuirks>; // Opcodes starting with 0xD are handled by op_Dxyn
     table[0xE] = &Chip8::TableE;  // Opcodes starting with 0xE are handled by TableE
     table[0xF] = &Chip8::TableF;  // Opcodes starting with 0xF are handled by TableF
 
@@ -58,18 +107,32 @@ void Chip8::setupTable() {
     table0[0x0] = &Chip8::op_00E0; // Opcode 0x00E0 is handled by op_00E0
     table0[0xE] = &Chip8::op_00EE; // Opcode 0x00EE is handled by op_00EE
 
+    // Initialize table00
+    // SUPER-CHIP and XO-CHIP decode opcodes 00nn by their whole last byte.
+    table00[0xE0] = &Chip8::op_00E0;
+    table00[0xEE] = &Chip8::op_00EE;
+    for (unsigned int n = 0; n <= 0xF; ++n) {
+        table00[0xC0 + n] = &Chip8::op_00Cn;
+        table00[0xD0 + n] = &Chip8::op_00Dn;
+    }
+    table00[0xFB] = &Chip8::op_00FB;
+    table00[0xFC] = &Chip8::op_00FC;
+    table00[0xFD] = &Chip8::op_00FD;
+    table00[0xFE] = &Chip8::op_00FE;
+    table00[0xFF] = &Chip8::op_00FF;
+
     // Initialize table8
     // Table8 is used to handle opcodes starting with 0x8.
     // The last nibble of the opcode determines the specific instruction.
     table8[0x0] = &Chip8::op_8xy0; // Opcode 0x8xy0 is handled by op_8xy0
-    table8[0x1] = &Chip8::op_8xy1; // Opcode 0x8xy1 is handled by op_8xy1
-    table8[0x2] = &Chip8::op_8xy2; // Opcode 0x8xy2 is handled by op_8xy2
-    table8[0x3] = &Chip8::op_8xy3; // Opcode 0x8xy3 is handled by op_8xy3
+    table8[0x1] = &Chip8::op_8xy1<OriginalQuirks>; // Opcode 0x8xy1 is handled by op_8xy1
+    table8[0x2] = &Chip8::op_8xy2<OriginalQuirks>; // Opcode 0x8xy2 is handled by op_8xy2
+    table8[0x3] = &Chip8::op_8xy3<OriginalQuirks>; // Opcode 0x8xy3 is handled by op_8xy3
     table8[0x4] = &Chip8::op_8xy4; // Opcode 0x8xy4 is handled by op_8xy4
     table8[0x5] = &Chip8::op_8xy5; // Opcode 0x8xy5 is handled by op_8xy5
-    table8[0x6] = &Chip8::op_8xy6; // Opcode 0x8xy6 is handled by op_8xy6
+    table8[0x6] = &Chip8::op_8xy6<OriginalQuirks>; // Opcode 0x8xy6 is handled by op_8xy6
     table8[0x7] = &Chip8::op_8xy7; // Opcode 0x8xy7 is handled by op_8xy7
-    table8[0xE] = &Chip8::op_8xyE; // Opcode 0x8xyE is handled by op_8xyE
+    table8[0xE] = &Chip8::op_8xyE<OriginalQuirks>; // Opcode 0x8xyE is handled by op_8xyE
 
     // Initialize tableE
     // TableE is used to handle opcodes starting with 0xE.
@@ -87,73 +150,422 @@ void Chip8::setupTable() {
     tableF[0x1E] = &Chip8::op_Fx1E; // Opcode 0xFx1E is handled by op_Fx1E
     tableF[0x29] = &Chip8::op_Fx29; // Opcode 0xFx29 is handled by op_Fx29
     tableF[0x33] = &Chip8::op_Fx33; // Opcode 0xFx33 is handled by op_Fx33
-    tableF[0x55] = &Chip8::op_Fx55; // Opcode 0xFx55 is handled by op_Fx55
-    tableF[0x65] = &Chip8::op_Fx65; // Opcode 0xFx65 is handled by op_Fx65
+    tableF[0x55] = &Chip8::op_Fx55<OriginalQuirks>; // Opcode 0xFx55 is handled by op_Fx55
+    tableF[0x65] = &Chip8::op_Fx65<OriginalQuirks>; // Opcode 0xFx65 is handled by op_Fx65
+
+    // SUPER-CHIP and XO-CHIP additions; on a CHIP-8 they do nothing, like any unknown opcode
+    tableF[0x00] = &Chip8::op_F000;
+    tableF[0x01] = &Chip8::op_Fn01;
+    tableF[0x02] = &Chip8::op_F002;
+    tableF[0x30] = &Chip8::op_Fx30;
+    tableF[0x3A] = &Chip8::op_Fx3A;
+    tableF[0x75] = &Chip8::op_Fx75;
+    tableF[0x85] = &Chip8::op_Fx85;
+}
+
+bool parseEngine(const std::string& name, Engine& engine) {
+    if (name == "interpreter") {
+        engine = Engine::Interpreter;
+    } else if (name == "threaded") {
+        engine = Engine::Threaded;
+    } else if (name == "cached") {
+        engine = Engine::BlockCache;
+    } else if (name == "jit") {
+        engine = Engine::Jit;
+    } else if (name == "jit-verify") {
+        engine = Engine::JitVerify;
+    } else if (name == "aot") {
+        engine = Engine::Aot;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool parseQuirkSet(const std::string& name, QuirkSet& quirks) {
+    if (name == "original") {
+        quirks = QuirkSet::Original;
+    } else if (name == "vip") {
+        quirks = QuirkSet::Vip;
+    } else if (name == "schip") {
+        quirks = QuirkSet::SuperChip;
+    } else if (name == "xochip") {
+        quirks = QuirkSet::XoChip;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool parseMachine(const std::string& name, Machine& machine) {
+    if (name == "chip8") {
+        machine = Machine::Chip8;
+    } else if (name == "schip") {
+        machine = Machine::SuperChip;
+    } else if (name == "xochip") {
+        machine = Machine::XoChip;
+    } else {
+        return false;
+    }
+    return true;
 }
 
 Chip8::Chip8()
-    : randGen(static_cast<unsigned int>(std::chrono::system_clock::now().time_since_epoch().count())),
-      randByte(0, 255)
 {
+    engine = Engine::Interpreter;
+    machine = Machine::Chip8;
+    memory = chip8Memory;
+    addressMask = MEMORY_SIZE - 1;
+    requestedQuirks = QuirkSet::Auto;
+    selectQuirks();
     pc = START_ADDRESS;
     sp = 0;
     opcode = 0;
     index = 0;
-    delayTimer = 0;
-    soundTimer = 0;
+    cycleCount = 0;
+    delayTimer.set(0, 0);
+    soundTimer.set(0, 0);
+    drawFlag = false;
+    dirtyRows = 0;
+    planeMask = 1;
+    pitch = 64; // 4000 Hz
+    idleSkip = true;
+    idleSkipCount = 0;
+    idleSkippedCycles = 0;
+    trace = nullptr;
 
     // Clear display, stack, registers, and memory
-    memset(video, 0, sizeof(video));
     memset(stack, 0, sizeof(stack));
     memset(registers, 0, sizeof(registers));
-    memset(memory, 0, sizeof(memory));
+    memset(chip8Memory, 0, sizeof(chip8Memory));
     memset(keypad, 0, sizeof(keypad));  // Initialize keypad to all zeros
+    memset(flags, 0, sizeof(flags));
+    memset(audioPattern, 0, sizeof(audioPattern));
 
     // Load fonts into memory
     for (unsigned int i = 0; i < FONTSET_SIZE; ++i) {
         memory[FONTSET_START_ADDRESS + i] = fontSet[i];
     }
+    memcpy(memory + BIG_FONTSET_START_ADDRESS, bigFontSet, BIG_FONTSET_SIZE);
 
     // Initialize the random number generator
     randGen.seed(static_cast<unsigned int>(std::chrono::system_clock::now().time_since_epoch().count()));
     // The seed is based on the current time to ensure different random sequences each run
 
-    // Set up the opcode function pointer tables
-    setupTable();
+    // Set up the shared opcode function pointer tables (only done by the first instance)
+    static std::once_flag tablesReady;
+    std::call_once(tablesReady, &Chip8::setupTable);
 
     // Clear the display
-    memset(video, 0, sizeof(video));
+    memset(&video, 0, sizeof(video));
+    video.hires = false;
+    video.planeCount = 1;
+
+#if CHIP8_PROFILE
+    profiler.reset(new Profiler());
+#endif
+}
+
+Chip8::~Chip8() = default;
+
+void Chip8::setEngine(Engine newEngine) {
+    engine = newEngine;
+
+    // The block cache, the JIT and the AOT engine are only kept around while they are in use
+    if (engine == Engine::BlockCache) {
+        if (!blockCache) {
+            blockCache.reset(new BlockCache());
+        }
+    } else {
+        blockCache.reset();
+    }
+
+    if (engine == Engine::Jit || engine == Engine::JitVerify) {
+        jit.reset(new Jit(engine == Engine::JitVerify));
+    } else {
+        jit.reset();
+    }
+
+    if (engine == Engine::Aot) {
+        if (!aot) {
+            aot.reset(new Aot());
+        }
+    } else {
+        aot.reset();
+    }
+}
+
+void Chip8::setMachine(Machine newMachine) {
+    machine = newMachine;
+    video.hires = false;
+    video.planeCount = machine == Machine::XoChip ? 2 : 1;
+    planeMask = 1;
+    clearDisplay();
+    selectQuirks();
+    selectMemory();
+#if CHIP8_PROFILE
+    profiler->setMachine(machine);
+#endif
+}
+
+void Chip8::setQuirks(QuirkSet newQuirks) {
+    requestedQuirks = newQuirks;
+    selectQuirks();
+}
+
+void Chip8::selectQuirks() {
+    // Picks the dispatch loop specialised for the quirk set, once, rather than testing quirks per instruction
+    quirks = requestedQuirks;
+    if (quirks == QuirkSet::Auto) {
+        quirks = machine == Machine::SuperChip ? QuirkSet::SuperChip
+               : machine == Machine::XoChip ? QuirkSet::XoChip : QuirkSet::Original;
+    }
+
+    switch (quirks) {
+    case QuirkSet::Vip:
+        stepQuirks = &Chip8::step<VipQuirks>;
+        interpretQuirks = &Chip8::interpret<VipQuirks>;
+        break;
+    case QuirkSet::SuperChip:
+        stepQuirks = &Chip8::step<SuperChipQuirks>;
+        interpretQuirks = &Chip8::interpret<SuperChipQuirks>;
+        break;
+    case QuirkSet::XoChip:
+        stepQuirks = &Chip8::step<XoChipQuirks>;
+        interpretQuirks = &Chip8::interpret<XoChipQuirks>;
+        break;
+    default:
+        stepQuirks = &Chip8::step<OriginalQuirks>;
+        interpretQuirks = &Chip8::interpret<OriginalQuirks>;
+        break;
+    }
+}
+
+void Chip8::selectMemory() {
+    // XO-CHIP's 64KB are only allocated while that machine is selected; the first 4KB, with the
+    // fonts and anything already loaded, carry over in both directions
+    uint8_t* previous = memory;
+    if (machine == Machine::XoChip) {
+        if (!xoChipMemory) {
+            xoChipMemory.reset(new uint8_t[XOCHIP_MEMORY_SIZE]());
+            memcpy(xoChipMemory.get(), chip8Memory, MEMORY_SIZE);
+        }
+        memory = xoChipMemory.get();
+        addressMask = static_cast<uint16_t>(XOCHIP_MEMORY_SIZE - 1);
+    } else {
+        if (xoChipMemory) {
+            memcpy(chip8Memory, xoChipMemory.get(), MEMORY_SIZE);
+            xoChipMemory.reset();
+        }
+        memory = chip8Memory;
+        addressMask = MEMORY_SIZE - 1;
+    }
+    if (memory != previous) {
+        invalidateCode();
+    }
+}
+
+void Chip8::invalidateCode() {
+    // Called whenever memory is changed from outside the CPU, so no engine keeps running stale code
+    if (blockCache) {
+        blockCache->flush();
+    }
+    if (jit) {
+        jit->flush();
+    }
+    if (aot) {
+        aot->flush();
+    }
+}
+
+void Chip8::copyStateFrom(const Chip8& other) {
+    // Copies the complete machine state, but not the engine
+    drawFlag = other.drawFlag;
+    delayTimer = other.delayTimer;
+    soundTimer = other.soundTimer;
+    memcpy(keypad, other.keypad, sizeof(keypad));
+    video = other.video;
+    dirtyRows = other.dirtyRows;
+    planeMask = other.planeMask;
+    memcpy(flags, other.flags, sizeof(flags));
+    memcpy(audioPattern, other.audioPattern, sizeof(audioPattern));
+    pitch = other.pitch;
+    machine = other.machine;
+    requestedQuirks = other.requestedQuirks;
+    selectQuirks();
+    selectMemory();
+    cycleCount = other.cycleCount;
+    memcpy(memory, other.memory, memorySize());
+    memcpy(registers, other.registers, sizeof(registers));
+    index = other.index;
+    pc = other.pc;
+    memcpy(stack, other.stack, sizeof(stack));
+    sp = other.sp;
+    opcode = other.opcode;
+    randGen = other.randGen;
+}
+
+// Stores a bool as one byte that is 0 or 1; any other byte loads as true, never as an invalid bool
+template <typename Transfer>
+static void transferFlag(Transfer& transfer, bool& flag) {
+    uint8_t byte = flag ? 1 : 0;
+    transfer(&byte, sizeof(byte));
+    flag = byte != 0;
+}
+
+// Copies the machine state field by field, in snapshot order
+// The same function saves and loads, so the two can't get out of step
+template <typename Transfer>
+void Chip8::transferState(Transfer& transfer) {
+    transfer(memory, memorySize());
+    transfer(registers, sizeof(registers));
+    transfer(&index, sizeof(index));
+    transfer(&pc, sizeof(pc));
+    transfer(stack, sizeof(stack));
+    transfer(&sp, sizeof(sp));
+    transfer(&opcode, sizeof(opcode));
+    transfer(&randGen.state, sizeof(randGen.state));
+    transfer(&cycleCount, sizeof(cycleCount));
+    transfer(&delayTimer.value, sizeof(delayTimer.value));
+    transfer(&delayTimer.frame, sizeof(delayTimer.frame));
+    transfer(&soundTimer.value, sizeof(soundTimer.value));
+    transfer(&soundTimer.frame, sizeof(soundTimer.frame));
+    transfer(keypad, sizeof(keypad));
+    transfer(video.planes, sizeof(video.planes));
+    transferFlag(transfer, video.hires);
+    transfer(&planeMask, sizeof(planeMask));
+    transfer(flags, sizeof(flags));
+    transfer(audioPattern, sizeof(audioPattern));
+    transfer(&pitch, sizeof(pitch));
+    transferFlag(transfer, drawFlag);
+    transfer(&dirtyRows, sizeof(dirtyRows));
+}
+
+struct SnapshotWriter
+{
+    uint8_t* out;
+
+    void operator()(const void* field, size_t size) {
+        memcpy(out, field, size);
+        out += size;
+    }
+};
+
+struct SnapshotReader
+{
+    const uint8_t* in;
+
+    void operator()(void* field, size_t size) {
+        memcpy(field, in, size);
+        in += size;
+    }
+};
+
+size_t Chip8::saveState(void* buffer, size_t size) const {
+    if (buffer == nullptr || size < snapshotSize()) {
+        return 0;
+    }
+
+    uint8_t* out = static_cast<uint8_t*>(buffer);
+    memcpy(out, &SNAPSHOT_MAGIC, 4);
+    memcpy(out + 4, &SNAPSHOT_VERSION, 2);
+    out[6] = static_cast<uint8_t>(machine);
+    out[7] = 0;
+
+    // transferState only reads the fields when writing a snapshot
+    SnapshotWriter writer = { out + SNAPSHOT_HEADER_SIZE };
+    const_cast<Chip8*>(this)->transferState(writer);
+
+    // The snapshot sizes in chip8.hpp are summed by hand; catch a field added to only one side
+    assert(static_cast<size_t>(writer.out - out) == snapshotSize());
+    return static_cast<size_t>(writer.out - out);
 }
 
-void Chip8::loadROM(const std::string& filename) {
+bool Chip8::loadState(const void* buffer, size_t size) {
+    if (buffer == nullptr || size < snapshotSize()) {
+        return false;
+    }
+
+    const uint8_t* in = static_cast<const uint8_t*>(buffer);
+    uint32_t magic;
+    uint16_t version;
+    memcpy(&magic, in, 4);
+    memcpy(&version, in + 4, 2);
+    // The snapshot's size follows its machine, so it has to be the selected one
+    if (magic != SNAPSHOT_MAGIC || version != SNAPSHOT_VERSION || in[6] != static_cast<uint8_t>(machine)) {
+        return false;
+    }
+
+    // Memory is the first field; cached or translated code only has to be dropped if it changed
+    bool memoryChanged = memcmp(memory, in + SNAPSHOT_HEADER_SIZE, memorySize()) != 0;
+
+    SnapshotReader reader = { in + SNAPSHOT_HEADER_SIZE };
+    transferState(reader);
+
+    if (memoryChanged) {
+        invalidateCode();
+    }
+    return true;
+}
+
+bool Chip8::loadROM(const std::string& filename) {
     // Open ROM in binary to ensure the computer reads the machine code 
     std::ifstream file(filename, std::ios::binary); // creates an std::ifstream object
 
     // Check if file was succesfully opened,if file objects evalutes to false, error message is printed to stander error stream
     if (!file) {
         std::cerr << "Failed to open ROM file: "<<filename<<std::endl;
-        return;
+        return false;
     }
     //Retrieves size of file
     file.seekg(0, std::ios::end); //moves file position indicator to the end
     std::streampos filesize = file.tellg(); //retrieves current position
     file.seekg(0, std::ios::beg); //moves pi to begining
 
-    //Creates memory buffer equalto file size
-    std::vector<uint8_t> buffer(filesize); //Creates a vector with a size equal to filesize, 8-bit
-    file.read(reinterpret_cast<char*>(buffer.data()), filesize); //reads the rom data, buffer.data is point is cast to char* using reinterpret_cast to match the type of the file 
+    // A ROM has to fit between START_ADDRESS and the end of the selected machine's memory
+    if (filesize < 0 || static_cast<unsigned long long>(filesize) > maxRomSize()) {
+        std::cerr << "ROM file is larger than " << maxRomSize() << " bytes: " << filename << std::endl;
+        return false;
+    }
+
+    // Read into a buffer first, so memory keeps its old contents if the read fails
+    std::vector<uint8_t> buffer(static_cast<size_t>(filesize));
+    if (!file.read(reinterpret_cast<char*>(buffer.data()), filesize)) {
+        std::cerr << "Failed to read ROM file: " << filename << std::endl;
+        return false;
+    }
 
-    for (size_t i=0; i<filesize; ++i) {
-        memory[0x200 + i] = buffer[i];
-    } //Loop iterates over each byte in hte buffer and copies it into chip-8 memory, rom data to memory
     file.close(); //Closes file
+
+    return loadROM(buffer.data(), buffer.size()); //Copies the rom data into chip-8 memory
+}
+
+bool Chip8::loadROM(const uint8_t* data, size_t size) {
+    // Loads a ROM that is already in memory, such as one generated by a benchmark or mapped from a
+    // ROM pack (see RomPack); a single copy into CHIP-8 memory
+    if (size > maxRomSize()) {
+        return false;
+    }
+    memcpy(memory + START_ADDRESS, data, size);
+
+    invalidateCode();
+    return true;
 }
 
 void Chip8::cycle() {
+    ((*this).*stepQuirks)();
+}
+
+template <typename Quirks>
+void Chip8::step() {
     // Fetch the opcode from memory
     // The opcode is 2 bytes (16 bits) long, so we need to combine two bytes from memory
     // The first byte is shifted left by 8 bits and then ORed with the second byte
-    opcode = (memory[pc] << 8) | memory[pc + 1];
+    opcode = (memory[pc & addressMask] << 8) | memory[(pc + 1) & addressMask];
+
+#if CHIP8_PROFILE
+    profiler->instruction(pc, opcode);
+#endif
 
     // Increment the program counter to point to the next instruction
     // Since each opcode is 2 bytes long, we increment the PC by 2
@@ -164,30 +576,234 @@ void Chip8::cycle() {
     // This gives us the first nibble of the opcode
     uint8_t instruction = (opcode & 0xF000u) >> 12u;
 
-    // Execute the opcode using the function pointer table
-    // We use the first nibble of the opcode as an index into the 'table' array
-    // The function pointer stored at that index is then invoked using the ((*this).*(...))() syntax
-    ((*this).*(table[instruction]))();
+    // The instructions with quirks go straight to the handlers specialised for this quirk set
+    // Everything else is executed using the function pointer table: we use the first nibble of the
+    // opcode as an index into the 'table' array, and the function pointer stored at that index is
+    // then invoked using the ((*this).*(...))() syntax
+    switch (instruction) {
+    case 0x8:
+        switch (opcode & 0x000F) {
+        case 0x1: op_8xy1<Quirks>(); break;
+        case 0x2: op_8xy2<Quirks>(); break;
+        case 0x3: op_8xy3<Quirks>(); break;
+        case 0x6: op_8xy6<Quirks>(); break;
+        case 0xE: op_8xyE<Quirks>(); break;
+        default: ((*this).*(table8[opcode & 0x000F]))(); break;
+        }
+        break;
+    case 0xB:
+        op_Bnnn<Quirks>();
+        break;
+    case 0xD:
+        op_Dxyn<Quirks>();
+        break;
+    case 0xF:
+        if ((opcode & 0x00FF) == 0x55) {
+            op_Fx55<Quirks>();
+        } else if ((opcode & 0x00FF) == 0x65) {
+            op_Fx65<Quirks>();
+        } else {
+            ((*this).*(tableF[opcode & 0x00FF]))();
+        }
+        break;
+    default:
+        ((*this).*(table[instruction]))();
+        break;
+    }
+
+    // Advance the emulated clock; the timers are derived from it, so there is no per-cycle timer work
+    ++cycleCount;
+}
 
-    // Update timers
-    // Decrement the delay timer if it's greater than zero
-    if (delayTimer > 0) {
-        --delayTimer;
+template <typename Quirks>
+void Chip8::interpret(unsigned long long cycles) {
+    // The interpreter loop for one quirk set, with step() inlined
+    for (unsigned long long i = 0; i < cycles; ++i) {
+        step<Quirks>();
+    }
+}
+
+void Chip8::tracedCycle() {
+    // Runs one instruction and records it with the first register it changed
+    uint16_t address = pc;
+    unsigned long long at = cycleCount;
+    uint8_t before[REGISTER_COUNT];
+    memcpy(before, registers, sizeof(before));
+
+    cycle();
+
+    trace->record(at, address, opcode, index, before, registers);
+}
+
+void Chip8::run(unsigned long long cycles) {
+    // Execute exactly `cycles` instructions with the selected engine
+    if (trace != nullptr) {
+        for (unsigned long long i = 0; i < cycles; ++i) {
+            tracedCycle();
+        }
+        return;
     }
 
-    // Decrement the sound timer if it's greater than zero
-    // If the sound timer reaches zero, a beep is produced
-    if (soundTimer > 0) {
-        if (soundTimer == 1) {
-            // BEEP!
-            // You can add code here to produce a beep sound
+    if (idleSkip) {
+        cycles -= skipIdleLoop(cycles);
+        if (cycles == 0) {
+            return;
         }
-        --soundTimer;
     }
+
+    // Only the interpreter knows the SUPER-CHIP and XO-CHIP instructions and the other quirk sets
+    if (machine != Machine::Chip8 || quirks != QuirkSet::Original) {
+        ((*this).*interpretQuirks)(cycles);
+        return;
+    }
+
+    if (engine == Engine::Threaded) {
+        Threaded::run(*this, cycles);
+        return;
+    }
+
+    if (engine == Engine::BlockCache) {
+        blockCache->run(*this, cycles);
+        return;
+    }
+
+    if (jit) {
+        jit->run(*this, cycles);
+        return;
+    }
+
+    if (aot) {
+        aot->run(*this, cycles);
+        return;
+    }
+
+    ((*this).*interpretQuirks)(cycles);
+}
+
+unsigned long long Chip8::skipIdleLoop(unsigned long long cycles) {
+    // Recognises an idle loop around pc and skips the iterations whose outcome can't change before
+    // the run ends: the keypad only changes between runs and the delay timer only at frame boundaries.
+    // Returns the number of cycles used, executed or skipped; 0 when pc is not in an idle loop.
+    auto fetch = [this](unsigned int address) -> uint16_t {
+        return static_cast<uint16_t>((memory[address & addressMask] << 8) | memory[(address + 1) & addressMask]);
+    };
+
+    // Find the first instruction of the loop; pc may be anywhere in it
+    uint16_t head = 0;
+    unsigned int length = 0;    // Instructions per iteration
+    for (unsigned int offset = 0; offset <= 4 && offset <= pc && length == 0; offset += 2) {
+        uint16_t start = pc - offset;
+        uint16_t first = fetch(start);
+        uint16_t jump = 0x1000u | start;
+        if (offset == 0 && (first == jump || (first & 0xF0FFu) == 0xF00Au)) {
+            length = 1;
+        } else if (offset <= 2 && ((first & 0xF0FFu) == 0xE09Eu || (first & 0xF0FFu) == 0xE0A1u) && fetch(start + 2) == jump) {
+            length = 2;
+        } else if ((first & 0xF0FFu) == 0xF007u && fetch(start + 4) == jump) {
+            uint16_t test = fetch(start + 2);
+            if (((test & 0xF000u) == 0x3000u || (test & 0xF000u) == 0x4000u) && (test & 0x0F00u) == (first & 0x0F00u)) {
+                length = 3;
+            }
+        }
+        head = start;
+    }
+    if (length == 0) {
+        return 0;
+    }
+
+    // Run the rest of the current iteration normally; it may leave the loop
+    unsigned long long used = 0;
+    while (pc != head && used < cycles && used < length) {
+        cycle();
+        ++used;
+    }
+    if (pc != head || used == cycles) {
+        return used;
+    }
+
+    // Work out how many whole iterations are certain to end back at the head
+    uint16_t first = fetch(head);
+    uint8_t Vx = (first & 0x0F00u) >> 8;
+    unsigned long long iterations = (cycles - used) / length;
+    if (length == 1 && first != (0x1000u | head)) {
+        // Fx0A waits until a key is down
+        for (unsigned int key = 0; key < KEY_COUNT; ++key) {
+            if (keypad[key]) {
+                return used;
+            }
+        }
+    } else if (length == 2) {
+        // Ex9E skips the jump when the key is down, ExA1 when it is up
+        bool down = keypad[registers[Vx] & 0x0F] != 0;
+        if (down == ((first & 0x00FFu) == 0x9Eu)) {
+            return used;
+        }
+    } else if (length == 3) {
+        // 3xkk leaves the loop once the timer equals kk, 4xkk once it differs; the timer holds its
+        // value until the next frame boundary, or for good once it is 0
+        uint16_t test = fetch(head + 2);
+        uint8_t timer = getDelayTimer();
+        if ((timer == (test & 0x00FFu)) == ((test & 0xF000u) == 0x3000u)) {
+            return used;
+        }
+        if (timer != 0) {
+            unsigned long long change = frameStartCycle(frameAtCycle(cycleCount) + 1);
+            iterations = std::min(iterations, (change - cycleCount + length - 1) / length);
+        }
+        if (iterations != 0) {
+            registers[Vx] = timer;
+        }
+    }
+    if (iterations == 0) {
+        return used;
+    }
+
+    // The loop leaves nothing behind but the clock and its last opcode
+    unsigned long long skipped = iterations * length;
+    opcode = length == 1 ? first : (0x1000u | head);
+    cycleCount += skipped;
+    ++idleSkipCount;
+    idleSkippedCycles += skipped;
+    return used + skipped;
+}
+
+unsigned long long Chip8::runUnpaced(unsigned long long cycle, unsigned long long endCycle) {
+    // Runs the CPU back to back from `cycle` (normally cycles()) up to `endCycle` with no pacing.
+    // drawFlag is cleared at every frame boundary, as the Scheduler does.
+    // Returns the number of frame boundaries crossed.
+    unsigned long long frames = 0;
+
+    // Find the first frame boundary after `cycle`
+    unsigned long long nextFrame = cycle * CHIP8_FRAME_RATE / CHIP8_CLOCK_SPEED + 1;
+    while (frameStartCycle(nextFrame) <= cycle) {
+        ++nextFrame;
+    }
+
+    while (cycle < endCycle) {
+        unsigned long long boundary = frameStartCycle(nextFrame);
+        unsigned long long stop = boundary < endCycle ? boundary : endCycle;
+
+        run(stop - cycle);
+        cycle = stop;
+
+        if (cycle == boundary) {
+            drawFlag = false;
+            ++frames;
+            ++nextFrame;
+        }
+    }
+
+    return frames;
 }
 
 void Chip8::Table0()
 {
+	// CHIP-8 only looks at the last nibble, as the other engines do; the later machines decode the
+	// whole byte, since 00Cn-00FF share nibbles with 00E0 and 00EE
+	if (machine != Machine::Chip8) {
+		((*this).*((opcode & 0x0F00u) == 0 ? table00[opcode & 0x00FFu] : &Chip8::op_NULL))();
+		return;
+	}
 	((*this).*(table0[opcode & 0x000Fu]))();
 }
 
@@ -207,7 +823,37 @@ void Chip8::TableF()
 }
 
 void Chip8::op_00E0() {
-    memset(video, 0, sizeof(video)); //Clear the display
+    // Clears the selected planes (always just the first one before XO-CHIP)
+    // Every row that still has a pixel on changes, so it needs to be redrawn
+    unsigned int height = video.height();
+    unsigned int words = video.words();
+    for (unsigned int plane = 0; plane < VIDEO_PLANES; ++plane) {
+        if (!((planeMask >> plane) & 1)) {
+            continue;
+        }
+        for (unsigned int row = 0; row < height; ++row) {
+            for (unsigned int word = 0; word < words; ++word) {
+                if (video.planes[plane][row][word] != 0) {
+                    dirtyRows |= 1ULL << row;
+                    drawFlag = true;
+                }
+            }
+        }
+        memset(video.planes[plane], 0, sizeof(video.planes[plane])); //Clear the display
+    }
+}
+
+void Chip8::clearDisplay() {
+    // Clears every plane at both resolutions, as a change of machine or resolution does
+    memset(video.planes, 0, sizeof(video.planes));
+    dirtyRows = ~0ULL;
+    drawFlag = true;
+}
+
+void Chip8::skip() {
+    // Skips the next instruction; on XO-CHIP that may be the 4-byte F000 nnnn
+    bool longInstruction = machine == Machine::XoChip && memory[pc & addressMask] == 0xF0 && memory[(pc + 1) & addressMask] == 0x00;
+    pc += longInstruction ? 4 : 2;
 }
 
 void Chip8::op_00EE() {
@@ -227,6 +873,10 @@ void Chip8::op_00EE() {
 
     // Decrement the stack pointer
     --sp;
+
+#if CHIP8_PROFILE
+    profiler->ret();
+#endif
 }
 
 void Chip8::op_1nnn() {
@@ -267,6 +917,10 @@ void Chip8::op_2nnn() {
     // This allows the emulator to remember the return address after the subroutine finishes
     stack[sp] = pc;
 
+#if CHIP8_PROFILE
+    profiler->call(sp);
+#endif
+
     // Extract the address from the opcode
     // The opcode has the format: 2nnn
     // where 2 is the opcode identifier and nnn is a 12-bit memory address
@@ -295,8 +949,8 @@ void Chip8::op_3xkk() {
 
     //Compare the value of register Vx with constant byte kk
     if (registers[Vx] == kk) {
-        //If register Vx == kk, increase pc by 2
-        pc +=2;
+        //If register Vx == kk, skip the next instruction
+        skip();
     }
 }
 
@@ -311,7 +965,7 @@ void Chip8::op_4xkk() {
     //Compare the value of register Vx with constant byte kk
     if (registers[Vx] != kk) {
         //If register Vx == kk, increase pc by 2
-        pc +=2;
+        skip();
     }
 }
 
@@ -320,6 +974,16 @@ void Chip8::op_5xy0() {
     //opcode: 5xy0
     //skips next instruction if Vx = Vy
 
+    // XO-CHIP also has 5xy2 and 5xy3; before it the last nibble is ignored
+    if (machine == Machine::XoChip && (opcode & 0x000F) != 0) {
+        if ((opcode & 0x000F) == 0x2) {
+            op_5xy2();
+        } else if ((opcode & 0x000F) == 0x3) {
+            op_5xy3();
+        }
+        return;
+    }
+
     uint8_t Vx = (opcode & 0x0F00) >> 8; //Extracts the third bit and right shifts it 8 bits
 
     uint8_t Vy = (opcode & 0x00F0) >> 4; //Extracts the second bit and right shifts it 4 bits
@@ -327,7 +991,7 @@ void Chip8::op_5xy0() {
     //Compare the value of register Vx with register Vy
     if (registers[Vx] == registers[Vy]) {
         //If register Vx == kk, increase pc by 2
-        pc +=2;
+        skip();
     }
 }
 
@@ -361,6 +1025,7 @@ void Chip8::op_8xy0() {
     registers[Vx] = registers[Vy];
 }
 
+template <typename Quirks>
 void Chip8::op_8xy1() {
     //opcode: 8xy1
     //Performs a bitwise OR on values of Vx and Vy, stores the result in VX
@@ -369,8 +1034,13 @@ void Chip8::op_8xy1() {
     uint8_t Vy = (opcode & 0x00F0) >> 4; //Extracts the second bit and right shifts it 4 bits
 
     registers[Vx] |= registers[Vy]; // Bitwise OR on values Vx and Vy
+
+    if constexpr (Quirks::logicResetsVf) {
+        registers[0xF] = 0;
+    }
 }
 
+template <typename Quirks>
 void Chip8::op_8xy2() {
     //opcode: 8xy2
     //Performs a bitwise AND on the values of Vx and Vy and stores the result in Vx
@@ -380,8 +1050,13 @@ void Chip8::op_8xy2() {
 
     registers[Vx] &= registers[Vy]; // Bitwiise AND
 
+    if constexpr (Quirks::logicResetsVf) {
+        registers[0xF] = 0;
+    }
+
 }
 
+template <typename Quirks>
 void Chip8::op_8xy3() {
     //opcode: 8xy3
     //Performs bitwise XOR on values of registers Vx and Vy, replace that value with value in Vx
@@ -390,6 +1065,10 @@ void Chip8::op_8xy3() {
     uint8_t Vy = (opcode & 0x00F0) >> 4; //Extracts the second bit and right shifts it 4 bits
 
     registers[Vx] ^= registers[Vy]; //Bitwise XOR
+
+    if constexpr (Quirks::logicResetsVf) {
+        registers[0xF] = 0;
+    }
 }
 
 void Chip8::op_8xy4() {
@@ -414,20 +1093,29 @@ void Chip8::op_8xy5() {
 
     uint8_t Vy = (opcode & 0x00F0) >> 4; //Extracts the second bit and right shifts it 4 bits
 
-    registers[0xF] = (Vx > Vy) ? 1 : 0;
+    registers[0xF] = (registers[Vx] > registers[Vy]) ? 1 : 0;
 
     registers[Vx] -= registers[Vy];
 
 }
 
+template <typename Quirks>
 void Chip8::op_8xy6() {
     //opcode: 8xy6
     //If the least-significant bit of Vx is 1, then VF is set to 1, otherwise 0. Then Vx is divided by 2.
     uint8_t Vx = (opcode & 0x0F00) >> 8;
+
+    // The VIP shifts Vy into Vx instead; VF is written last, so it holds the flag even for 8Fy6
+    if constexpr (Quirks::shiftUsesVy) {
+        uint8_t value = registers[(opcode & 0x00F0) >> 4];
+        registers[Vx] = value >> 1;
+        registers[0xF] = value & 0x1;
+        return;
+    }
     
     // Check the least significant bit of Vx using a bitwise AND operation with 0x1
     // If the least significant bit is 1, set VF to 1, otherwise set VF to 0
-    registers[0xF] = (Vx & 0x1) != 0 ? 1 : 0;
+    registers[0xF] = (registers[Vx] & 0x1) != 0 ? 1 : 0;
 
     // Perform a logical right shift on Vx by 1 bit, effectively dividing Vx by 2
     registers[Vx] >>= 1; 
@@ -448,11 +1136,20 @@ void Chip8::op_8xy7() {
 
 }
 
+template <typename Quirks>
 void Chip8::op_8xyE() {
     //opcode: 8xyE
     //If the most-significant bit of Vx is 1, then VF is set to 1, otherwise to 0. Then Vx is multiplied by 2.
 	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
 
+	// The VIP shifts Vy into Vx instead
+	if constexpr (Quirks::shiftUsesVy) {
+		uint8_t value = registers[(opcode & 0x00F0u) >> 4u];
+		registers[Vx] = static_cast<uint8_t>(value << 1);
+		registers[0xF] = (value & 0x80u) >> 7u;
+		return;
+	}
+
 	// Save MSB in VF
 	registers[0xF] = (registers[Vx] & 0x80u) >> 7u;
 
@@ -468,7 +1165,9 @@ void Chip8::op_9xy0() {
 
     uint8_t Vy = (opcode & 0x00F0) >> 4; //Extracts the second bit and right shifts it 4 bits
 
-    pc += (Vx != Vy) ? 2 : 0;
+    if (registers[Vx] != registers[Vy]) {
+        skip();
+    }
 }
 
 void Chip8::op_Annn() {
@@ -480,12 +1179,16 @@ void Chip8::op_Annn() {
 
 }
 
+template <typename Quirks>
 void Chip8::op_Bnnn() {
     //opcode: Bnn
     //The program counter is set to nnn plus the value of V0.
     uint16_t address = opcode & 0x0FFF;
 
-    pc = registers[0] + address;
+    // SUPER-CHIP reads it as Bxnn: xnn plus the value of Vx
+    uint8_t offset = Quirks::jumpUsesVx ? registers[(opcode & 0x0F00) >> 8] : registers[0];
+
+    pc = offset + address;
 
 }
 
@@ -496,11 +1199,17 @@ void Chip8::op_Cxkk() {
 
     uint8_t Vx = (opcode & 0x0F00) >> 8; //Extracts the third bit and right shifts it 8 bits
 
-    registers[Vx] = kk & randByte(randGen);
+    registers[Vx] = kk & randGen.nextByte();
 
 }
 
+template <typename Quirks>
 void Chip8::op_Dxyn() {
+    if (machine != Machine::Chip8) {
+        drawExtended(Quirks::wrapSprites);
+        return;
+    }
+
     // Extract the X and Y coordinates from the opcode
     uint8_t Vx = (opcode & 0x0F00) >> 8;  // X-coordinate register index
     uint8_t Vy = (opcode & 0x00F0) >> 4;  // Y-coordinate register index
@@ -514,41 +1223,48 @@ void Chip8::op_Dxyn() {
     // Reset the collision flag (VF) to 0
     registers[0xF] = 0;
 
-    // Iterate over each row of the sprite
-    for (unsigned int row = 0; row < height; ++row) {
+    // Iterate over each row of the sprite that is on the screen
+    // Rows below the bottom edge are clipped, or wrap around to the top with the wrapping quirk
+    for (unsigned int row = 0; row < height && (Quirks::wrapSprites || yPos + row < VIDEO_HEIGHT); ++row) {
         // Get the current byte of the sprite data
-        uint8_t spriteByte = memory[index + row];
-
-        // Iterate over each bit (pixel) in the current byte
-        for (unsigned int col = 0; col < 8; ++col) {
-            // Extract the current pixel from the sprite byte
-            // We use a bit mask that starts at 10000000 and shifts right
-            uint8_t spritePixel = spriteByte & (0x80 >> col);
-            
-            // Check if the current pixel is within the screen bounds
-            if (xPos + col < VIDEO_WIDTH && yPos + row < VIDEO_HEIGHT) {
-                // Calculate the address of the screen pixel
-                uint32_t* screenPixel = &video[(yPos + row) * VIDEO_WIDTH + (xPos + col)];
-
-                // If the sprite pixel is on (1)
-                if (spritePixel) {
-                    // Check for collision
-                    // If the screen pixel is already on (white), set VF to 1
-                    if (*screenPixel == 0xFFFFFFFF) {
-                        registers[0xF] = 1;
-                    }
-
-                    // XOR the screen pixel
-                    // This will flip the pixel: off->on or on->off
-                    *screenPixel ^= 0xFFFFFFFF;
-                }
-            }
-            // Note: Pixels outside the screen bounds are simply ignored (clipped)
+        uint8_t spriteByte = memory[(index + row) & addressMask];
+        unsigned int y = (yPos + row) % VIDEO_HEIGHT;
+
+        // Line the sprite byte up with the display row
+        // Bit 63 of a row is its leftmost pixel, so the byte is moved to the top of the word and then
+        // right by the X position; pixels past the right edge are shifted out (clipped) or, with the
+        // wrapping quirk, rotated back in on the left
+        uint64_t top = static_cast<uint64_t>(spriteByte) << 56;
+        uint64_t spriteRow = top >> xPos;
+        if (Quirks::wrapSprites && xPos != 0) {
+            spriteRow |= top << (64 - xPos);
+        }
+#if CHIP8_PROFILE
+        profiler->drawRow(spriteRow);
+#endif
+
+        // Check for collision
+        // If any sprite pixel lands on a pixel that is already on, set VF to 1
+        uint64_t& line = video.planes[0][y][0];
+        if (line & spriteRow) {
+            registers[0xF] = 1;
+        }
+
+        // XOR the sprite into the row
+        // This flips every pixel covered by the sprite: off->on or on->off
+        // Only rows where a pixel actually flipped need to be redrawn
+        if (spriteRow != 0) {
+            line ^= spriteRow;
+            dirtyRows |= 1ULL << y;
+
+            // Set the draw flag to indicate the screen needs updating
+            drawFlag = true;
         }
     }
 
-    // Set the draw flag to indicate the screen needs updating
-    drawFlag = true;
+#if CHIP8_PROFILE
+    profiler->draw();
+#endif
 }
 
 void Chip8::op_Ex9E() {
@@ -560,14 +1276,15 @@ void Chip8::op_Ex9E() {
     uint8_t Vx = (opcode & 0x0F00) >> 8;
 
     // Get the key value from the Vx register
-    uint8_t key = registers[Vx];
+    // Only the low nibble selects a key, so values above 0xF can't read past the keypad
+    uint8_t key = registers[Vx] & 0x0F;
 
     // Check if the key corresponding to the value in Vx is currently pressed
     if (keypad[key]) {
         // If the key is pressed, skip the next instruction by increasing the program counter (PC) by 2
         // The PC is normally incremented by 2 after each instruction cycle
         // By incrementing it by 2 here, we effectively skip the next instruction
-        pc += 2;
+        skip();
     }
 }
 
@@ -580,14 +1297,15 @@ void Chip8::op_ExA1() {
     uint8_t Vx = (opcode & 0x0F00) >> 8;
 
     // Get the key value from the Vx register
-    uint8_t key = registers[Vx];
+    // Only the low nibble selects a key, so values above 0xF can't read past the keypad
+    uint8_t key = registers[Vx] & 0x0F;
 
     // Check if the key corresponding to the value in Vx is currently not pressed
     if (!keypad[key]) {
         // If the key is not pressed, skip the next instruction by increasing the program counter (PC) by 2
         // The PC is normally incremented by 2 after each instruction cycle
         // By incrementing it by 2 here, we effectively skip the next instruction
-        pc += 2;
+        skip();
     }
 }
 
@@ -600,7 +1318,8 @@ void Chip8::op_Fx07() {
     uint8_t Vx = (opcode & 0x0F00) >> 8;
 
     // Set the value of register Vx to the current value of the delay timer
-    registers[Vx] = delayTimer;
+    // The timer is not decremented anywhere: its value follows from the cycle counter
+    registers[Vx] = getDelayTimer();
 
 }
 
@@ -639,7 +1358,7 @@ void Chip8::op_Fx15() {
 
     uint8_t Vx = (opcode & 0x0F00) >> 8;
 
-    delayTimer = registers[Vx];
+    setDelayTimer(registers[Vx]);
 }
 
 void Chip8::op_Fx18() {
@@ -647,7 +1366,7 @@ void Chip8::op_Fx18() {
     //St is set equal to the value of Vx
     uint8_t Vx = (opcode & 0x0F00) >> 8;
 
-    soundTimer = registers[Vx];
+    setSoundTimer(registers[Vx]);
 
 }
 
@@ -687,16 +1406,17 @@ void Chip8::op_Fx33() {
     uint8_t value = registers[Vx];
 
     // Store the hundreds digit in memory location I
-    memory[index] = value / 100;
+    memory[index & addressMask] = value / 100;
 
     // Store the tens digit in memory location I+1
-    memory[index + 1] = (value / 10) % 10;
+    memory[(index + 1) & addressMask] = (value / 10) % 10;
 
     // Store the ones digit in memory location I+2
-    memory[index + 2] = value % 10;
+    memory[(index + 2) & addressMask] = value % 10;
 
 }
 
+template <typename Quirks>
 void Chip8::op_Fx55() {
     //opcode: fx55
     //The interpreter copies the values of registers V0 through Vx into memory, starting at the address in I.
@@ -704,12 +1424,15 @@ void Chip8::op_Fx55() {
     uint8_t Vx = (opcode & 0x0F00) >>8;
 
     for (int i = 0; i <= Vx; i++) {
-        memory[index + i] = registers[i];
+        memory[(index + i) & addressMask] = registers[i];
     }
 
-    // Increment the index register I by Vx + 1
-    index += Vx + 1;
+    // Increment the index register I by Vx + 1 (SUPER-CHIP leaves it unchanged)
+    if constexpr (Quirks::indexIncrements) {
+        index += Vx + 1;
+    }
 }
+template <typename Quirks>
 void Chip8::op_Fx65() {
     //opcode: fx55
     //The interpreter reads values from memory starting at location I into registers V0 through Vx.
@@ -718,15 +1441,280 @@ void Chip8::op_Fx65() {
 
     // Load the values from memory starting at address I into registers V0 through Vx
     for (int i = 0; i <= Vx; ++i) {
-        registers[i] = memory[index + i];
+        registers[i] = memory[(index + i) & addressMask];
     }
 
-    // Increment the index register I by Vx + 1
-    index += Vx + 1;
+    // Increment the index register I by Vx + 1 (SUPER-CHIP leaves it unchanged)
+    if constexpr (Quirks::indexIncrements) {
+        index += Vx + 1;
+    }
 
 }
 
+void Chip8::drawExtended(bool wrap) {
+    // Dxyn on SUPER-CHIP and XO-CHIP: at either resolution, 16x16 sprites for n = 0 (8x16 in SUPER-CHIP
+    // low resolution) and, on XO-CHIP, into every selected plane; `wrap` is the quirk that wraps the
+    // sprite around the edges instead of clipping it. Each sprite line is shifted into place across
+    // the words of its row, so a line costs the same few word operations at 128x64 as at 64x32.
+    uint8_t Vx = (opcode & 0x0F00) >> 8;
+    uint8_t Vy = (opcode & 0x00F0) >> 4;
+    unsigned int n = opcode & 0x000F;
+    unsigned int width = video.width();
+    unsigned int height = video.height();
+    unsigned int words = video.words();
+    unsigned int lines = n == 0 ? 16 : n;
+    unsigned int spriteWidth = n == 0 && (video.hires || machine == Machine::XoChip) ? 16 : 8;
+
+    unsigned int xPos = registers[Vx] % width;
+    unsigned int yPos = registers[Vy] % height;
+    unsigned int word = xPos / 64;
+    unsigned int shift = xPos % 64;
 
+    registers[0xF] = 0;
 
+    // With two planes selected the sprite holds the lines of the first plane, then those of the second
+    uint16_t address = index;
+    for (unsigned int plane = 0; plane < VIDEO_PLANES; ++plane) {
+        if (!((planeMask >> plane) & 1)) {
+            continue;
+        }
 
+        for (unsigned int i = 0; i < lines; ++i, address += spriteWidth / 8) {
+            unsigned int row = yPos + i;
+            if (row >= height) {
+                if (!wrap) {
+                    continue;
+                }
+                row -= height;
+            }
+
+            uint64_t bits = memory[address & addressMask];
+            if (spriteWidth == 16) {
+                bits = (bits << 8) | memory[(address + 1) & addressMask];
+            }
+
+            // Line the sprite up with its row: the leftmost pixel goes to bit 63 of the word it starts
+            // in, and the pixels past the end of that word spill into the next one, or wrap around to
+            // the start of the row
+            uint64_t sprite[VIDEO_ROW_WORDS] = {};
+            uint64_t top = bits << (64 - spriteWidth);
+            sprite[word] = top >> shift;
+            if (shift != 0) {
+                uint64_t spill = top << (64 - shift);
+                if (word + 1 < words) {
+                    sprite[word + 1] = spill;
+                } else if (wrap) {
+                    sprite[0] |= spill;
+                }
+            }
+
+#if CHIP8_PROFILE
+            profiler->drawRow(sprite[0], sprite[1]);
+#endif
+
+            uint64_t* target = video.planes[plane][row];
+            if ((target[0] & sprite[0]) | (target[1] & sprite[1])) {
+                registers[0xF] = 1;
+            }
+            if ((sprite[0] | sprite[1]) != 0) {
+                target[0] ^= sprite[0];
+                target[1] ^= sprite[1];
+                dirtyRows |= 1ULL << row;
+                drawFlag = true;
+            }
+        }
+    }
+
+#if CHIP8_PROFILE
+    profiler->draw();
+#endif
+}
+
+void Chip8::scroll(int rows, int pixels) {
+    // Moves the selected planes down by `rows` (up when negative) and right by `pixels` (left when
+    // negative), in pixels of the current resolution; what scrolls in is blank. Rows move as a block
+    // and each row shifts as a whole, carrying the bits between its two words in high resolution.
+    unsigned int height = video.height();
+    unsigned int words = video.words();
+    size_t rowSize = sizeof(video.planes[0][0]);
+
+    for (unsigned int plane = 0; plane < VIDEO_PLANES; ++plane) {
+        if (!((planeMask >> plane) & 1)) {
+            continue;
+        }
+        uint64_t (*display)[VIDEO_ROW_WORDS] = video.planes[plane];
+
+        if (rows > 0) {
+            memmove(display + rows, display, (height - rows) * rowSize);
+            memset(display, 0, rows * rowSize);
+        } else if (rows < 0) {
+            memmove(display, display - rows, (height + rows) * rowSize);
+            memset(display + height + rows, 0, -rows * rowSize);
+        }
+
+        for (unsigned int row = 0; pixels != 0 && row < height; ++row) {
+            uint64_t* line = display[row];
+            if (words == 1) {
+                line[0] = pixels > 0 ? line[0] >> pixels : line[0] << -pixels;
+            } else if (pixels > 0) {
+                line[1] = (line[1] >> pixels) | (line[0] << (64 - pixels));
+                line[0] >>= pixels;
+            } else {
+                line[0] = (line[0] << -pixels) | (line[1] >> (64 + pixels));
+                line[1] <<= -pixels;
+            }
+        }
+    }
+
+    dirtyRows |= height == 64 ? ~0ULL : (1ULL << height) - 1;
+    drawFlag = true;
+}
+
+void Chip8::op_00Cn() {
+    //opcode: 00Cn
+    //Scrolls the display down by n rows
+    scroll(opcode & 0x000F, 0);
+}
+
+void Chip8::op_00Dn() {
+    //opcode: 00Dn (XO-CHIP)
+    //Scrolls the display up by n rows
+    if (machine == Machine::XoChip) {
+        scroll(-(opcode & 0x000F), 0);
+    }
+}
+
+void Chip8::op_00FB() {
+    //opcode: 00FB
+    //Scrolls the display right by 4 pixels
+    scroll(0, 4);
+}
+
+void Chip8::op_00FC() {
+    //opcode: 00FC
+    //Scrolls the display left by 4 pixels
+    scroll(0, -4);
+}
+
+void Chip8::op_00FD() {
+    //opcode: 00FD
+    //Exits the interpreter: the program stays on this instruction
+    pc -= 2;
+}
+
+void Chip8::op_00FE() {
+    //opcode: 00FE
+    //Switches to the 64x32 low resolution, clearing the display
+    video.hires = false;
+    clearDisplay();
+}
+
+void Chip8::op_00FF() {
+    //opcode: 00FF
+    //Switches to the 128x64 high resolution, clearing the display
+    video.hires = true;
+    clearDisplay();
+}
+
+void Chip8::op_5xy2() {
+    //opcode: 5xy2 (XO-CHIP)
+    //Stores Vx to Vy (in that order, which may be descending) in memory starting at I; I is unchanged
+    unsigned int Vx = (opcode & 0x0F00) >> 8;
+    unsigned int Vy = (opcode & 0x00F0) >> 4;
+    int step = Vx <= Vy ? 1 : -1;
+    unsigned int count = (Vx <= Vy ? Vy - Vx : Vx - Vy) + 1;
+
+    for (unsigned int i = 0; i < count; ++i) {
+        memory[(index + i) & addressMask] = registers[Vx + step * static_cast<int>(i)];
+    }
+}
+
+void Chip8::op_5xy3() {
+    //opcode: 5xy3 (XO-CHIP)
+    //Loads Vx to Vy (in that order, which may be descending) from memory starting at I; I is unchanged
+    unsigned int Vx = (opcode & 0x0F00) >> 8;
+    unsigned int Vy = (opcode & 0x00F0) >> 4;
+    int step = Vx <= Vy ? 1 : -1;
+    unsigned int count = (Vx <= Vy ? Vy - Vx : Vx - Vy) + 1;
+
+    for (unsigned int i = 0; i < count; ++i) {
+        registers[Vx + step * static_cast<int>(i)] = memory[(index + i) & addressMask];
+    }
+}
+
+void Chip8::op_F000() {
+    //opcode: F000 nnnn (XO-CHIP)
+    //I is set to the 16-bit address in the next two bytes, which are skipped
+    if (machine != Machine::XoChip || (opcode & 0x0F00) != 0) {
+        return;
+    }
+    index = static_cast<uint16_t>((memory[pc & addressMask] << 8) | memory[(pc + 1) & addressMask]);
+    pc += 2;
+}
+
+void Chip8::op_Fn01() {
+    //opcode: Fn01 (XO-CHIP)
+    //Selects the planes (bit 0 the first, bit 1 the second) that drawing, clearing and scrolling affect
+    if (machine == Machine::XoChip) {
+        planeMask = (opcode & 0x0300) >> 8;
+    }
+}
+
+void Chip8::op_F002() {
+    //opcode: F002 (XO-CHIP)
+    //Loads the 16-byte audio pattern from memory starting at I
+    if (machine != Machine::XoChip || (opcode & 0x0F00) != 0) {
+        return;
+    }
+    for (unsigned int i = 0; i < AUDIO_PATTERN_SIZE; ++i) {
+        audioPattern[i] = memory[(index + i) & addressMask];
+    }
+}
+
+void Chip8::op_Fx30() {
+    //opcode: Fx30
+    //I is set to the large (8x10) sprite of the digit in Vx
+    if (machine != Machine::Chip8) {
+        uint8_t Vx = (opcode & 0x0F00) >> 8;
+        index = BIG_FONTSET_START_ADDRESS + 10 * (registers[Vx] & 0x0F);
+    }
+}
+
+void Chip8::op_Fx3A() {
+    //opcode: Fx3A (XO-CHIP)
+    //Sets the playback pitch of the audio pattern to Vx
+    if (machine == Machine::XoChip) {
+        pitch = registers[(opcode & 0x0F00) >> 8];
+    }
+}
+
+void Chip8::op_Fx75() {
+    //opcode: Fx75
+    //Stores V0 to Vx in the RPL user flags; SUPER-CHIP has 8 of them, XO-CHIP 16
+    if (machine == Machine::Chip8) {
+        return;
+    }
+    unsigned int Vx = (opcode & 0x0F00) >> 8;
+    unsigned int last = machine == Machine::SuperChip && Vx > 7 ? 7 : Vx;
+    memcpy(flags, registers, last + 1);
+}
+
+void Chip8::op_Fx85() {
+    //opcode: Fx85
+    //Loads V0 to Vx from the RPL user flags
+    if (machine == Machine::Chip8) {
+        return;
+    }
+    unsigned int Vx = (opcode & 0x0F00) >> 8;
+    unsigned int last = machine == Machine::SuperChip && Vx > 7 ? 7 : Vx;
+    memcpy(registers, flags, last + 1);
+}
+
+void Chip8::op_NULL() {
+    // Unknown opcode: ignored
+}
 
+// The threaded engine and the block cache run these handlers with the original quirks
+template void Chip8::op_Dxyn<OriginalQuirks>();
+template void Chip8::op_Fx55<OriginalQuirks>();
+template void Chip8::op_Fx65<OriginalQuirks>();
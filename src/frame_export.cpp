@@ -0,0 +1,262 @@
+#include "frame_export.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+// How long the writer sleeps when no frame is waiting, and the producer when the queue is full
+const std::chrono::milliseconds EXPORT_IDLE_SLEEP(2);
+const std::chrono::microseconds EXPORT_STALL_SLEEP(100);
+
+static const char Y4M_FRAME_HEADER[] = "FRAME\n";
+
+bool parseExportFormat(const std::string& name, ExportFormat& format) {
+    if (name == "y4m") {
+        format = ExportFormat::Y4m;
+    } else if (name == "rgba") {
+        format = ExportFormat::Rgba;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// 0xRRGGBBAA as a word whose bytes in memory are R, G, B, A on any host
+static uint32_t toByteOrder(uint32_t color) {
+    uint8_t bytes[4] = { static_cast<uint8_t>(color >> 24), static_cast<uint8_t>(color >> 16),
+                         static_cast<uint8_t>(color >> 8), static_cast<uint8_t>(color) };
+    uint32_t word;
+    memcpy(&word, bytes, sizeof(word));
+    return word;
+}
+
+// BT.601 studio range Y, U and V of a 0xRRGGBBAA colour
+static void toYuv(uint32_t color, uint8_t* yuv) {
+    int r = (color >> 24) & 0xFF;
+    int g = (color >> 16) & 0xFF;
+    int b = (color >> 8) & 0xFF;
+    yuv[0] = static_cast<uint8_t>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+    yuv[1] = static_cast<uint8_t>(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+    yuv[2] = static_cast<uint8_t>(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+}
+
+FrameExporter::FrameExporter()
+    : head_(0), tail_(0), stop_(false), file_(nullptr), timecodes_(nullptr), format_(ExportFormat::Y4m),
+      frameSize_(0), submitted_(0), stalls_(0), batchUsed_(0), last_(), written_(0), bytes_(0), writes_(0), failed_(false)
+{
+    static_assert((EXPORT_QUEUE_SIZE & (EXPORT_QUEUE_SIZE - 1)) == 0, "EXPORT_QUEUE_SIZE must be a power of two");
+}
+
+FrameExporter::~FrameExporter() {
+    close();
+}
+
+bool FrameExporter::open(const std::string& filename, ExportFormat format, unsigned int scale, const Palette& palette,
+                         bool highResolution, const std::string& timecodesFilename) {
+    close();
+
+    if (filename == "-") {
+        file_ = stdout;
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    } else {
+        file_ = fopen(filename.c_str(), "wb");
+        if (file_ == nullptr) {
+            error_ = "can't create " + filename;
+            return false;
+        }
+    }
+    if (!timecodesFilename.empty()) {
+        timecodes_ = fopen(timecodesFilename.c_str(), "w");
+        if (timecodes_ == nullptr) {
+            error_ = "can't create " + timecodesFilename;
+            close();
+            return false;
+        }
+        fputs("# timecode format v2\n", timecodes_);
+    }
+    // Frames are collected in batch_ and written whole; the stream's own buffer would only copy them again
+    setvbuf(file_, nullptr, _IONBF, 0);
+
+    // The palette is converted once: RGBA frames are expanded with the colours already in byte order,
+    // Y4M frames pick each pixel's Y, U and V from a table
+    format_ = format;
+    Palette bytePalette = palette;
+    if (format == ExportFormat::Rgba) {
+        bytePalette.on = toByteOrder(palette.on);
+        bytePalette.off = toByteOrder(palette.off);
+        bytePalette.second = toByteOrder(palette.second);
+        bytePalette.both = toByteOrder(palette.both);
+    }
+    renderer_.reset(new OffscreenRenderer(scale, bytePalette, highResolution));
+    toYuv(palette.off, yuv_[0]);
+    toYuv(palette.on, yuv_[1]);
+    toYuv(palette.second, yuv_[2]);
+    toYuv(palette.both, yuv_[3]);
+
+    size_t pixels = static_cast<size_t>(width()) * height();
+    if (format == ExportFormat::Y4m) {
+        fprintf(file_, "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C444\n", width(), height(), CHIP8_FRAME_RATE);
+        frameSize_ = sizeof(Y4M_FRAME_HEADER) - 1 + 3 * pixels;
+    } else {
+        frameSize_ = 4 * pixels;
+    }
+
+    slots_.resize(EXPORT_QUEUE_SIZE);
+    batch_.resize(std::max(EXPORT_BATCH_SIZE, frameSize_));
+    lineColors_.resize(width());
+    batchUsed_ = 0;
+    head_.store(0, std::memory_order_relaxed);
+    tail_.store(0, std::memory_order_relaxed);
+    submitted_ = stalls_ = written_ = bytes_ = writes_ = 0;
+    failed_ = false;
+    error_.clear();
+
+    stop_.store(false, std::memory_order_relaxed);
+    writer_ = std::thread(&FrameExporter::writerLoop, this);
+    return true;
+}
+
+void FrameExporter::close() {
+    if (writer_.joinable()) {
+        stop_.store(true, std::memory_order_release);
+        writer_.join();
+    }
+    if (file_ != nullptr) {
+        if (file_ == stdout) {
+            fflush(file_);
+        } else {
+            fclose(file_);
+        }
+        file_ = nullptr;
+    }
+    if (timecodes_ != nullptr) {
+        fclose(timecodes_);
+        timecodes_ = nullptr;
+    }
+}
+
+void FrameExporter::submit(const Display& video) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) == slots_.size()) {
+        ++stalls_;
+        while (head - tail_.load(std::memory_order_acquire) == slots_.size()) {
+            std::this_thread::sleep_for(EXPORT_STALL_SLEEP);
+        }
+    }
+
+    Slot& slot = slots_[head & (slots_.size() - 1)];
+    slot.video = video;
+    slot.frame = submitted_++;
+    head_.store(head + 1, std::memory_order_release);
+}
+
+void FrameExporter::writerLoop() {
+    // Frames submitted before close() was called are all written: stop_ is read before the queue
+    for (;;) {
+        bool stopping = stop_.load(std::memory_order_acquire);
+        if (!drain()) {
+            if (stopping) {
+                break;
+            }
+            // Nothing is waiting: don't hold back the frames collected so far from a pipe
+            flushBatch();
+            std::this_thread::sleep_for(EXPORT_IDLE_SLEEP);
+        }
+    }
+    flushBatch();
+}
+
+bool FrameExporter::drain() {
+    // Converts every frame that is waiting; returns false if there was none
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    size_t head = head_.load(std::memory_order_acquire);
+    if (tail == head) {
+        return false;
+    }
+
+    for (; tail != head; ++tail) {
+        const Slot& slot = slots_[tail & (slots_.size() - 1)];
+        const Display& video = slot.video;
+
+        // With timecodes, frames without any change are left out
+        if (timecodes_ != nullptr && slot.frame != 0 && video.hires == last_.hires && video.planeCount == last_.planeCount
+            && memcmp(video.planes, last_.planes, sizeof(video.planes)) == 0) {
+            tail_.store(tail + 1, std::memory_order_release);
+            continue;
+        }
+
+        if (batchUsed_ + frameSize_ > batch_.size()) {
+            flushBatch();
+        }
+        convert(video, batch_.data() + batchUsed_);
+        batchUsed_ += frameSize_;
+        ++written_;
+        if (timecodes_ != nullptr) {
+            fprintf(timecodes_, "%.3f\n", slot.frame * 1000.0 / CHIP8_FRAME_RATE);
+            last_ = video;
+        }
+
+        // The slot is free once the frame has been converted
+        tail_.store(tail + 1, std::memory_order_release);
+    }
+    return true;
+}
+
+void FrameExporter::convert(const Display& video, uint8_t* out) {
+    if (format_ == ExportFormat::Rgba) {
+        renderer_->render(video, reinterpret_cast<uint32_t*>(out), static_cast<size_t>(width()) * sizeof(uint32_t));
+        return;
+    }
+
+    // Y4M: the frame header, then the Y, U and V planes
+    memcpy(out, Y4M_FRAME_HEADER, sizeof(Y4M_FRAME_HEADER) - 1);
+    out += sizeof(Y4M_FRAME_HEADER) - 1;
+
+    size_t lineSize = width();
+    size_t planeSize = lineSize * height();
+    unsigned int scale = static_cast<unsigned int>(lineSize / video.width());   // Pixels, and lines, per display pixel
+    uint8_t* colors = lineColors_.data();
+    for (unsigned int row = 0; row < video.height(); ++row) {
+        // Colour of every pixel of the output line: bit 0 from the first plane, bit 1 from the second
+        for (unsigned int x = 0; x < video.width(); ++x) {
+            unsigned int word = x / 64;
+            unsigned int bit = 63 - x % 64;
+            unsigned int color = (video.planes[0][row][word] >> bit) & 1;
+            if (video.planeCount > 1) {
+                color |= ((video.planes[1][row][word] >> bit) & 1) << 1;
+            }
+            memset(colors + x * scale, static_cast<int>(color), scale);
+        }
+
+        // One line per plane, repeated for the rest of the display row
+        for (unsigned int component = 0; component < 3; ++component) {
+            const uint8_t table[4] = { yuv_[0][component], yuv_[1][component], yuv_[2][component], yuv_[3][component] };
+            uint8_t* line = out + component * planeSize + static_cast<size_t>(row) * scale * lineSize;
+            for (size_t x = 0; x < lineSize; ++x) {
+                line[x] = table[colors[x]];
+            }
+            for (unsigned int copy = 1; copy < scale; ++copy) {
+                memcpy(line + copy * lineSize, line, lineSize);
+            }
+        }
+    }
+}
+
+void FrameExporter::flushBatch() {
+    if (batchUsed_ == 0) {
+        return;
+    }
+    if (!failed_) {
+        size_t done = fwrite(batch_.data(), 1, batchUsed_, file_);
+        ++writes_;
+        bytes_ += done;
+        failed_ = done != batchUsed_;
+    }
+    batchUsed_ = 0;
+}
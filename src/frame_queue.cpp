@@ -0,0 +1,32 @@
+#include "frame_queue.hpp"
+#include <cstring>
+
+FrameQueue::FrameQueue()
+    : middle_(1), back_(0), front_(2)
+{
+    memset(frames_, 0, sizeof(frames_));
+}
+
+void FrameQueue::publish() {
+    // A frame still waiting in the middle slot is about to be dropped; its rows (which already carry
+    // those of any frame dropped before it) have to reach the consumer with this one. If the consumer
+    // takes it right after this check, its rows are just compared once more.
+    uint8_t middle = middle_.load(std::memory_order_acquire);
+    if (middle & FRESH) {
+        frames_[back_].dirtyRows |= frames_[middle & 0x3].dirtyRows;
+    }
+
+    // Release makes the frame visible to the consumer; acquire makes the slot we get back safe to reuse
+    uint8_t previous = middle_.exchange(static_cast<uint8_t>(back_ | FRESH), std::memory_order_acq_rel);
+    back_ = previous & 0x3;
+}
+
+const FrameQueue::Frame* FrameQueue::acquire() {
+    if ((middle_.load(std::memory_order_relaxed) & FRESH) == 0) {
+        return nullptr;
+    }
+
+    uint8_t previous = middle_.exchange(front_, std::memory_order_acq_rel);
+    front_ = previous & 0x3;
+    return &frames_[front_];
+}
@@ -0,0 +1,538 @@
+#include "aot.hpp"
+#include "audio.hpp"
+#include "chip8.hpp"
+#include "frame_export.hpp"
+#include "jit.hpp"
+#include "log.hpp"
+#include "movie.hpp"
+#include "offscreen_renderer.hpp"
+#include "profiler.hpp"
+#include "rewind.hpp"
+#include "rom_pack.hpp"
+#include "scheduler.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Headless runner
+// Runs a ROM for a fixed number of CPU cycles or emulated frames without opening a window,
+// as fast as the host allows, and reports the achieved throughput at exit.
+// This binary has no SDL dependency so it can run on display-less build machines.
+
+static void printUsage(const char* program)
+{
+    std::cerr << "Usage: " << program << " (--cycles <N> | --frames <N>) [--engine <Engine>]"
+              << " [--scale <N>] [--palette <On,Off[,Second,Both]>] [--screenshot <File.ppm>] [--rewind <KB>]"
+              << " [--audio] [--export <File|->] [--export-format y4m|rgba] [--export-changed <Timecodes>] [--seed <N>] [--replay <Movie>] [--no-idle-skip] [--profile <File.json>]"
+              << " [--trace <File>] [--pack <Pack>] [--machine <Machine>] [--quirks <Quirks>] <ROM>\n"
+              << "Engines: interpreter (default), threaded, cached, jit, jit-verify, aot\n"
+              << "Machines: chip8 (default), schip, xochip; the last two always run on the interpreter\n"
+              << "Quirks: original, vip, schip, xochip; the machine's own by default, only original runs on every engine\n"
+              << "With --pack, <ROM> is the name of a ROM in the pack\n"
+              << "--export streams every frame to a file or, with -, to stdout (the report then goes to stderr), scaled by --scale;\n"
+              << "--export-changed writes only the frames that changed and their times to <Timecodes>\n";
+}
+
+// Writes 0xRRGGBBAA pixels as a binary PPM image (the alpha channel is dropped)
+static bool writePPM(const std::string& filename, const std::vector<uint32_t>& pixels, unsigned int width, unsigned int height)
+{
+    std::ofstream file(filename, std::ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+
+    file << "P6\n" << width << " " << height << "\n255\n";
+    std::vector<char> line(width * 3);
+    for (unsigned int y = 0; y < height; ++y)
+    {
+        for (unsigned int x = 0; x < width; ++x)
+        {
+            uint32_t pixel = pixels[y * width + x];
+            line[x * 3 + 0] = static_cast<char>(pixel >> 24);
+            line[x * 3 + 1] = static_cast<char>(pixel >> 16);
+            line[x * 3 + 2] = static_cast<char>(pixel >> 8);
+        }
+        file.write(line.data(), static_cast<std::streamsize>(line.size()));
+    }
+    return static_cast<bool>(file);
+}
+
+int main(int argc, char** argv)
+{
+    unsigned long long cycleBudget = 0;
+    unsigned long long frameBudget = 0;
+    const char* romFilename = nullptr;
+    Engine engine = Engine::Interpreter;
+    Machine machine = Machine::Chip8;
+    QuirkSet quirks = QuirkSet::Auto;
+    bool machineGiven = false;
+    bool quirksGiven = false;
+    unsigned int scale = 0;
+    Palette palette;
+    std::string screenshotFilename;
+    size_t rewindKilobytes = 0;
+    bool seeded = false;
+    uint32_t seed = 0;
+    std::string movieFilename;
+    bool idleSkip = true;
+    std::string profileFilename;
+    std::string traceFilename;
+    std::string packFilename;
+    bool audioEnabled = false;
+    std::string exportFilename;
+    ExportFormat exportFormat = ExportFormat::Y4m;
+    std::string timecodesFilename;
+
+    // Parse command-line arguments
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--cycles") == 0 && i + 1 < argc)
+        {
+            cycleBudget = std::stoull(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+        {
+            frameBudget = std::stoull(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--engine") == 0 && i + 1 < argc && parseEngine(argv[i + 1], engine))
+        {
+            ++i;
+        }
+        else if (std::strcmp(argv[i], "--machine") == 0 && i + 1 < argc && parseMachine(argv[i + 1], machine))
+        {
+            machineGiven = true;
+            ++i;
+        }
+        else if (std::strcmp(argv[i], "--quirks") == 0 && i + 1 < argc && parseQuirkSet(argv[i + 1], quirks))
+        {
+            quirksGiven = true;
+            ++i;
+        }
+        else if (std::strcmp(argv[i], "--scale") == 0 && i + 1 < argc)
+        {
+            scale = static_cast<unsigned int>(std::stoul(argv[++i]));
+        }
+        else if (std::strcmp(argv[i], "--palette") == 0 && i + 1 < argc && parsePalette(argv[i + 1], palette))
+        {
+            ++i;
+        }
+        else if (std::strcmp(argv[i], "--screenshot") == 0 && i + 1 < argc)
+        {
+            screenshotFilename = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--rewind") == 0 && i + 1 < argc)
+        {
+            rewindKilobytes = static_cast<size_t>(std::stoull(argv[++i]));
+        }
+        else if (std::strcmp(argv[i], "--audio") == 0)
+        {
+            audioEnabled = true;
+        }
+        else if (std::strcmp(argv[i], "--export") == 0 && i + 1 < argc)
+        {
+            exportFilename = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--export-format") == 0 && i + 1 < argc && parseExportFormat(argv[i + 1], exportFormat))
+        {
+            ++i;
+        }
+        else if (std::strcmp(argv[i], "--export-changed") == 0 && i + 1 < argc)
+        {
+            timecodesFilename = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+        {
+            seed = static_cast<uint32_t>(std::stoul(argv[++i]));
+            seeded = true;
+        }
+        else if (std::strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+        {
+            movieFilename = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--no-idle-skip") == 0)
+        {
+            idleSkip = false;
+        }
+        else if (std::strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+        {
+            profileFilename = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+        {
+            traceFilename = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--pack") == 0 && i + 1 < argc)
+        {
+            packFilename = argv[++i];
+        }
+        else if (romFilename == nullptr && argv[i][0] != '-')
+        {
+            romFilename = argv[i];
+        }
+        else
+        {
+            printUsage(argv[0]);
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
+    // A ROM from a pack is loaded from the mapped pack rather than from its own file
+    RomPack pack;
+    PackedRom packed = {};
+    if (!packFilename.empty() && romFilename != nullptr)
+    {
+        size_t index;
+        if (!pack.open(packFilename))
+        {
+            std::cerr << "Failed to open ROM pack: " << pack.error() << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        if (!pack.find(romFilename, index))
+        {
+            std::cerr << "No ROM named " << romFilename << " in " << packFilename << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        packed = pack.rom(index);
+    }
+    bool fromPack = packed.data != nullptr;
+
+    // A replayed movie carries its seed, machine, quirk set and, unless a budget is given, its length
+    InputMovie movie;
+    bool replaying = !movieFilename.empty();
+    if (replaying)
+    {
+        if (romFilename == nullptr || !movie.load(movieFilename))
+        {
+            printUsage(argv[0]);
+            std::exit(EXIT_FAILURE);
+        }
+        uint32_t checksum = fromPack ? packed.checksum : InputMovie::checksumFile(romFilename);
+        if (movie.romChecksum != 0 && movie.romChecksum != checksum)
+        {
+            std::cerr << "Warning: the movie was recorded with a different ROM" << std::endl;
+        }
+        if (seeded && seed != movie.seed)
+        {
+            std::cerr << "Warning: --seed is ignored, the movie was recorded with seed " << movie.seed << std::endl;
+        }
+        seed = movie.seed;
+        seeded = true;
+        if ((machineGiven && machine != movie.machine) || (quirksGiven && quirks != movie.quirks))
+        {
+            std::cerr << "Warning: --machine and --quirks are ignored, the movie was recorded with its own" << std::endl;
+        }
+        machine = movie.machine;
+        quirks = movie.quirks;
+        if (cycleBudget == 0 && frameBudget == 0)
+        {
+            cycleBudget = movie.length;
+        }
+    }
+
+    // Exactly one budget must be given
+    if (romFilename == nullptr || (cycleBudget == 0) == (frameBudget == 0))
+    {
+        printUsage(argv[0]);
+        std::exit(EXIT_FAILURE);
+    }
+
+#if !CHIP8_PROFILE
+    if (!profileFilename.empty())
+    {
+        std::cerr << "--profile needs a build configured with -DCHIP8_PROFILE=ON" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+#endif
+
+    // A profile has to see every instruction: only the interpreter reports them, and an idle loop
+    // skipped at once would be missing from it
+    if (!profileFilename.empty())
+    {
+        if (engine != Engine::Interpreter)
+        {
+            std::cerr << "Warning: --profile runs on the interpreter, --engine is ignored" << std::endl;
+        }
+        engine = Engine::Interpreter;
+        idleSkip = false;
+    }
+
+    // Video streamed to stdout can't share it with the report
+    if (exportFilename == "-")
+    {
+        std::cout.rdbuf(std::cerr.rdbuf());
+        Logger::instance().setOutput(stderr);
+    }
+
+    // A frame budget is converted to the number of cycles the CPU runs in that many frames
+    if (frameBudget != 0)
+    {
+        cycleBudget = frameBudget * CHIP8_CLOCK_SPEED / CHIP8_FRAME_RATE;
+    }
+
+    Chip8 chip8;
+    chip8.setEngine(engine);
+    chip8.setMachine(machine);
+    chip8.setQuirks(quirks);
+    chip8.setIdleSkip(idleSkip);
+    if (fromPack && !chip8.loadROM(packed.data, packed.size))
+    {
+        std::cerr << "ROM " << romFilename << " is larger than " << chip8.maxRomSize() << " bytes" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    if (!fromPack && !chip8.loadROM(romFilename))
+    {
+        std::exit(EXIT_FAILURE);
+    }
+    if (seeded)
+    {
+        chip8.seedRandom(seed);
+    }
+
+    // Every instruction of the run is recorded into the trace, if one is requested
+    TraceWriter trace;
+    if (!traceFilename.empty())
+    {
+        if (!trace.open(traceFilename))
+        {
+            std::cerr << "Failed to create trace: " << traceFilename << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        chip8.setTrace(&trace);
+    }
+
+    auto startTime = std::chrono::steady_clock::now();
+
+    // Main emulation loop
+    // Cycles are executed back to back with no pacing; the scheduler stops the CPU at every frame
+    // boundary and at the next key change of the movie, if one is replayed
+    Scheduler scheduler(chip8);
+    if (replaying)
+    {
+        scheduler.at(movie.apply(0, chip8.keypad));
+    }
+
+    unsigned long long cycles = cycleBudget;
+    unsigned long long frames = 0;
+    std::chrono::duration<double> renderTime(0);
+
+    // A screenshot needs the display rendered, at the original size unless a scale was given
+    if (scale == 0 && !screenshotFilename.empty())
+    {
+        scale = 1;
+    }
+
+    // Every frame can be rendered offscreen, as a window would present it, and/or recorded
+    // into the rewind history
+    std::unique_ptr<OffscreenRenderer> offscreen;
+    std::vector<uint32_t> pixels;
+    size_t pitch = 0;
+    if (scale != 0)
+    {
+        offscreen.reset(new OffscreenRenderer(scale, palette, machine != Machine::Chip8));
+        pixels.resize(static_cast<size_t>(offscreen->width()) * offscreen->height());
+        pitch = offscreen->width() * sizeof(uint32_t);
+    }
+
+    std::unique_ptr<Rewind> rewind;
+    std::chrono::duration<double> rewindTime(0);
+    if (rewindKilobytes != 0)
+    {
+        rewind.reset(new Rewind(rewindKilobytes * 1024, chip8.snapshotSize()));
+    }
+
+    // Sound is generated every frame and drained into a null sink, to measure what producing it costs
+    // The stream holds two frames, so a whole frame of samples always fits.
+    std::unique_ptr<AudioStream> audio;
+    std::unique_ptr<NullAudioSink> audioSink;
+    std::chrono::duration<double> audioTime(0);
+    if (audioEnabled)
+    {
+        audio.reset(new AudioStream(2 * 1000 / CHIP8_FRAME_RATE));
+        audioSink.reset(new NullAudioSink(*audio));
+        audio->resync(chip8);
+    }
+
+    // Frames are only copied here; the exporter's thread converts and writes them
+    FrameExporter exporter;
+    std::chrono::duration<double> exportTime(0);
+    if (!exportFilename.empty())
+    {
+        if (!exporter.open(exportFilename, exportFormat, scale != 0 ? scale : 1, palette, machine != Machine::Chip8, timecodesFilename))
+        {
+            std::cerr << "Failed to start the export: " << exporter.error() << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
+    while (chip8.cycles() < cycleBudget)
+    {
+        unsigned int events = scheduler.run(cycleBudget);
+
+        if (events & Scheduler::EVENT_USER)
+        {
+            scheduler.at(movie.apply(chip8.cycles(), chip8.keypad));
+        }
+
+        if (events & Scheduler::EVENT_FRAME)
+        {
+            ++frames;
+
+            if (!exportFilename.empty())
+            {
+                auto exportStart = std::chrono::steady_clock::now();
+                exporter.submit(chip8.video);
+                exportTime += std::chrono::steady_clock::now() - exportStart;
+            }
+        }
+
+        // The partial frame at the end of the budget is presented too
+        if (!(events & Scheduler::EVENT_FRAME) && chip8.cycles() != cycleBudget)
+        {
+            continue;
+        }
+
+        if (offscreen)
+        {
+            auto renderStart = std::chrono::steady_clock::now();
+            offscreen->update(chip8.video, chip8.takeDirtyRows(), pixels.data(), pitch);
+            renderTime += std::chrono::steady_clock::now() - renderStart;
+        }
+
+        if (rewind)
+        {
+            auto recordStart = std::chrono::steady_clock::now();
+            rewind->record(chip8);
+            rewindTime += std::chrono::steady_clock::now() - recordStart;
+        }
+
+        if (audio)
+        {
+            auto audioStart = std::chrono::steady_clock::now();
+            audio->produce(chip8);
+            audioSink->drain();
+            audioTime += std::chrono::steady_clock::now() - audioStart;
+        }
+    }
+
+    if (offscreen)
+    {
+        std::cout << "Scaled frames: " << offscreen->framesRendered() << " rendered, " << offscreen->framesSkipped()
+                  << " unchanged (" << offscreen->width() << "x" << offscreen->height() << ", " << expandKernelName() << ")\n"
+                  << "Render time: " << renderTime.count() << " s\n";
+
+        if (!screenshotFilename.empty() && !writePPM(screenshotFilename, pixels, offscreen->width(), offscreen->height()))
+        {
+            std::cerr << "Failed to write screenshot: " << screenshotFilename << std::endl;
+        }
+    }
+
+    if (rewind)
+    {
+        // Bytes per frame is what sizes the cap: seconds of history = cap / (bytes per frame * 60)
+        std::cout << "Rewind: " << rewind->frames() << " frames (" << static_cast<double>(rewind->frames()) / CHIP8_FRAME_RATE
+                  << " s) in " << rewind->bytesUsed() << " of " << rewind->capacity() << " bytes, "
+                  << rewind->keyframesRecorded() << " keyframes\n"
+                  << "Rewind bytes/frame: " << rewind->bytesPerFrame()
+                  << " (full snapshot: " << chip8.snapshotSize() << ")\n"
+                  << "Rewind record time: " << rewindTime.count() << " s\n";
+    }
+
+    if (!exportFilename.empty())
+    {
+        // Waits for the writer to finish the frames still queued
+        auto closeStart = std::chrono::steady_clock::now();
+        exporter.close();
+        std::chrono::duration<double> closeTime = std::chrono::steady_clock::now() - closeStart;
+        std::cout << "Export: " << exporter.framesWritten() << " of " << exporter.framesSubmitted() << " frames ("
+                  << exporter.width() << "x" << exporter.height() << " " << (exportFormat == ExportFormat::Y4m ? "y4m" : "rgba")
+                  << ") in " << exporter.bytesWritten() << " bytes, " << exporter.writes() << " writes, "
+                  << exporter.stalls() << " stalls on a full queue" << (exporter.failed() ? ", write failed" : "") << "\n"
+                  << "Export time: " << exportTime.count() << " s submitting, " << closeTime.count() << " s finishing\n";
+    }
+
+    if (audio)
+    {
+        std::cout << "Audio: " << audio->samplesProduced() << " samples (" << static_cast<double>(audio->samplesProduced()) / AUDIO_SAMPLE_RATE
+                  << " s at " << AUDIO_SAMPLE_RATE << " Hz), " << audioSink->samples() << " drained, "
+                  << audio->samplesDropped() << " dropped, " << audio->underruns() << " underruns\n"
+                  << "Audio time: " << audioTime.count() << " s\n";
+    }
+
+    std::chrono::duration<double> wallTime = std::chrono::steady_clock::now() - startTime;
+    double seconds = wallTime.count() > 0.0 ? wallTime.count() : 1e-9;
+
+    // Report throughput
+    std::cout << "Instructions: " << cycles << "\n"
+              << "Frames: " << frames << "\n"
+              << "Wall time: " << wallTime.count() << " s\n"
+              << "Instructions/sec: " << static_cast<double>(cycles) / seconds << "\n"
+              << "Frames/sec: " << static_cast<double>(frames) / seconds << "\n"
+              << "Idle loops skipped: " << chip8.idleSkips() << " (" << chip8.idleCyclesSkipped() << " instructions)\n";
+
+    // Two runs of the same ROM with the same seed and movie end in the same state on every engine
+    if (seeded)
+    {
+        // Dirty rows depend on how often the display was rendered, not on the emulation
+        chip8.takeDirtyRows();
+        std::vector<uint8_t> snapshot(chip8.snapshotSize());
+        chip8.saveState(snapshot.data(), snapshot.size());
+        uint32_t checksum = 0x811C9DC5u; // FNV-1a
+        for (uint8_t byte : snapshot)
+        {
+            checksum = (checksum ^ byte) * 0x01000193u;
+        }
+        std::cout << "Seed: " << seed << "\n"
+                  << "State checksum: " << std::hex << checksum << std::dec << "\n";
+    }
+
+    if (!traceFilename.empty())
+    {
+        chip8.setTrace(nullptr);
+        std::cout << "Trace: " << trace.records() << " instructions written to " << traceFilename;
+        if (trace.dropped() != 0)
+        {
+            std::cout << " (" << trace.dropped() << " lost, the file could not grow)";
+        }
+        std::cout << "\n";
+        trace.close();
+    }
+
+    if (chip8.getEngine() == Engine::JitVerify)
+    {
+        std::cout << "JIT divergences: " << chip8.getJit()->divergences() << "\n";
+    }
+
+    if (chip8.getEngine() == Engine::Aot)
+    {
+        const AotProgram* program = chip8.getAot()->program();
+        std::cout << "AOT program: " << (program != nullptr ? program->name : "none (interpreter)") << "\n";
+    }
+
+#if CHIP8_PROFILE
+    // Sorted report of what the interpreter spent its cycles on
+    if (engine != Engine::Interpreter)
+    {
+        std::cout << "Profile only covers the instructions run through the interpreter by this engine\n";
+    }
+    chip8.getProfiler().writeText(std::cout);
+    if (!profileFilename.empty())
+    {
+        std::ofstream profileFile(profileFilename);
+        chip8.getProfiler().writeJson(profileFile);
+        if (!profileFile)
+        {
+            std::cerr << "Failed to write profile: " << profileFilename << std::endl;
+        }
+    }
+#endif
+
+    return 0;
+}
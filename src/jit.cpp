@@ -0,0 +1,551 @@
+#include "jit.hpp"
+#include <cstring>
+#include <initializer_list>
+#include <iostream>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CHIP8_JIT_X64 1
+#else
+#define CHIP8_JIT_X64 0
+#endif
+
+#if CHIP8_JIT_X64
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+// Longest run of instructions translated into one block
+const unsigned int MAX_JIT_BLOCK_INSTRUCTIONS = 32;
+
+// Size of the executable arena, and the space reserved before translating a block
+// (a block needs well under 200 bytes per instruction, including its exit stub)
+const size_t JIT_ARENA_SIZE = 1024 * 1024;
+const size_t JIT_MAX_BLOCK_BYTES = 16 * 1024;
+
+// Host registers used by the generated code
+const uint8_t AL = 0;   // also EAX / AX
+const uint8_t CL = 1;   // also ECX
+const uint8_t DL = 2;   // also EDX
+
+// Appends x86-64 machine code to a buffer
+// Memory operands are always [rbx + disp32], rbx holding the Chip8 object being run.
+class Emitter
+{
+public:
+    explicit Emitter(uint8_t* out) : start_(out), cur_(out) {}
+
+    uint8_t* position() const { return cur_; }
+    size_t size() const { return static_cast<size_t>(cur_ - start_); }
+
+    void byte(uint8_t value) { *cur_++ = value; }
+
+    void bytes(std::initializer_list<uint8_t> values)
+    {
+        for (uint8_t value : values) {
+            *cur_++ = value;
+        }
+    }
+
+    void imm16(uint16_t value) { std::memcpy(cur_, &value, 2); cur_ += 2; }
+    void imm32(uint32_t value) { std::memcpy(cur_, &value, 4); cur_ += 4; }
+    void imm64(uint64_t value) { std::memcpy(cur_, &value, 8); cur_ += 8; }
+
+    // ModRM for [rbx + disp32] with the given register field
+    void mem(uint8_t reg, int32_t disp)
+    {
+        byte(static_cast<uint8_t>(0x80 | (reg << 3) | 3));
+        imm32(static_cast<uint32_t>(disp));
+    }
+
+    // Patches a rel32 jump operand to land on the current position
+    void patch(uint8_t* operand)
+    {
+        int32_t rel = static_cast<int32_t>(cur_ - (operand + 4));
+        std::memcpy(operand, &rel, 4);
+    }
+
+private:
+    uint8_t* start_;
+    uint8_t* cur_;
+};
+
+// Byte offsets of the Chip8 members used by the generated code
+struct Layout
+{
+    int32_t registers;
+    int32_t index;
+    int32_t pc;
+    int32_t opcode;
+
+    int32_t V(unsigned int x) const { return registers + static_cast<int32_t>(x); }
+};
+
+static int32_t offsetIn(const Chip8& chip8, const void* member)
+{
+    return static_cast<int32_t>(static_cast<const char*>(member) - reinterpret_cast<const char*>(&chip8));
+}
+
+struct Jit::Ops
+{
+    // Callbacks from translated code into the interpreter
+
+    // Runs one instruction through the interpreter's dispatch tables
+    static void execute(Chip8* chip8, uint32_t opcode)
+    {
+        chip8->opcode = static_cast<uint16_t>(opcode);
+        ((*chip8).*(Chip8::table[opcode >> 12]))();
+    }
+
+    // Runs Fx07, Fx15 or Fx18: the operand holds the opcode and, in the high half, the number of
+    // instructions the block ran before it, since the cycle counter is only advanced after the block
+    static void timer(Chip8* chip8, uint32_t operand)
+    {
+        unsigned long long offset = operand >> 16;
+        chip8->cycleCount += offset;
+        execute(chip8, operand & 0xFFFFu);
+        chip8->cycleCount -= offset;
+    }
+
+    // Runs Fx33 or Fx55 and checks whether the write hit translated code
+    static void store(Chip8* chip8, uint32_t opcode)
+    {
+        uint16_t address = chip8->index;
+        execute(chip8, opcode);
+        unsigned int length = (opcode & 0x00FFu) == 0x33 ? 3 : ((opcode & 0x0F00u) >> 8) + 1;
+        chip8->jit->checkCodeWrite(address, length);
+    }
+
+    static Layout layout(const Chip8& chip8)
+    {
+        Layout layout;
+        layout.registers = offsetIn(chip8, chip8.registers);
+        layout.index = offsetIn(chip8, &chip8.index);
+        layout.pc = offsetIn(chip8, &chip8.pc);
+        layout.opcode = offsetIn(chip8, &chip8.opcode);
+        return layout;
+    }
+
+    // Code generation
+
+    static void prologue(Emitter& e)
+    {
+        e.bytes({0x53});                        // push rbx
+        e.bytes({0x41, 0x54});                  // push r12
+#ifdef _WIN32
+        e.bytes({0x48, 0x83, 0xEC, 0x28});      // sub rsp, 40 (shadow space + alignment)
+        e.bytes({0x48, 0x89, 0xCB});            // mov rbx, rcx
+        e.bytes({0x41, 0x89, 0xD4});            // mov r12d, edx
+#else
+        e.bytes({0x48, 0x83, 0xEC, 0x08});      // sub rsp, 8 (alignment)
+        e.bytes({0x48, 0x89, 0xFB});            // mov rbx, rdi
+        e.bytes({0x41, 0x89, 0xF4});            // mov r12d, esi
+#endif
+    }
+
+    static void epilogue(Emitter& e, uint32_t executed)
+    {
+        e.byte(0xB8);                           // mov eax, executed
+        e.imm32(executed);
+#ifdef _WIN32
+        e.bytes({0x48, 0x83, 0xC4, 0x28});      // add rsp, 40
+#else
+        e.bytes({0x48, 0x83, 0xC4, 0x08});      // add rsp, 8
+#endif
+        e.bytes({0x41, 0x5C});                  // pop r12
+        e.bytes({0x5B});                        // pop rbx
+        e.bytes({0xC3});                        // ret
+    }
+
+    static void storeWord(Emitter& e, int32_t field, uint16_t value)
+    {
+        e.bytes({0x66, 0xC7}); e.mem(0, field);         // mov word [field], value
+        e.imm16(value);
+    }
+
+    static void call(Emitter& e, void (*function)(Chip8*, uint32_t), uint32_t operand)
+    {
+#ifdef _WIN32
+        e.bytes({0x48, 0x89, 0xD9});                    // mov rcx, rbx
+        e.byte(0xBA); e.imm32(operand);                 // mov edx, operand
+#else
+        e.bytes({0x48, 0x89, 0xDF});                    // mov rdi, rbx
+        e.byte(0xBE); e.imm32(operand);                 // mov esi, operand
+#endif
+        e.bytes({0x48, 0xB8});                          // mov rax, function
+        e.imm64(reinterpret_cast<uint64_t>(function));
+        e.bytes({0xFF, 0xD0});                          // call rax
+    }
+
+    // Exits the block when the budget is used up: returns the rel32 operand to patch
+    static uint8_t* budgetCheck(Emitter& e, uint32_t executed)
+    {
+        e.bytes({0x41, 0x81, 0xFC}); e.imm32(executed); // cmp r12d, executed
+        e.bytes({0x0F, 0x86});                          // jbe exit
+        uint8_t* operand = e.position();
+        e.imm32(0);
+        return operand;
+    }
+
+    // Sets pc to address + 2, or address + 4 when the condition code in AL is set
+    static void skip(Emitter& e, const Layout& l, uint16_t address)
+    {
+        e.bytes({0x8D, 0x04, 0x45});                    // lea eax, [rax * 2 + address + 2]
+        e.imm32(address + 2u);
+        e.bytes({0x66, 0x89}); e.mem(AL, l.pc);         // mov [pc], ax
+    }
+
+    // Emits one instruction; `count` is the number of instructions before it in the block
+    // Returns true when the instruction ends the block; pc has been stored by then.
+    static bool instruction(Emitter& e, const Layout& l, uint16_t opcode, uint16_t address, uint32_t count)
+    {
+        uint8_t x = (opcode & 0x0F00u) >> 8u;
+        uint8_t y = (opcode & 0x00F0u) >> 4u;
+        uint8_t kk = opcode & 0x00FFu;
+        uint16_t nnn = opcode & 0x0FFFu;
+        const int32_t VF = l.V(0xF);
+
+        // Runs the instruction through the interpreter with pc pointing past it
+        auto fallback = [&](void (*function)(Chip8*, uint32_t), uint32_t operand) {
+            storeWord(e, l.pc, address + 2u);
+            call(e, function, operand);
+        };
+
+        bool terminal = false;
+        switch (opcode >> 12) {
+            case 0x0:
+                // Decoded on the last nibble only, like Chip8::Table0; other values are op_NULL
+                if ((opcode & 0x000Fu) == 0x0) {
+                    fallback(&Ops::execute, opcode);
+                } else if ((opcode & 0x000Fu) == 0xE) {
+                    fallback(&Ops::execute, opcode);
+                    terminal = true;
+                }
+                break;
+            case 0x1:
+                storeWord(e, l.pc, nnn);
+                terminal = true;
+                break;
+            case 0x2:
+            case 0xB:
+                fallback(&Ops::execute, opcode);
+                terminal = true;
+                break;
+            case 0x3:
+            case 0x4:
+                e.bytes({0x31, 0xC0});                              // xor eax, eax
+                e.byte(0x80); e.mem(7, l.V(x)); e.byte(kk);         // cmp byte [Vx], kk
+                e.bytes({0x0F, static_cast<uint8_t>((opcode >> 12) == 0x3 ? 0x94 : 0x95), 0xC0}); // sete/setne al
+                skip(e, l, address);
+                terminal = true;
+                break;
+            case 0x5:
+            case 0x9:
+                e.bytes({0x31, 0xC0});                              // xor eax, eax
+                e.byte(0x8A); e.mem(CL, l.V(x));                    // mov cl, [Vx]
+                e.byte(0x3A); e.mem(CL, l.V(y));                    // cmp cl, [Vy]
+                e.bytes({0x0F, static_cast<uint8_t>((opcode >> 12) == 0x5 ? 0x94 : 0x95), 0xC0}); // sete/setne al
+                skip(e, l, address);
+                terminal = true;
+                break;
+            case 0x6:
+                e.byte(0xC6); e.mem(0, l.V(x)); e.byte(kk);         // mov byte [Vx], kk
+                break;
+            case 0x7:
+                e.byte(0x80); e.mem(0, l.V(x)); e.byte(kk);         // add byte [Vx], kk
+                break;
+            case 0x8:
+                switch (opcode & 0x000Fu) {
+                    case 0x0:
+                        e.byte(0x8A); e.mem(AL, l.V(y));            // mov al, [Vy]
+                        e.byte(0x88); e.mem(AL, l.V(x));            // mov [Vx], al
+                        break;
+                    case 0x1:
+                    case 0x2:
+                    case 0x3: {
+                        static const uint8_t ops[] = {0, 0x08, 0x20, 0x30}; // or, and, xor
+                        e.byte(0x8A); e.mem(AL, l.V(y));            // mov al, [Vy]
+                        e.byte(ops[opcode & 0x3u]); e.mem(AL, l.V(x)); // op [Vx], al
+                        break;
+                    }
+                    case 0x4:
+                        e.bytes({0x0F, 0xB6}); e.mem(AL, l.V(x));   // movzx eax, byte [Vx]
+                        e.bytes({0x0F, 0xB6}); e.mem(CL, l.V(y));   // movzx ecx, byte [Vy]
+                        e.bytes({0x01, 0xC8});                      // add eax, ecx
+                        e.bytes({0x89, 0xC2});                      // mov edx, eax
+                        e.bytes({0xC1, 0xEA, 0x08});                // shr edx, 8 (carry)
+                        e.byte(0x88); e.mem(DL, VF);                // mov [VF], dl
+                        e.byte(0x88); e.mem(AL, l.V(x));            // mov [Vx], al
+                        break;
+                    case 0x5:
+                    case 0x7: {
+                        // 8xy5: VF = Vx > Vy, Vx = Vx - Vy; 8xy7: VF = Vy > Vx, Vx = Vy - Vx
+                        // Both operands are read again after VF is written, as the interpreter does
+                        uint8_t a = (opcode & 0x000Fu) == 0x5 ? x : y;
+                        uint8_t b = (opcode & 0x000Fu) == 0x5 ? y : x;
+                        e.byte(0x8A); e.mem(AL, l.V(a));            // mov al, [Va]
+                        e.byte(0x3A); e.mem(AL, l.V(b));            // cmp al, [Vb]
+                        e.bytes({0x0F, 0x97, 0xC2});                // seta dl
+                        e.byte(0x88); e.mem(DL, VF);                // mov [VF], dl
+                        e.byte(0x8A); e.mem(AL, l.V(a));            // mov al, [Va]
+                        e.byte(0x2A); e.mem(AL, l.V(b));            // sub al, [Vb]
+                        e.byte(0x88); e.mem(AL, l.V(x));            // mov [Vx], al
+                        break;
+                    }
+                    case 0x6:
+                        e.byte(0x8A); e.mem(AL, l.V(x));            // mov al, [Vx]
+                        e.bytes({0x24, 0x01});                      // and al, 1
+                        e.byte(0x88); e.mem(AL, VF);                // mov [VF], al
+                        e.byte(0xD0); e.mem(5, l.V(x));             // shr byte [Vx], 1
+                        break;
+                    case 0xE:
+                        e.byte(0x8A); e.mem(AL, l.V(x));            // mov al, [Vx]
+                        e.bytes({0xC0, 0xE8, 0x07});                // shr al, 7
+                        e.byte(0x88); e.mem(AL, VF);                // mov [VF], al
+                        e.byte(0xD0); e.mem(4, l.V(x));             // shl byte [Vx], 1
+                        break;
+                    default:
+                        break;                                      // op_NULL
+                }
+                break;
+            case 0xA:
+                storeWord(e, l.index, nnn);
+                break;
+            case 0xC:
+            case 0xD:
+                fallback(&Ops::execute, opcode);
+                break;
+            case 0xE:
+                // Decoded on the last nibble only, like Chip8::TableE
+                if ((opcode & 0x000Fu) == 0x1 || (opcode & 0x000Fu) == 0xE) {
+                    fallback(&Ops::execute, opcode);
+                    terminal = true;
+                }
+                break;
+            default:
+                switch (opcode & 0x00FFu) {
+                    case 0x07:
+                    case 0x15:
+                    case 0x18:
+                        // The timers are derived from the cycle counter of this instruction
+                        fallback(&Ops::timer, (count << 16) | opcode);
+                        break;
+                    case 0x1E:
+                        e.bytes({0x0F, 0xB6}); e.mem(AL, l.V(x));   // movzx eax, byte [Vx]
+                        e.bytes({0x66, 0x01}); e.mem(AL, l.index);  // add [index], ax
+                        break;
+                    case 0x0A:
+                        fallback(&Ops::execute, opcode);
+                        terminal = true;
+                        break;
+                    case 0x33:
+                    case 0x55:
+                        fallback(&Ops::store, opcode);
+                        terminal = true;
+                        break;
+                    case 0x29:
+                    case 0x65:
+                        fallback(&Ops::execute, opcode);
+                        break;
+                    default:
+                        break;                                      // op_NULL
+                }
+                break;
+        }
+
+        return terminal;
+    }
+};
+
+bool Jit::available() {
+    return CHIP8_JIT_X64 != 0;
+}
+
+Jit::Jit(bool verify)
+    : arena_(nullptr), arenaSize_(0), arenaUsed_(0), flushPending_(false),
+      compiled_(0), flushes_(0), verify_(verify), divergences_(0)
+{
+    std::memset(entries_, 0, sizeof(entries_));
+    std::memset(covered_, 0, sizeof(covered_));
+
+#if CHIP8_JIT_X64
+#ifdef _WIN32
+    void* memory = VirtualAlloc(nullptr, JIT_ARENA_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+#else
+    void* memory = mmap(nullptr, JIT_ARENA_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        memory = nullptr;
+    }
+#endif
+    if (memory == nullptr) {
+        std::cerr << "JIT: failed to allocate executable memory, using the interpreter" << std::endl;
+    } else {
+        arena_ = static_cast<uint8_t*>(memory);
+        arenaSize_ = JIT_ARENA_SIZE;
+    }
+#endif
+}
+
+Jit::~Jit() {
+#if CHIP8_JIT_X64
+    if (arena_ != nullptr) {
+#ifdef _WIN32
+        VirtualFree(arena_, 0, MEM_RELEASE);
+#else
+        munmap(arena_, arenaSize_);
+#endif
+    }
+#endif
+}
+
+void Jit::flush() {
+    arenaUsed_ = 0;
+    std::memset(entries_, 0, sizeof(entries_));
+    std::memset(covered_, 0, sizeof(covered_));
+    flushPending_ = false;
+    ++flushes_;
+}
+
+void Jit::checkCodeWrite(uint16_t address, unsigned int length) {
+    // The block running the write always ends right after it, so the flush can wait until it returns
+    for (unsigned int i = 0; i < length && address + i < MEMORY_SIZE; ++i) {
+        if (covered_[address + i]) {
+            flushPending_ = true;
+            return;
+        }
+    }
+}
+
+Jit::BlockFunc Jit::compile(const Chip8& chip8, uint16_t start) {
+    if (arenaUsed_ + JIT_MAX_BLOCK_BYTES > arenaSize_) {
+        flush();
+    }
+
+    struct Exit
+    {
+        uint8_t* operand;       // rel32 of the budget check jump
+        uint32_t executed;      // Instructions run before the exit
+        uint16_t pc;
+        uint16_t opcode;        // Last opcode run before the exit
+    };
+    Exit exits[MAX_JIT_BLOCK_INSTRUCTIONS];
+    unsigned int exitCount = 0;
+
+    Layout layout = Ops::layout(chip8);
+    uint8_t* code = arena_ + arenaUsed_;
+    Emitter e(code);
+    Ops::prologue(e);
+
+    uint16_t address = start;
+    uint16_t lastOpcode = chip8.opcode;
+    uint32_t count = 0;
+    bool terminal = false;
+    while (!terminal && address + 1u < MEMORY_SIZE && count < MAX_JIT_BLOCK_INSTRUCTIONS) {
+        uint16_t opcode = (chip8.memory[address] << 8) | chip8.memory[address + 1];
+
+        // Stop here if the budget does not cover this instruction (the first one always runs)
+        if (count > 0) {
+            exits[exitCount++] = {Ops::budgetCheck(e, count), count, address, lastOpcode};
+        }
+
+        terminal = Ops::instruction(e, layout, opcode, address, count);
+        lastOpcode = opcode;
+        address += 2;
+        ++count;
+    }
+
+    // Normal exit
+    if (!terminal) {
+        Ops::storeWord(e, layout.pc, address);
+    }
+    Ops::storeWord(e, layout.opcode, lastOpcode);
+    Ops::epilogue(e, count);
+
+    // Budget exits, out of line
+    for (unsigned int i = 0; i < exitCount; ++i) {
+        e.patch(exits[i].operand);
+        Ops::storeWord(e, layout.pc, exits[i].pc);
+        Ops::storeWord(e, layout.opcode, exits[i].opcode);
+        Ops::epilogue(e, exits[i].executed);
+    }
+
+    arenaUsed_ += (e.size() + 15) & ~static_cast<size_t>(15);
+    for (uint16_t i = start; i < address; ++i) {
+        covered_[i] = 1;
+    }
+    ++compiled_;
+
+    entries_[start] = reinterpret_cast<BlockFunc>(code);
+    return entries_[start];
+}
+
+void Jit::verify(const Chip8& chip8, uint16_t start, uint32_t executed) {
+    Chip8& shadow = *shadow_;
+    for (uint32_t i = 0; i < executed; ++i) {
+        shadow.cycle();
+    }
+
+    const char* field = nullptr;
+    if (std::memcmp(chip8.registers, shadow.registers, sizeof(chip8.registers)) != 0) field = "registers";
+    else if (chip8.pc != shadow.pc) field = "pc";
+    else if (chip8.index != shadow.index) field = "index";
+    else if (chip8.sp != shadow.sp || std::memcmp(chip8.stack, shadow.stack, sizeof(chip8.stack)) != 0) field = "stack";
+    else if (chip8.cycleCount != shadow.cycleCount) field = "cycle count";
+    else if (chip8.getDelayTimer() != shadow.getDelayTimer() || chip8.getSoundTimer() != shadow.getSoundTimer()) field = "timers";
+    else if (chip8.opcode != shadow.opcode) field = "opcode";
+    else if (std::memcmp(chip8.memory, shadow.memory, chip8.memorySize()) != 0) field = "memory";
+    else if (std::memcmp(chip8.video.planes, shadow.video.planes, sizeof(chip8.video.planes)) != 0) field = "video";
+
+    if (field != nullptr) {
+        ++divergences_;
+        std::cerr << "JIT divergence: " << field << " differs after running " << executed
+                  << " instructions from 0x" << std::hex << start << std::dec << std::endl;
+
+        // Continue from the JIT's state, so one divergence is only reported once
+        shadow.copyStateFrom(chip8);
+    }
+}
+
+void Jit::run(Chip8& chip8, unsigned long long cycles) {
+    // The shadow starts every run from the JIT's state, which includes any change made from outside
+    if (verify_) {
+        if (!shadow_) {
+            shadow_.reset(new Chip8());
+        }
+        shadow_->copyStateFrom(chip8);
+    }
+
+    while (cycles > 0) {
+        uint16_t pc = chip8.pc;
+
+        // Without executable memory, and for code running off the end of memory, use the interpreter
+        if (arena_ == nullptr || pc + 1u >= MEMORY_SIZE) {
+            chip8.cycle();
+            if (verify_) {
+                shadow_->cycle();
+            }
+            --cycles;
+            continue;
+        }
+
+        BlockFunc block = entries_[pc];
+        if (block == nullptr) {
+            block = compile(chip8, pc);
+        }
+
+        uint32_t budget = cycles < 0xFFFFFFFFull ? static_cast<uint32_t>(cycles) : 0xFFFFFFFFu;
+        uint32_t executed = block(&chip8, budget);
+        chip8.cycleCount += executed;
+        cycles -= executed;
+
+        if (verify_) {
+            verify(chip8, pc, executed);
+        }
+
+        if (flushPending_) {
+            flush();
+        }
+    }
+}
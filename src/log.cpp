@@ -0,0 +1,164 @@
+#include "log.hpp"
+#include <chrono>
+
+// Printed in front of every message
+static const char* const levelNames[] = { "[trace] ", "[debug] ", "[info] ", "[warn] ", "[error] " };
+
+// How long the writer sleeps when the ring is empty; messages are never waited on by the logging side
+const std::chrono::milliseconds WRITER_IDLE_SLEEP(2);
+
+Logger& Logger::instance() {
+    // Created on first use, and destroyed (after writing everything still queued) at exit
+    static Logger logger;
+    return logger;
+}
+
+Logger::Logger()
+    : enqueuePos_(0), dequeuePos_(0), dropped_(0), stop_(false), output_(stdout), written_(0)
+{
+    static_assert((LOG_RING_SIZE & (LOG_RING_SIZE - 1)) == 0, "LOG_RING_SIZE must be a power of two");
+
+    // Cell i is free for the message with position i
+    for (size_t i = 0; i < LOG_RING_SIZE; ++i) {
+        ring_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    writer_ = std::thread(&Logger::writerLoop, this);
+}
+
+Logger::~Logger() {
+    stop_.store(true, std::memory_order_release);
+    writer_.join();
+}
+
+Logger::Cell* Logger::claim() {
+    size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+    for (;;) {
+        Cell* cell = &ring_[pos & (LOG_RING_SIZE - 1)];
+        size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+
+        if (difference == 0) {
+            // The cell is free for this position; take the position unless another thread was faster
+            if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                return cell;
+            }
+        } else if (difference < 0) {
+            // The writer has not freed this cell since the last lap: the ring is full
+            return nullptr;
+        } else {
+            pos = enqueuePos_.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void Logger::publish(Cell* cell) {
+    // A claimed cell's sequence is its position; position + 1 hands it to the writer
+    size_t pos = cell->sequence.load(std::memory_order_relaxed);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+}
+
+bool Logger::drain() {
+    // Writes every message that is ready, in order; returns false if there was none
+    char line[512];
+    bool any = false;
+    for (;;) {
+        Cell* cell = &ring_[dequeuePos_ & (LOG_RING_SIZE - 1)];
+        if (cell->sequence.load(std::memory_order_acquire) != dequeuePos_ + 1) {
+            break;
+        }
+
+        format(cell->record, line, sizeof(line));
+        fputs(line, output_);
+
+        // Free the cell for the message one lap later
+        cell->sequence.store(dequeuePos_ + LOG_RING_SIZE, std::memory_order_release);
+        ++dequeuePos_;
+        any = true;
+    }
+
+    if (any) {
+        fflush(output_);
+        std::lock_guard<std::mutex> lock(flushMutex_);
+        written_ = dequeuePos_;
+    }
+    flushed_.notify_all();
+    return any;
+}
+
+void Logger::writerLoop() {
+    while (!stop_.load(std::memory_order_acquire)) {
+        if (!drain()) {
+            std::this_thread::sleep_for(WRITER_IDLE_SLEEP);
+        }
+    }
+
+    // Whatever was logged before exit still gets written
+    drain();
+}
+
+void Logger::flush() {
+    size_t target = enqueuePos_.load(std::memory_order_acquire);
+    std::unique_lock<std::mutex> lock(flushMutex_);
+    flushed_.wait(lock, [&]() { return written_ >= target; });
+}
+
+void Logger::format(const LogRecord& record, char* line, size_t size) const {
+    // Expands the placeholders of the format string; always ends the line with '\n'
+    size_t used = 0;
+    size_t limit = size - 2;
+    auto append = [&](const char* text, size_t length) {
+        if (length > limit - used) {
+            length = limit - used;
+        }
+        memcpy(line + used, text, length);
+        used += length;
+    };
+
+    const char* prefix = levelNames[record.level <= LOG_LEVEL_ERROR ? record.level : LOG_LEVEL_ERROR];
+    append(prefix, strlen(prefix));
+
+    unsigned int next = 0;
+    for (const char* p = record.format; *p != '\0'; ++p) {
+        const char* close = *p == '{' ? strchr(p, '}') : nullptr;
+        if (close == nullptr) {
+            append(p, 1);
+            continue;
+        }
+
+        bool hex = close - p == 2 && p[1] == 'x';
+        p = close;
+        if (next >= record.count) {
+            append("{?}", 3);
+            continue;
+        }
+
+        char number[32];
+        int length = 0;
+        unsigned int n = next++;
+        switch (record.types[n]) {
+            case LogRecord::ARG_SIGNED:
+                length = hex ? snprintf(number, sizeof(number), "%llx", static_cast<unsigned long long>(record.values[n].u))
+                             : snprintf(number, sizeof(number), "%lld", static_cast<long long>(record.values[n].i));
+                break;
+            case LogRecord::ARG_UNSIGNED:
+                length = snprintf(number, sizeof(number), hex ? "%llx" : "%llu", static_cast<unsigned long long>(record.values[n].u));
+                break;
+            case LogRecord::ARG_DOUBLE:
+                length = snprintf(number, sizeof(number), "%g", record.values[n].d);
+                break;
+            case LogRecord::ARG_TEXT:
+                if (record.values[n].u < LOG_TEXT_SIZE) {
+                    const char* text = record.text + record.values[n].u;
+                    append(text, strlen(text));
+                }
+                break;
+        }
+        if (length > 0) {
+            append(number, static_cast<size_t>(length) < sizeof(number) ? static_cast<size_t>(length) : sizeof(number) - 1);
+        }
+    }
+
+    line[used++] = '\n';
+    line[used] = '\0';
+}
@@ -1,20 +1,34 @@
+#include "audio.hpp"
+#include "audio_output.hpp"
 #include "chip8.hpp"
+#include "frame_export.hpp"
+#include "frame_queue.hpp"
+#include "log.hpp"
+#include "movie.hpp"
+#include "profiler.hpp"
 #include "renderer.hpp"
+#include "rewind.hpp"
+#include "scheduler.hpp"
 #include <chrono>
+#include <cstring>
 #include <iostream>
 #include <thread>
 
-// Set the clock speed of the CHIP-8 CPU
-// This value determines how many CPU cycles are executed per second
-// Adjust this value to change the overall speed of the emulation
-const int CHIP8_CLOCK_SPEED = 500; // Hz
+// Number of times per frame the keyboard is read
+const unsigned int INPUT_SAMPLES_PER_FRAME = 4;
+
+static void printUsage(const char* program)
+{
+    std::cerr << "Usage: " << program << " <Scale> <Delay> <ROM> [--rewind <MB>] [--seed <N>] [--record <Movie>]"
+              << " [--machine <Machine>] [--quirks <Quirks>] [--export <File|->] [--export-format y4m|rgba] [--export-changed <Timecodes>]\n";
+}
 
 int main(int argc, char** argv)
 {
     // Check if the correct number of command-line arguments are provided
-    if (argc != 4)
+    if (argc < 4)
     {
-        std::cerr << "Usage: " << argv[0] << " <Scale> <Delay> <ROM>\n";
+        printUsage(argv[0]);
         std::exit(EXIT_FAILURE);
     }
 
@@ -22,85 +36,280 @@ int main(int argc, char** argv)
     int videoScale = std::stoi(argv[1]);
     int cycleDelay = std::stoi(argv[2]);
     const char* romFilename = argv[3];
+    size_t rewindMegabytes = 16;
+    bool seeded = false;
+    uint32_t seed = 0;
+    std::string movieFilename;
+    Machine machine = Machine::Chip8;
+    QuirkSet quirks = QuirkSet::Auto;
+    std::string exportFilename;
+    ExportFormat exportFormat = ExportFormat::Y4m;
+    std::string timecodesFilename;
+
+    for (int i = 4; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--rewind") == 0 && i + 1 < argc)
+        {
+            rewindMegabytes = static_cast<size_t>(std::stoul(argv[++i]));
+        }
+        else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+        {
+            seed = static_cast<uint32_t>(std::stoul(argv[++i]));
+            seeded = true;
+        }
+        else if (std::strcmp(argv[i], "--machine") == 0 && i + 1 < argc && parseMachine(argv[i + 1], machine))
+        {
+            ++i;
+        }
+        else if (std::strcmp(argv[i], "--quirks") == 0 && i + 1 < argc && parseQuirkSet(argv[i + 1], quirks))
+        {
+            ++i;
+        }
+        else if (std::strcmp(argv[i], "--export") == 0 && i + 1 < argc)
+        {
+            exportFilename = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--export-format") == 0 && i + 1 < argc && parseExportFormat(argv[i + 1], exportFormat))
+        {
+            ++i;
+        }
+        else if (std::strcmp(argv[i], "--export-changed") == 0 && i + 1 < argc)
+        {
+            timecodesFilename = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+        {
+            movieFilename = argv[++i];
+        }
+        else
+        {
+            printUsage(argv[0]);
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
+    // Video streamed to stdout can't share it with the log and the report
+    if (exportFilename == "-")
+    {
+        std::cout.rdbuf(std::cerr.rdbuf());
+        Logger::instance().setOutput(stderr);
+    }
 
     // Initialize the renderer and CHIP-8 emulator
     Renderer renderer(videoScale);
     Chip8 chip8;
-    chip8.loadROM(romFilename);
+    chip8.setMachine(machine);
+    chip8.setQuirks(quirks);
+#if CHIP8_PROFILE
+    // Idle loops skipped at once would be missing from the profile
+    chip8.setIdleSkip(false);
+#endif
+    if (!chip8.loadROM(romFilename))
+    {
+        std::exit(EXIT_FAILURE);
+    }
+
+    // A recorded movie needs a known seed; pick one if none was given
+    bool recording = !movieFilename.empty();
+    if (recording && !seeded)
+    {
+        seed = static_cast<uint32_t>(std::chrono::system_clock::now().time_since_epoch().count());
+        seeded = true;
+    }
+    if (seeded)
+    {
+        chip8.seedRandom(seed);
+    }
 
-    // Get the current time as the starting point for our timing calculations
-    auto lastCycleTime = std::chrono::high_resolution_clock::now();
-    auto lastFrameTime = std::chrono::high_resolution_clock::now();
+    InputMovie movie;
+    movie.seed = seed;
+    movie.machine = chip8.getMachine();
+    movie.quirks = chip8.getQuirks();
+    movie.romChecksum = InputMovie::checksumFile(romFilename);
 
-    // Calculate time intervals for frame updates and CPU cycles
-    // frameInterval is set to 1/60 second for 60 FPS
-    const std::chrono::duration<double> frameInterval(1.0 / 60.0);
-    // cycleInterval is set based on the defined CHIP8_CLOCK_SPEED
-    const std::chrono::duration<double> cycleInterval(1.0 / CHIP8_CLOCK_SPEED);
+    // Every frame is recorded into the rewind history; holding Backspace plays it backwards
+    // Rewinding is disabled while recording a movie, which has to follow a single timeline
+    Rewind rewind(rewindMegabytes * 1024 * 1024, chip8.snapshotSize());
 
-    // Main emulation loop
-    while (!renderer.quit())
+    // The scheduler stops the CPU at every frame boundary and input sample of the emulated clock
+    // The timers are derived from the same clock, so a recorded movie replays bit-exactly in chip8headless
+    Scheduler scheduler(chip8, INPUT_SAMPLES_PER_FRAME);
+
+    // Completed frames go from the emulation thread to this one without either waiting for the other
+    FrameQueue frameQueue;
+
+    // Sound goes from the emulation thread to SDL's audio thread the same way, through a sample ring
+    // Declared after the renderer so the device is closed before SDL shuts down
+    AudioStream audio;
+    AudioOutput audioOutput(audio);
+
+    // Every emulated frame is also streamed to the export, at the window's scale, if one is requested
+    // Frames played back by rewinding are not part of the recording.
+    FrameExporter exporter;
+    bool exporting = !exportFilename.empty();
+    if (exporting && !exporter.open(exportFilename, exportFormat, static_cast<unsigned int>(videoScale), Palette(),
+                                    machine != Machine::Chip8, timecodesFilename))
     {
-        // Get the current time at the start of each loop iteration
-        auto currentTime = std::chrono::high_resolution_clock::now();
+        std::cerr << "Failed to start the export: " << exporter.error() << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
 
-        // Handle user input
-        renderer.handleInput(chip8);
+    typedef std::chrono::steady_clock Clock;
+    const std::chrono::duration<double> cycleInterval(1.0 / CHIP8_CLOCK_SPEED);
+    const std::chrono::duration<double> frameInterval(1.0 / CHIP8_FRAME_RATE);
 
-        // CPU cycle loop: Run as many CPU cycles as necessary based on elapsed time
-        while (currentTime - lastCycleTime >= cycleInterval)
+    // Emulation thread: runs the CPU, the rewind history and the movie recording, and publishes
+    // every frame and its sound. It only talks to this thread through the frame queue, the audio
+    // stream and the renderer's input atomics.
+    std::thread emulation([&]()
+    {
+        auto publishFrame = [&](uint64_t dirtyRows)
         {
-            // Execute one CPU cycle
-            chip8.cycle();
+            FrameQueue::Frame& frame = frameQueue.back();
+            frame.video = chip8.video;
+            frame.dirtyRows = dirtyRows;
+            frame.cycle = chip8.cycles();
+            frameQueue.publish();
+        };
 
-            // Update the last cycle time
-            // We use duration_cast to ensure we're adding the exact cycle interval
-            lastCycleTime += std::chrono::duration_cast<std::chrono::high_resolution_clock::duration>(cycleInterval);
+        // Backspace is ignored while recording a movie, which has to follow a single timeline
+        auto rewinding = [&]() { return renderer.rewinding() && !recording; };
 
-            // If a draw operation occurred during this cycle, exit the CPU loop
-            // This allows us to update the screen immediately when necessary
-            if (chip8.drawFlag)
-            {
-                break;
-            }
-        }
+        // The emulated clock follows the wall clock from this point on
+        // It is moved whenever emulation resumes after a pause, such as rewinding
+        auto clockStart = Clock::now();
+        unsigned long long clockStartCycle = chip8.cycles();
+        audio.resync(chip8);
 
-        // Frame update: Check if it's time to update the screen (60 times per second)
-        if (currentTime - lastFrameTime >= frameInterval)
+        while (!renderer.quit())
         {
-            // Only update the screen if the draw flag is set
-            if (chip8.drawFlag)
+            if (rewinding())
             {
-                renderer.update(chip8.video);
-                chip8.drawFlag = false;
-            }
-
-            // Update the last frame time
-            // Again, we use duration_cast to ensure we're adding the exact frame interval
-            lastFrameTime += std::chrono::duration_cast<std::chrono::high_resolution_clock::duration>(frameInterval);
+                // The CPU is stopped; step back one frame per 60 Hz tick until the key is released
+                if (rewind.stepBack(chip8))
+                {
+                    // The restored display can differ anywhere from the window
+                    chip8.takeDirtyRows();
+                    publishFrame(~0ULL);
+                }
+                std::this_thread::sleep_for(frameInterval);
 
-            // Update CHIP-8 timers
-            // These timers should decrement at 60Hz, which is why we update them here
-            if (chip8.delayTimer > 0)
-            {
-                --chip8.delayTimer;
+                clockStart = Clock::now();
+                clockStartCycle = chip8.cycles();
+                audio.resync(chip8);
+                continue;
             }
 
-            if (chip8.soundTimer > 0)
+            // Run every cycle that is due by now, stopping at each scheduled event
+            std::chrono::duration<double> elapsed = Clock::now() - clockStart;
+            unsigned long long dueCycle = clockStartCycle + static_cast<unsigned long long>(elapsed / cycleInterval);
+            while (chip8.cycles() < dueCycle && !renderer.quit() && !rewinding())
             {
-                if (chip8.soundTimer == 1)
+                unsigned int events = scheduler.run(dueCycle);
+
+                if (events & Scheduler::EVENT_INPUT)
                 {
-                    // Emit a beep sound when the sound timer reaches 1
-                    // In this case, we just print "BEEP!" to the console
-                    std::cout << "BEEP!" << std::endl;
+                    // Take over the keys the presentation thread saw last
+                    uint16_t keys = renderer.keys();
+                    for (unsigned int key = 0; key < KEY_COUNT; ++key)
+                    {
+                        chip8.keypad[key] = (keys >> key) & 1;
+                    }
+                    if (recording)
+                    {
+                        movie.capture(chip8.cycles(), chip8.keypad);
+                    }
                 }
-                --chip8.soundTimer;
+
+                if (events & Scheduler::EVENT_FRAME)
+                {
+                    // Hand the frame to the presentation thread with the rows that changed in it
+                    publishFrame(chip8.takeDirtyRows());
+                    if (exporting)
+                    {
+                        exporter.submit(chip8.video);
+                    }
+
+                    // Record the state at the end of this frame
+                    rewind.record(chip8);
+                }
+
+                // Sound for the cycles just run, a quarter of a frame at most
+                audio.produce(chip8);
             }
+
+            // Sleep until the next event is due instead of polling the clock
+            auto nextEventTime = clockStart + std::chrono::duration_cast<Clock::duration>(cycleInterval * static_cast<double>(scheduler.nextEvent() - clockStartCycle));
+            std::this_thread::sleep_until(nextEventTime);
         }
+    });
 
-        // Sleep for a short time to prevent the loop from consuming 100% CPU
-        // This allows other processes to run and reduces power consumption
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    // Presentation loop: SDL events and rendering stay on the thread that created the window
+    // Only the newest frame is presented; with vsync the present blocks this thread, never the CPU
+    while (!renderer.quit())
+    {
+        renderer.handleInput();
+
+        const FrameQueue::Frame* frame = frameQueue.acquire();
+        if (frame != nullptr)
+        {
+            // Frames without any net change are skipped entirely
+            renderer.update(frame->video, frame->dirtyRows);
+        }
+        else
+        {
+            // Nothing new to show yet; keep polling input at a modest rate
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    emulation.join();
+
+    // Let the log catch up so the report below comes last
+    Logger::instance().flush();
+
+    // Report how many frames actually had to be presented
+    std::cout << "Frames presented: " << renderer.framesPresented()
+              << ", skipped: " << renderer.framesSkipped() << std::endl;
+
+    // Report how much of the CPU time idle loops would have taken
+    std::cout << "Idle loops skipped: " << chip8.idleSkips() << " (" << chip8.idleCyclesSkipped()
+              << " of " << chip8.cycles() << " instructions)" << std::endl;
+
+#if CHIP8_PROFILE
+    // Report what the ROM spent its cycles on
+    chip8.getProfiler().writeText(std::cout);
+#endif
+
+    // Report how well the audio device kept up
+    if (audioOutput.isOpen())
+    {
+        std::cout << "Audio: " << audio.latencyMs() << " ms buffered (cap " << audio.maxBuffered() * 1000.0 / AUDIO_SAMPLE_RATE
+                  << " ms), " << audio.underruns() << " underruns (" << audio.underrunSamples() << " samples of silence), "
+                  << audio.samplesDropped() << " samples dropped" << std::endl;
+    }
+
+    if (exporting)
+    {
+        exporter.close();
+        std::cout << "Export: " << exporter.framesWritten() << " of " << exporter.framesSubmitted() << " frames ("
+                  << exporter.width() << "x" << exporter.height() << ") in " << exporter.bytesWritten() << " bytes, "
+                  << exporter.stalls() << " stalls on a full queue" << (exporter.failed() ? ", write failed" : "") << std::endl;
+    }
+
+    // Report what the rewind history costs, to size the cap
+    std::cout << "Rewind history: " << rewind.frames() << " frames in " << rewind.bytesUsed()
+              << " bytes, " << rewind.bytesPerFrame() << " bytes/frame" << std::endl;
+
+    if (recording)
+    {
+        // The movie ends where the session ended
+        movie.capture(chip8.cycles(), chip8.keypad);
+        if (movie.save(movieFilename))
+        {
+            std::cout << "Movie: " << movie.events.size() << " key changes over " << chip8.cycles()
+                      << " cycles, seed " << movie.seed << ", written to " << movieFilename << std::endl;
+        }
     }
 
     return 0;
@@ -0,0 +1,163 @@
+#include "movie.hpp"
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+const char MOVIE_MAGIC[4] = { 'C', '8', 'M', 'V' };
+const uint16_t MOVIE_VERSION = 2;
+const uint8_t MOVIE_END = 0xFF;
+
+static void putLittleEndian(std::vector<uint8_t>& out, uint32_t value, unsigned int bytes)
+{
+    for (unsigned int i = 0; i < bytes; ++i) {
+        out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+}
+
+static uint32_t getLittleEndian(const uint8_t* in, unsigned int bytes)
+{
+    uint32_t value = 0;
+    for (unsigned int i = 0; i < bytes; ++i) {
+        value |= static_cast<uint32_t>(in[i]) << (8 * i);
+    }
+    return value;
+}
+
+// Unsigned LEB128: 7 bits per byte, the high bit set on every byte but the last
+static void putVarint(std::vector<uint8_t>& out, unsigned long long value)
+{
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+static bool getVarint(const std::vector<uint8_t>& in, size_t& pos, unsigned long long& value)
+{
+    value = 0;
+    for (unsigned int shift = 0; shift < 64 && pos < in.size(); shift += 7) {
+        uint8_t byte = in[pos++];
+        value |= static_cast<unsigned long long>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+InputMovie::InputMovie()
+    : seed(0), machine(Machine::Chip8), quirks(QuirkSet::Original), romChecksum(0), length(0), captured_(), position_(0)
+{
+}
+
+void InputMovie::capture(unsigned long long cycle, const uint8_t* keypad) {
+    for (unsigned int key = 0; key < KEY_COUNT; ++key) {
+        if ((keypad[key] != 0) != (captured_[key] != 0)) {
+            captured_[key] = keypad[key];
+            events.push_back(InputEvent{ cycle, static_cast<uint8_t>(key), keypad[key] != 0 });
+        }
+    }
+    if (cycle > length) {
+        length = cycle;
+    }
+}
+
+unsigned long long InputMovie::nextEventCycle() const {
+    return position_ < events.size() ? events[position_].cycle : UINT64_MAX;
+}
+
+unsigned long long InputMovie::apply(unsigned long long cycle, uint8_t* keypad) {
+    while (position_ < events.size() && events[position_].cycle <= cycle) {
+        const InputEvent& event = events[position_++];
+        keypad[event.key] = event.pressed ? 1 : 0;
+    }
+    return nextEventCycle();
+}
+
+bool InputMovie::save(const std::string& filename) const {
+    std::vector<uint8_t> out(MOVIE_MAGIC, MOVIE_MAGIC + 4);
+    putLittleEndian(out, MOVIE_VERSION, 2);
+    out.push_back(static_cast<uint8_t>(machine));
+    out.push_back(static_cast<uint8_t>(quirks));
+    putLittleEndian(out, seed, 4);
+    putLittleEndian(out, romChecksum, 4);
+
+    unsigned long long previous = 0;
+    for (const InputEvent& event : events) {
+        putVarint(out, event.cycle - previous);
+        out.push_back(static_cast<uint8_t>(event.key | (event.pressed ? 0x10 : 0x00)));
+        previous = event.cycle;
+    }
+    putVarint(out, length > previous ? length - previous : 0);
+    out.push_back(MOVIE_END);
+
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) {
+        std::cerr << "Failed to open movie file: " << filename << std::endl;
+        return false;
+    }
+    file.write(reinterpret_cast<const char*>(out.data()), static_cast<std::streamsize>(out.size()));
+    return static_cast<bool>(file);
+}
+
+bool InputMovie::load(const std::string& filename) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) {
+        std::cerr << "Failed to open movie file: " << filename << std::endl;
+        return false;
+    }
+    std::vector<uint8_t> in((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    if (in.size() < 16 || std::memcmp(in.data(), MOVIE_MAGIC, 4) != 0 || getLittleEndian(&in[4], 2) != MOVIE_VERSION) {
+        std::cerr << "Not a version " << MOVIE_VERSION << " input movie: " << filename << std::endl;
+        return false;
+    }
+    if (in[6] > static_cast<uint8_t>(Machine::XoChip) || in[7] == static_cast<uint8_t>(QuirkSet::Auto)
+        || in[7] > static_cast<uint8_t>(QuirkSet::XoChip)) {
+        std::cerr << "Unknown machine or quirk set in input movie: " << filename << std::endl;
+        return false;
+    }
+
+    std::vector<InputEvent> loaded;
+    unsigned long long cycle = 0;
+    size_t pos = 16;
+    for (;;) {
+        unsigned long long delta;
+        if (!getVarint(in, pos, delta) || pos >= in.size()) {
+            std::cerr << "Truncated input movie: " << filename << std::endl;
+            return false;
+        }
+        cycle += delta;
+        uint8_t record = in[pos++];
+        if (record == MOVIE_END) {
+            break;
+        }
+        loaded.push_back(InputEvent{ cycle, static_cast<uint8_t>(record & 0x0F), (record & 0x10) != 0 });
+    }
+
+    machine = static_cast<Machine>(in[6]);
+    quirks = static_cast<QuirkSet>(in[7]);
+    seed = getLittleEndian(&in[8], 4);
+    romChecksum = getLittleEndian(&in[12], 4);
+    length = cycle;
+    events.swap(loaded);
+    position_ = 0;
+    return true;
+}
+
+uint32_t InputMovie::checksumFile(const std::string& filename) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) {
+        return 0;
+    }
+
+    // 32-bit FNV-1a
+    uint32_t hash = 0x811C9DC5u;
+    for (std::istreambuf_iterator<char> it(file), end; it != end; ++it) {
+        hash ^= static_cast<uint8_t>(*it);
+        hash *= 0x01000193u;
+    }
+    return hash;
+}
@@ -0,0 +1,52 @@
+#include "offscreen_renderer.hpp"
+#include <cstring>
+
+OffscreenRenderer::OffscreenRenderer(unsigned int scale, const Palette& palette, bool highResolution)
+    : scale_(scale > 0 ? scale : 1), palette_(palette), highResolution_(highResolution), shown_(), rendered_(false),
+      framesRendered_(0), framesSkipped_(0)
+{
+}
+
+void OffscreenRenderer::render(const Display& video, uint32_t* pixels, size_t pitch) const {
+    expandDisplayScaled(video, 0, video.height(), rowScale(video), palette_, pixels, pitch);
+}
+
+bool OffscreenRenderer::update(const Display& video, uint64_t dirtyRows, uint32_t* pixels, size_t pitch) {
+    // The first frame, and the first after a change of resolution or plane count, fills the whole buffer
+    if (!rendered_ || video.hires != shown_.hires || video.planeCount != shown_.planeCount) {
+        shown_ = video;
+        render(video, pixels, pitch);
+        rendered_ = true;
+        ++framesRendered_;
+        return true;
+    }
+
+    bool changed = false;
+    unsigned int scale = rowScale(video);
+    size_t rowBytes = video.words() * sizeof(uint64_t);
+    for (unsigned int row = 0; row < video.height(); ++row) {
+        if (!((dirtyRows >> row) & 1)) {
+            continue;
+        }
+        bool rowChanged = false;
+        for (unsigned int plane = 0; plane < video.planeCount; ++plane) {
+            if (std::memcmp(video.planes[plane][row], shown_.planes[plane][row], rowBytes) != 0) {
+                std::memcpy(shown_.planes[plane][row], video.planes[plane][row], rowBytes);
+                rowChanged = true;
+            }
+        }
+        if (rowChanged) {
+            // Each display row is `scale` lines of the buffer
+            uint8_t* line = reinterpret_cast<uint8_t*>(pixels) + static_cast<size_t>(row) * scale * pitch;
+            expandDisplayScaled(shown_, row, 1, scale, palette_, line, pitch);
+            changed = true;
+        }
+    }
+
+    if (changed) {
+        ++framesRendered_;
+    } else {
+        ++framesSkipped_;
+    }
+    return changed;
+}
@@ -0,0 +1,114 @@
+#include "chip8.hpp"
+#include "rom_pack.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+// ROM pack tool
+// Builds a ROM pack from every file under the given directories, named by their path relative to
+// the directory, or lists and verifies an existing pack.
+
+static void printUsage(const char* program)
+{
+    std::cerr << "Usage: " << program << " <Pack> <Directory>...    build a pack from the ROMs in the directories\n"
+              << "       " << program << " --list <Pack>              list the ROMs in a pack\n"
+              << "       " << program << " --verify <Pack>            check the checksum of every ROM in a pack\n";
+}
+
+static int buildPack(const std::string& packFilename, const std::vector<std::string>& directories)
+{
+    RomPackBuilder builder;
+    unsigned long long skipped = 0;
+
+    for (const std::string& directory : directories)
+    {
+        std::error_code error;
+        std::filesystem::recursive_directory_iterator it(directory, error);
+        if (error)
+        {
+            std::cerr << "Failed to read directory: " << directory << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        // Sorted, so the same directory always gives the same pack
+        std::vector<std::filesystem::path> paths;
+        for (const auto& entry : it)
+        {
+            if (entry.is_regular_file())
+            {
+                paths.push_back(entry.path());
+            }
+        }
+        std::sort(paths.begin(), paths.end());
+
+        for (const std::filesystem::path& path : paths)
+        {
+            std::string name = path.lexically_relative(directory).generic_string();
+            std::ifstream file(path, std::ios::binary);
+            std::vector<uint8_t> rom((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            if (!file.is_open() || !builder.add(name, rom.data(), rom.size()))
+            {
+                std::cerr << "Skipped " << name << " (" << rom.size() << " bytes): empty, larger than "
+                          << XOCHIP_MAX_ROM_SIZE << " bytes, unreadable or a duplicate name" << std::endl;
+                ++skipped;
+            }
+        }
+    }
+
+    if (!builder.save(packFilename))
+    {
+        std::cerr << "Failed to write ROM pack: " << packFilename << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << "Packed " << builder.size() << " ROMs (" << builder.duplicates() << " sharing an identical image, "
+              << skipped << " skipped) into " << packFilename << std::endl;
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc == 3 && (std::strcmp(argv[1], "--list") == 0 || std::strcmp(argv[1], "--verify") == 0))
+    {
+        bool verifying = std::strcmp(argv[1], "--verify") == 0;
+        RomPack pack;
+        if (!pack.open(argv[2]))
+        {
+            std::cerr << "Failed to open ROM pack: " << pack.error() << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        unsigned long long bad = 0;
+        for (size_t i = 0; i < pack.size(); ++i)
+        {
+            PackedRom rom = pack.rom(i);
+            if (!verifying)
+            {
+                std::printf("%08X %5zu %.*s\n", rom.checksum, rom.size, static_cast<int>(rom.nameLength), rom.name);
+            }
+            else if (!pack.verify(i))
+            {
+                std::printf("Checksum mismatch: %.*s\n", static_cast<int>(rom.nameLength), rom.name);
+                ++bad;
+            }
+        }
+        if (verifying)
+        {
+            std::cout << pack.size() - bad << " of " << pack.size() << " ROMs intact" << std::endl;
+        }
+        return bad == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (argc < 3 || argv[1][0] == '-')
+    {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    return buildPack(argv[1], std::vector<std::string>(argv + 2, argv + argc));
+}
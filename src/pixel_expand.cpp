@@ -0,0 +1,324 @@
+#include "pixel_expand.hpp"
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CHIP8_EXPAND_SSE2 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#else
+#define CHIP8_EXPAND_SSE2 0
+#endif
+
+// The AVX2 kernel is compiled for AVX2 even when the rest of the build is not, and only used when
+// the CPU reports support for it
+#if CHIP8_EXPAND_SSE2 && (defined(__GNUC__) || defined(__clang__))
+#define CHIP8_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define CHIP8_TARGET_AVX2
+#endif
+
+const unsigned int ROW_PIXELS = 64;
+
+// Kernels expand `words` consecutive words (one row of the display) into 64 * `words` pixels
+typedef void (*ExpandKernel)(const uint64_t* row, unsigned int words, uint32_t on, uint32_t off, uint32_t* out);
+
+[[maybe_unused]] static void expandScalar(const uint64_t* row, unsigned int words, uint32_t on, uint32_t off, uint32_t* out)
+{
+    for (unsigned int word = 0; word < words; ++word, out += ROW_PIXELS) {
+        uint64_t bits = row[word];
+        for (unsigned int x = 0; x < ROW_PIXELS; ++x) {
+            out[x] = (bits >> (ROW_PIXELS - 1 - x)) & 1 ? on : off;
+        }
+    }
+}
+
+[[maybe_unused]] static void fillScalar(uint32_t* out, size_t count, uint32_t color)
+{
+    for (size_t i = 0; i < count; ++i) {
+        out[i] = color;
+    }
+}
+
+#if CHIP8_EXPAND_SSE2
+
+// Lane masks for every 4-pixel nibble: lane i is all ones when bit 3 - i is set
+struct NibbleMasks
+{
+    alignas(16) uint32_t lanes[16][4];
+
+    constexpr NibbleMasks() : lanes()
+    {
+        for (unsigned int nibble = 0; nibble < 16; ++nibble) {
+            for (unsigned int lane = 0; lane < 4; ++lane) {
+                lanes[nibble][lane] = (nibble >> (3 - lane)) & 1 ? 0xFFFFFFFFu : 0u;
+            }
+        }
+    }
+};
+
+static constexpr NibbleMasks nibbleMasks{};
+
+static void expandSse2(const uint64_t* row, unsigned int words, uint32_t on, uint32_t off, uint32_t* out)
+{
+    const __m128i onColor = _mm_set1_epi32(static_cast<int>(on));
+    const __m128i offColor = _mm_set1_epi32(static_cast<int>(off));
+
+    for (unsigned int word = 0; word < words; ++word, out += ROW_PIXELS) {
+        uint64_t bits = row[word];
+        __m128i* pixel = reinterpret_cast<__m128i*>(out);
+        for (unsigned int x = 0; x < ROW_PIXELS / 4; ++x) {
+            unsigned int nibble = static_cast<unsigned int>(bits >> (ROW_PIXELS - 4 - 4 * x)) & 0xF;
+            __m128i mask = _mm_load_si128(reinterpret_cast<const __m128i*>(nibbleMasks.lanes[nibble]));
+            _mm_storeu_si128(pixel + x, _mm_or_si128(_mm_and_si128(mask, onColor), _mm_andnot_si128(mask, offColor)));
+        }
+    }
+}
+
+CHIP8_TARGET_AVX2
+static void expandAvx2(const uint64_t* row, unsigned int words, uint32_t on, uint32_t off, uint32_t* out)
+{
+    const __m256i onColor = _mm256_set1_epi32(static_cast<int>(on));
+    const __m256i offColor = _mm256_set1_epi32(static_cast<int>(off));
+    const __m256i bits = _mm256_setr_epi32(0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+
+    for (unsigned int word = 0; word < words; ++word, out += ROW_PIXELS) {
+        uint64_t value = row[word];
+        __m256i* pixel = reinterpret_cast<__m256i*>(out);
+        for (unsigned int x = 0; x < ROW_PIXELS / 8; ++x) {
+            // Broadcast the byte holding these 8 pixels and turn each bit into a lane mask
+            int byte = static_cast<int>(value >> (ROW_PIXELS - 8 - 8 * x)) & 0xFF;
+            __m256i mask = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(byte), bits), bits);
+            _mm256_storeu_si256(pixel + x, _mm256_blendv_epi8(offColor, onColor, mask));
+        }
+    }
+}
+
+static void fillSse2(uint32_t* out, size_t count, uint32_t color)
+{
+    const __m128i value = _mm_set1_epi32(static_cast<int>(color));
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), value);
+    }
+    for (; i < count; ++i) {
+        out[i] = color;
+    }
+}
+
+CHIP8_TARGET_AVX2
+static void fillAvx2(uint32_t* out, size_t count, uint32_t color)
+{
+    const __m256i value = _mm256_set1_epi32(static_cast<int>(color));
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), value);
+    }
+    for (; i < count; ++i) {
+        out[i] = color;
+    }
+}
+
+static bool cpuHasAvx2()
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_cpu_supports("avx2");
+#elif defined(_MSC_VER)
+    // AVX2 needs the CPU feature and the OS saving the YMM registers
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuid(info, 1);
+    bool osSavesYmm = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 0x6) == 0x6;
+    __cpuidex(info, 7, 0);
+    return osSavesYmm && (info[1] & (1 << 5)) != 0;
+#else
+    return false;
+#endif
+}
+
+#endif
+
+typedef void (*FillKernel)(uint32_t* out, size_t count, uint32_t color);
+
+struct ExpandSelection
+{
+    ExpandKernel kernel;
+    FillKernel fill;
+    const char* name;
+};
+
+static const ExpandSelection& selectedKernel()
+{
+    // Picked on first use; function-local statics are initialised thread-safely
+    static const ExpandSelection selection = [] {
+#if CHIP8_EXPAND_SSE2
+        if (cpuHasAvx2()) {
+            return ExpandSelection{ &expandAvx2, &fillAvx2, "avx2" };
+        }
+        return ExpandSelection{ &expandSse2, &fillSse2, "sse2" };
+#else
+        return ExpandSelection{ &expandScalar, &fillScalar, "scalar" };
+#endif
+    }();
+    return selection;
+}
+
+// True when the second plane has no pixels lit in this row, so it has two colours only
+static bool singlePlane(const Display& display, unsigned int row)
+{
+    if (display.planeCount < 2) {
+        return true;
+    }
+    const uint64_t* second = display.planes[1][row];
+    for (unsigned int word = 0; word < display.words(); ++word) {
+        if (second[word] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Colour of pixel x of a row that has both planes in use
+static uint32_t planeColor(const Display& display, unsigned int row, unsigned int x, const Palette& palette)
+{
+    unsigned int word = x / ROW_PIXELS;
+    unsigned int bit = ROW_PIXELS - 1 - x % ROW_PIXELS;
+    unsigned int first = (display.planes[0][row][word] >> bit) & 1;
+    unsigned int second = (display.planes[1][row][word] >> bit) & 1;
+    const uint32_t colors[4] = { palette.off, palette.on, palette.second, palette.both };
+    return colors[first | (second << 1)];
+}
+
+void expandDisplay(const Display& display, unsigned int first, unsigned int count, const Palette& palette, void* pixels, size_t pitch)
+{
+    ExpandKernel kernel = selectedKernel().kernel;
+    uint8_t* out = static_cast<uint8_t*>(pixels);
+    unsigned int width = display.width();
+
+    for (unsigned int row = first; row < first + count; ++row, out += pitch) {
+        uint32_t* line = reinterpret_cast<uint32_t*>(out);
+        if (singlePlane(display, row)) {
+            kernel(display.planes[0][row], display.words(), palette.on, palette.off, line);
+            continue;
+        }
+        for (unsigned int x = 0; x < width; ++x) {
+            line[x] = planeColor(display, row, x, palette);
+        }
+    }
+}
+
+// Number of leading zero bits of a non-zero word
+static unsigned int leadingZeros(uint64_t value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<unsigned int>(__builtin_clzll(value));
+#else
+    unsigned int count = 0;
+    while (!(value & (1ULL << 63))) {
+        value <<= 1;
+        ++count;
+    }
+    return count;
+#endif
+}
+
+void expandDisplayScaled(const Display& display, unsigned int first, unsigned int count, unsigned int scale, const Palette& palette, void* pixels, size_t pitch)
+{
+    if (scale == 1) {
+        expandDisplay(display, first, count, palette, pixels, pitch);
+        return;
+    }
+
+    FillKernel fill = selectedKernel().fill;
+    uint8_t* out = static_cast<uint8_t*>(pixels);
+    unsigned int width = display.width();
+    size_t lineBytes = static_cast<size_t>(width) * scale * sizeof(uint32_t);
+
+    for (unsigned int y = first; y < first + count; ++y) {
+        // Fill the first output line run by run: display rows are mostly long runs of equal pixels,
+        // and each run becomes one vector fill of run length * scale pixels
+        uint32_t* line = reinterpret_cast<uint32_t*>(out);
+        if (singlePlane(display, y)) {
+            for (unsigned int word = 0; word < display.words(); ++word) {
+                uint64_t row = display.planes[0][y][word];
+                uint32_t* wordLine = line + static_cast<size_t>(word) * ROW_PIXELS * scale;
+                unsigned int x = 0;
+                while (x < ROW_PIXELS) {
+                    bool lit = (row >> (ROW_PIXELS - 1 - x)) & 1;
+                    uint64_t rest = (lit ? ~row : row) << x;   // The run ends at the first bit that differs
+                    unsigned int length = rest == 0 ? ROW_PIXELS - x : leadingZeros(rest);
+                    fill(wordLine + static_cast<size_t>(x) * scale, static_cast<size_t>(length) * scale, lit ? palette.on : palette.off);
+                    x += length;
+                }
+            }
+        } else {
+            unsigned int x = 0;
+            while (x < width) {
+                uint32_t color = planeColor(display, y, x, palette);
+                unsigned int end = x + 1;
+                while (end < width && planeColor(display, y, end, palette) == color) {
+                    ++end;
+                }
+                fill(line + static_cast<size_t>(x) * scale, static_cast<size_t>(end - x) * scale, color);
+                x = end;
+            }
+        }
+        out += pitch;
+
+        // The other lines of this display row are copies of the first
+        for (unsigned int copy = 1; copy < scale; ++copy, out += pitch) {
+            std::memcpy(out, line, lineBytes);
+        }
+    }
+}
+
+const char* expandKernelName()
+{
+    return selectedKernel().name;
+}
+
+static bool parseColor(const std::string& text, uint32_t& color)
+{
+    if ((text.size() != 6 && text.size() != 8) || text.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos) {
+        return false;
+    }
+
+    uint32_t value = static_cast<uint32_t>(std::strtoul(text.c_str(), nullptr, 16));
+
+    // Colours without alpha are opaque
+    color = text.size() == 6 ? (value << 8) | 0xFF : value;
+    return true;
+}
+
+bool parsePalette(const std::string& text, Palette& palette)
+{
+    // Two colours, or four with the XO-CHIP plane colours
+    Palette parsed;
+    uint32_t* colors[4] = { &parsed.on, &parsed.off, &parsed.second, &parsed.both };
+
+    size_t start = 0;
+    unsigned int count = 0;
+    for (;;) {
+        size_t comma = text.find(',', start);
+        std::string color = text.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+        if (count == 4 || !parseColor(color, *colors[count])) {
+            return false;
+        }
+        ++count;
+        if (comma == std::string::npos) {
+            break;
+        }
+        start = comma + 1;
+    }
+
+    if (count != 2 && count != 4) {
+        return false;
+    }
+    palette = parsed;
+    return true;
+}
@@ -0,0 +1,170 @@
+#include "profiler.hpp"
+#include "threaded.hpp"
+#include <algorithm>
+#include <bitset>
+#include <cstdio>
+#include <cstring>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+static_assert(PROFILE_FAMILIES - PROFILE_EXTENDED_FAMILIES == Threaded::OP_COUNT, "PROFILE_FAMILIES must match Threaded::Op");
+
+// In the same order as Threaded::Op, then the extended families
+static const char* const familyNames[PROFILE_FAMILIES] = {
+    "00E0 CLS", "00EE RET", "1nnn JP", "2nnn CALL", "3xkk SE", "4xkk SNE", "5xy0 SE", "6xkk LD",
+    "7xkk ADD", "8xy0 LD", "8xy1 OR", "8xy2 AND", "8xy3 XOR", "8xy4 ADD", "8xy5 SUB", "8xy6 SHR",
+    "8xy7 SUBN", "8xyE SHL", "9xy0 SNE", "Annn LD I", "Bnnn JP V0", "Cxkk RND", "Dxyn DRW",
+    "Ex9E SKP", "ExA1 SKNP", "Fx07 LD V,DT", "Fx0A LD V,K", "Fx15 LD DT,V", "Fx18 LD ST,V", "Fx1E ADD I",
+    "Fx29 LD F", "Fx33 LD B", "Fx55 LD [I],V", "Fx65 LD V,[I]", "illegal",
+    "00Cn SCD", "00Dn SCU", "00FB SCR", "00FC SCL", "00FD EXIT", "00FE LOW", "00FF HIGH",
+    "5xy2 LD [I],Vx-Vy", "5xy3 LD Vx-Vy,[I]", "F000 LD I,long", "Fn01 PLANE", "F002 AUDIO",
+    "Fx30 LD HF", "Fx3A PITCH", "Fx75 LD R,V", "Fx85 LD V,R",
+};
+
+enum ExtendedFamily : unsigned int
+{
+    FAMILY_SCD = Threaded::OP_COUNT, FAMILY_SCU, FAMILY_SCR, FAMILY_SCL, FAMILY_EXIT, FAMILY_LOW, FAMILY_HIGH,
+    FAMILY_SAVE, FAMILY_LOAD, FAMILY_LD_I_LONG, FAMILY_PLANE, FAMILY_AUDIO, FAMILY_LD_HF, FAMILY_PITCH,
+    FAMILY_LD_R, FAMILY_LD_V_R
+};
+static_assert(FAMILY_LD_V_R + 1 == PROFILE_FAMILIES, "familyNames must list every extended family");
+
+Profiler::Profiler() : machine_(Machine::Chip8), pcHits_(MEMORY_SIZE) {
+    reset();
+}
+
+void Profiler::setMachine(Machine machine) {
+    machine_ = machine;
+    pcHits_.assign(machine == Machine::XoChip ? XOCHIP_MEMORY_SIZE : MEMORY_SIZE, 0);
+}
+
+void Profiler::reset() {
+    instructions_ = 0;
+    memset(families_, 0, sizeof(families_));
+    std::fill(pcHits_.begin(), pcHits_.end(), 0);
+    draws_ = 0;
+    drawRows_ = 0;
+    drawPixels_ = 0;
+    memset(callDepth_, 0, sizeof(callDepth_));
+    returns_ = 0;
+}
+
+void Profiler::instruction(uint16_t pc, uint16_t opcode) {
+    ++instructions_;
+    ++families_[family(opcode)];
+    ++pcHits_[pc & (pcHits_.size() - 1)];
+}
+
+unsigned int Profiler::family(uint16_t opcode) const {
+    // The later machines decode like Chip8::Table0, Chip8::op_5xy0 and Chip8::TableF do for them
+    if (machine_ == Machine::Chip8) {
+        return Threaded::decode(opcode);
+    }
+    const unsigned int illegal = Threaded::OP_ILLEGAL;
+    uint8_t low = opcode & 0x00FFu;
+    switch (opcode >> 12) {
+        case 0x0:
+            if ((opcode & 0x0F00u) != 0) {
+                return illegal;
+            }
+            switch (low) {
+                case 0xE0: return Threaded::OP_CLS;
+                case 0xEE: return Threaded::OP_RET;
+                case 0xFB: return FAMILY_SCR;
+                case 0xFC: return FAMILY_SCL;
+                case 0xFD: return FAMILY_EXIT;
+                case 0xFE: return FAMILY_LOW;
+                case 0xFF: return FAMILY_HIGH;
+                default:
+                    return (low & 0xF0u) == 0xC0u ? FAMILY_SCD : (low & 0xF0u) == 0xD0u ? FAMILY_SCU : illegal;
+            }
+        case 0x5:
+            if (machine_ == Machine::XoChip && (opcode & 0x000Fu) != 0) {
+                return (opcode & 0x000Fu) == 0x2 ? FAMILY_SAVE : (opcode & 0x000Fu) == 0x3 ? FAMILY_LOAD : illegal;
+            }
+            break;
+        case 0xF:
+            switch (low) {
+                case 0x00: return FAMILY_LD_I_LONG;
+                case 0x01: return FAMILY_PLANE;
+                case 0x02: return FAMILY_AUDIO;
+                case 0x30: return FAMILY_LD_HF;
+                case 0x3A: return FAMILY_PITCH;
+                case 0x75: return FAMILY_LD_R;
+                case 0x85: return FAMILY_LD_V_R;
+            }
+            break;
+    }
+    return Threaded::decode(opcode);
+}
+
+unsigned int Profiler::popcount(uint64_t bits) {
+    return static_cast<unsigned int>(std::bitset<64>(bits).count());
+}
+
+// Non-zero entries of `counts`, most counted first (lowest index first among equal counts)
+static std::vector<std::pair<unsigned int, unsigned long long>> sortedCounts(const unsigned long long* counts, unsigned int size) {
+    std::vector<std::pair<unsigned int, unsigned long long>> sorted;
+    for (unsigned int i = 0; i < size; ++i) {
+        if (counts[i] != 0) {
+            sorted.emplace_back(i, counts[i]);
+        }
+    }
+    std::stable_sort(sorted.begin(), sorted.end(), [](const std::pair<unsigned int, unsigned long long>& a,
+                                                     const std::pair<unsigned int, unsigned long long>& b) {
+        return a.second > b.second;
+    });
+    return sorted;
+}
+
+void Profiler::writeText(std::ostream& out, size_t hotspots) const {
+    double total = instructions_ != 0 ? static_cast<double>(instructions_) : 1.0;
+
+    out << "Profile: " << instructions_ << " instructions\n"
+        << "Opcode families:\n";
+    for (const auto& family : sortedCounts(families_, PROFILE_FAMILIES)) {
+        out << "  " << familyNames[family.first] << ": " << family.second
+            << " (" << 100.0 * static_cast<double>(family.second) / total << "%)\n";
+    }
+
+    out << "Hottest addresses:\n";
+    std::vector<std::pair<unsigned int, unsigned long long>> addresses = sortedCounts(pcHits_.data(), static_cast<unsigned int>(pcHits_.size()));
+    for (size_t i = 0; i < addresses.size() && i < hotspots; ++i) {
+        char address[8];
+        snprintf(address, sizeof(address), "0x%0*X", pcHits_.size() > MEMORY_SIZE ? 4 : 3, addresses[i].first);
+        out << "  " << address << ": " << addresses[i].second
+            << " (" << 100.0 * static_cast<double>(addresses[i].second) / total << "%)\n";
+    }
+
+    out << "Dxyn: " << draws_ << " draws, " << drawRows_ << " rows, " << drawPixels_ << " pixels\n"
+        << "Calls by stack depth:";
+    for (unsigned int depth = 1; depth <= STACK_LEVELS; ++depth) {
+        if (callDepth_[depth] != 0) {
+            out << " " << depth << ":" << callDepth_[depth];
+        }
+    }
+    out << "\nReturns: " << returns_ << "\n";
+}
+
+void Profiler::writeJson(std::ostream& out) const {
+    out << "{\n  \"instructions\": " << instructions_ << ",\n  \"families\": [";
+    std::vector<std::pair<unsigned int, unsigned long long>> families = sortedCounts(families_, PROFILE_FAMILIES);
+    for (size_t i = 0; i < families.size(); ++i) {
+        out << (i == 0 ? "\n" : ",\n") << "    {\"family\": \"" << familyNames[families[i].first]
+            << "\", \"count\": " << families[i].second << "}";
+    }
+
+    out << "\n  ],\n  \"addresses\": [";
+    std::vector<std::pair<unsigned int, unsigned long long>> addresses = sortedCounts(pcHits_.data(), static_cast<unsigned int>(pcHits_.size()));
+    for (size_t i = 0; i < addresses.size(); ++i) {
+        out << (i == 0 ? "\n" : ",\n") << "    {\"pc\": " << addresses[i].first << ", \"count\": " << addresses[i].second << "}";
+    }
+
+    out << "\n  ],\n  \"dxyn\": {\"draws\": " << draws_ << ", \"rows\": " << drawRows_ << ", \"pixels\": " << drawPixels_ << "},\n"
+        << "  \"call_depth\": [";
+    for (unsigned int depth = 0; depth <= STACK_LEVELS; ++depth) {
+        out << (depth == 0 ? "" : ", ") << callDepth_[depth];
+    }
+    out << "],\n  \"returns\": " << returns_ << "\n}\n";
+}
@@ -1,7 +1,11 @@
 #include "renderer.hpp"
-#include <iostream>
+#include "pixel_expand.hpp"
+#include "log.hpp"
+#include <cstring>
 
-Renderer::Renderer(int scale) : scale_(scale), quit_(false), currentTexture_(0) {
+Renderer::Renderer(int scale, const Palette& palette)
+    : texture_(nullptr), palette_(palette), shown_(), forcePresent_(true),
+      framesPresented_(0), framesSkipped_(0), scale_(scale), keys_(0), quit_(false), rewinding_(false) {
     SDL_Init(SDL_INIT_VIDEO);
     window_ = SDL_CreateWindow("Chip-8 Emulator", 
                                SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 
@@ -10,130 +14,185 @@ Renderer::Renderer(int scale) : scale_(scale), quit_(false), currentTexture_(0)
     renderer_ = SDL_CreateRenderer(window_, -1, 
                                    SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
     
-    for (int i = 0; i < 3; ++i) {
-        textures_[i] = SDL_CreateTexture(renderer_, 
-                                         SDL_PIXELFORMAT_RGBA8888,
-                                         SDL_TEXTUREACCESS_STREAMING,
-                                         VIDEO_WIDTH, VIDEO_HEIGHT);
+    // A single streaming texture: SDL already double buffers the presented frames, so the display is
+    // expanded straight into the texture memory every frame. It has room for the 128x64 display;
+    // at 64x32 only its top left quarter is used and stretched over the window.
+    texture_ = SDL_CreateTexture(renderer_,
+                                 SDL_PIXELFORMAT_RGBA8888,
+                                 SDL_TEXTUREACCESS_STREAMING,
+                                 HIRES_WIDTH, HIRES_HEIGHT);
+
+    // Start from a blank display, which is what shown_ holds; later frames only upload changed rows
+    shown_.planeCount = 1;
+    void* pixels;
+    int pitch;
+    if (SDL_LockTexture(texture_, nullptr, &pixels, &pitch) == 0) {
+        expandDisplay(shown_, 0, shown_.height(), palette_, pixels, static_cast<size_t>(pitch));
+        SDL_UnlockTexture(texture_);
     }
 }
 
 Renderer::~Renderer() {
-    for (auto& texture : textures_) {
-        SDL_DestroyTexture(texture);
-    }
+    SDL_DestroyTexture(texture_);
     SDL_DestroyRenderer(renderer_);
     SDL_DestroyWindow(window_);
     SDL_Quit();
 }
 
-void Renderer::update(const uint32_t* buffer) {
-    SDL_UpdateTexture(textures_[currentTexture_], nullptr, buffer, VIDEO_WIDTH * sizeof(uint32_t));
+bool Renderer::update(const Display& video, uint64_t dirtyRows) {
+    // A change of resolution or plane count redraws every row
+    bool redraw = video.hires != shown_.hires || video.planeCount != shown_.planeCount;
+    if (redraw) {
+        shown_.hires = video.hires;
+        shown_.planeCount = video.planeCount;
+        dirtyRows = ~0ULL;
+    }
+
+    // Find the rows that really differ from the texture
+    // A sprite that was erased and drawn again in the same frame leaves its rows unchanged
+    int firstRow = -1;
+    int lastRow = -1;
+    size_t rowBytes = video.words() * sizeof(uint64_t);
+    for (unsigned int row = 0; row < video.height(); ++row) {
+        if (!((dirtyRows >> row) & 1)) {
+            continue;
+        }
+        bool changed = redraw;
+        for (unsigned int plane = 0; plane < video.planeCount; ++plane) {
+            if (memcmp(video.planes[plane][row], shown_.planes[plane][row], rowBytes) != 0) {
+                memcpy(shown_.planes[plane][row], video.planes[plane][row], rowBytes);
+                changed = true;
+            }
+        }
+        if (changed) {
+            if (firstRow < 0) {
+                firstRow = static_cast<int>(row);
+            }
+            lastRow = static_cast<int>(row);
+        }
+    }
+
+    // Nothing changed: the window still shows this frame, so skip the upload and the present
+    if (firstRow < 0 && !forcePresent_) {
+        ++framesSkipped_;
+        return false;
+    }
+
+    // Lock only the band of changed rows and expand the display directly into it
+    if (firstRow >= 0) {
+        SDL_Rect band = { 0, firstRow, static_cast<int>(shown_.width()), lastRow - firstRow + 1 };
+        void* pixels;
+        int pitch;
+        if (SDL_LockTexture(texture_, &band, &pixels, &pitch) == 0) {
+            expandDisplay(shown_, static_cast<unsigned int>(firstRow), static_cast<unsigned int>(band.h), palette_, pixels, static_cast<size_t>(pitch));
+            SDL_UnlockTexture(texture_);
+        } else {
+            LOG_ERROR("Failed to lock texture: {}", SDL_GetError());
+        }
+    }
+
     SDL_RenderClear(renderer_);
-    SDL_RenderCopy(renderer_, textures_[currentTexture_], nullptr, nullptr);
+    SDL_Rect source = { 0, 0, static_cast<int>(shown_.width()), static_cast<int>(shown_.height()) };
+    SDL_RenderCopy(renderer_, texture_, &source, nullptr);
     SDL_RenderPresent(renderer_);
-    swapBuffers();
+    forcePresent_ = false;
+    ++framesPresented_;
+    return true;
 }
 
-void Renderer::swapBuffers() {
-    currentTexture_ = (currentTexture_ + 1) % 3;
-}
-
-void Renderer::handleInput(Chip8& chip8) {
+void Renderer::handleInput() {
     SDL_Event event;
     bool keypadChanged = false;
 
     while (SDL_PollEvent(&event)) {
         switch (event.type) {
             case SDL_QUIT:
-                std::cout << "Quit event received" << std::endl;
+                LOG_INFO("Quit event received");
                 quit_ = true;
                 break;
             case SDL_KEYDOWN:
-                std::cout << "Key pressed: " << SDL_GetKeyName(event.key.keysym.sym) << std::endl;
-                keypadChanged = handleKeyEvent(event.key.keysym.sym, true, chip8);
+                LOG_DEBUG("Key pressed: {}", SDL_GetKeyName(event.key.keysym.sym));
+                keypadChanged = handleKeyEvent(event.key.keysym.sym, true);
                 break;
             case SDL_KEYUP:
-                std::cout << "Key released: " << SDL_GetKeyName(event.key.keysym.sym) << std::endl;
-                keypadChanged = handleKeyEvent(event.key.keysym.sym, false, chip8);
+                LOG_DEBUG("Key released: {}", SDL_GetKeyName(event.key.keysym.sym));
+                keypadChanged = handleKeyEvent(event.key.keysym.sym, false);
                 break;
             case SDL_WINDOWEVENT:
                 handleWindowEvent(event.window);
                 break;
             case SDL_SYSWMEVENT:
-                std::cout << "System window manager event received" << std::endl;
+                LOG_TRACE("System window manager event received");
                 break;
             default:
                 if (event.type >= SDL_USEREVENT && event.type < SDL_LASTEVENT) {
-                    std::cout << "User-defined event received: " << (event.type - SDL_USEREVENT) << std::endl;
+                    LOG_TRACE("User-defined event received: {}", event.type - SDL_USEREVENT);
                 } else {
-                    std::cout << "Unhandled event type: " << event.type << std::endl;
+                    LOG_TRACE("Unhandled event type: {x}", event.type);
                 }
                 break;
         }
     }
     
     if (keypadChanged) {
-        std::cout << "Current CHIP-8 keypad state: ";
-        for (int i = 0; i < 16; i++) {
-            std::cout << (chip8.keypad[i] ? '1' : '0');
-        }
-        std::cout << std::endl;
+        // Bit k is key k
+        LOG_DEBUG("Current CHIP-8 keypad state: {x}", keys_.load(std::memory_order_relaxed));
     }
 }
 
 void Renderer::handleWindowEvent(const SDL_WindowEvent& windowEvent) {
     switch (windowEvent.event) {
         case SDL_WINDOWEVENT_SHOWN:
-            std::cout << "Window shown" << std::endl;
+            LOG_DEBUG("Window shown");
             break;
         case SDL_WINDOWEVENT_HIDDEN:
-            std::cout << "Window hidden" << std::endl;
+            LOG_DEBUG("Window hidden");
             break;
         case SDL_WINDOWEVENT_EXPOSED:
-            std::cout << "Window exposed" << std::endl;
+            LOG_DEBUG("Window exposed");
+            forcePresent_ = true; // The window contents were lost, so present even without changes
             break;
         case SDL_WINDOWEVENT_MOVED:
-            std::cout << "Window moved to " << windowEvent.data1 << "," << windowEvent.data2 << std::endl;
+            LOG_DEBUG("Window moved to {},{}", windowEvent.data1, windowEvent.data2);
             break;
         case SDL_WINDOWEVENT_RESIZED:
-            std::cout << "Window resized to " << windowEvent.data1 << "x" << windowEvent.data2 << std::endl;
+            LOG_DEBUG("Window resized to {}x{}", windowEvent.data1, windowEvent.data2);
             break;
         case SDL_WINDOWEVENT_SIZE_CHANGED:
-            std::cout << "Window size changed to " << windowEvent.data1 << "x" << windowEvent.data2 << std::endl;
+            LOG_DEBUG("Window size changed to {}x{}", windowEvent.data1, windowEvent.data2);
             break;
         case SDL_WINDOWEVENT_MINIMIZED:
-            std::cout << "Window minimized" << std::endl;
+            LOG_DEBUG("Window minimized");
             break;
         case SDL_WINDOWEVENT_MAXIMIZED:
-            std::cout << "Window maximized" << std::endl;
+            LOG_DEBUG("Window maximized");
             break;
         case SDL_WINDOWEVENT_RESTORED:
-            std::cout << "Window restored" << std::endl;
+            LOG_DEBUG("Window restored");
             break;
         case SDL_WINDOWEVENT_ENTER:
-            std::cout << "Mouse entered window" << std::endl;
+            LOG_TRACE("Mouse entered window");
             break;
         case SDL_WINDOWEVENT_LEAVE:
-            std::cout << "Mouse left window" << std::endl;
+            LOG_TRACE("Mouse left window");
             break;
         case SDL_WINDOWEVENT_FOCUS_GAINED:
-            std::cout << "Window gained keyboard focus" << std::endl;
+            LOG_DEBUG("Window gained keyboard focus");
             break;
         case SDL_WINDOWEVENT_FOCUS_LOST:
-            std::cout << "Window lost keyboard focus" << std::endl;
+            LOG_DEBUG("Window lost keyboard focus");
             break;
         case SDL_WINDOWEVENT_CLOSE:
-            std::cout << "Window close requested" << std::endl;
+            LOG_INFO("Window close requested");
             quit_ = true;
             break;
         default:
-            std::cout << "Unhandled window event: " << windowEvent.event << std::endl;
+            LOG_TRACE("Unhandled window event: {}", windowEvent.event);
             break;
     }
 }
 
-bool Renderer::handleKeyEvent(SDL_Keycode key, bool isPressed, Chip8& chip8) {
+bool Renderer::handleKeyEvent(SDL_Keycode key, bool isPressed) {
     int chipKey = -1;
     switch (key) {
         case SDLK_x: chipKey = 0x0; break;
@@ -155,12 +214,17 @@ bool Renderer::handleKeyEvent(SDL_Keycode key, bool isPressed, Chip8& chip8) {
         case SDLK_ESCAPE:
             quit_ = true;
             return false;
+        case SDLK_BACKSPACE:
+            rewinding_ = isPressed;
+            return false;
     }
 
     if (chipKey != -1) {
-        chip8.keypad[chipKey] = isPressed ? 1 : 0;
-        std::cout << "CHIP-8 key " << std::hex << chipKey << " " 
-                  << (isPressed ? "pressed" : "released") << std::endl;
+        // Only this thread writes the key state, so a plain load and store is enough
+        uint16_t keys = keys_.load(std::memory_order_relaxed);
+        uint16_t bit = static_cast<uint16_t>(1u << chipKey);
+        keys_.store(static_cast<uint16_t>(isPressed ? (keys | bit) : (keys & ~bit)), std::memory_order_relaxed);
+        LOG_DEBUG("CHIP-8 key {x} {}", chipKey, isPressed ? "pressed" : "released");
         return true;
     }
 
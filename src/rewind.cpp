@@ -0,0 +1,272 @@
+#include "rewind.hpp"
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+// Each index entry is paid for with this many bytes of the memory cap; frames that encode to less
+// than that (minus the entry itself) run out of index before they run out of data
+const size_t CAP_BYTES_PER_FRAME = 96;
+
+// A run of unchanged bytes shorter than this stays inside the current literal run, since starting
+// a new run costs a 4-byte header
+const size_t MIN_SKIP = 4;
+
+// Longest skip or literal run a run header can hold
+const size_t MAX_RUN = 0xFFFF;
+
+// Encoded format: a sequence of runs, each made of
+//   uint16 skip   number of bytes equal to the reference before this run
+//   uint16 count  number of bytes that differ
+//   count bytes   state XOR reference
+// Every run except the first covers at least MIN_SKIP + 1 bytes of the state, which bounds the size,
+// apart from the empty runs that carry skips longer than MAX_RUN
+static size_t maxEncodedSize(size_t snapshotSize) {
+    return snapshotSize + 4 * (1 + snapshotSize / (MIN_SKIP + 1)) + 4 * (snapshotSize / MAX_RUN + 1);
+}
+
+// XORs the runs of an encoded state into `state`, which holds its reference
+static void applyRuns(const uint8_t* in, size_t size, uint8_t* state)
+{
+    const uint8_t* end = in + size;
+    size_t pos = 0;
+    while (in < end) {
+        uint16_t skip, count;
+        std::memcpy(&skip, in, 2);
+        std::memcpy(&count, in + 2, 2);
+        in += 4;
+        pos += skip;
+        for (uint16_t i = 0; i < count; ++i) {
+            state[pos++] ^= *in++;
+        }
+    }
+}
+
+Rewind::Rewind(size_t memoryCap, size_t snapshotSize, unsigned int keyframeInterval)
+    : first_(0), next_(0), head_(0), contentBytes_(0),
+      keyframeInterval_(keyframeInterval > 0 ? keyframeInterval : 1), snapshotSize_(snapshotSize),
+      snapshot_(snapshotSize), keyframe_(snapshotSize), keyframeSequence_(0), keyframeValid_(false),
+      encoded_(maxEncodedSize(snapshotSize)), zeros_(snapshotSize, 0),
+      framesRecorded_(0), keyframesRecorded_(0), bytesRecorded_(0)
+{
+    size_t entries = std::max<size_t>(2, memoryCap / CAP_BYTES_PER_FRAME);
+    size_t indexBytes = entries * sizeof(Frame);
+    size_t dataBytes = memoryCap > indexBytes ? memoryCap - indexBytes : 0;
+
+    index_.resize(entries);
+    data_.resize(std::min<size_t>(dataBytes, UINT32_MAX)); // Offsets are stored in 32 bits
+}
+
+void Rewind::clear() {
+    first_ = next_ = 0;
+    head_ = 0;
+    contentBytes_ = 0;
+    keyframeValid_ = false;
+}
+
+double Rewind::bytesPerFrame() const {
+    return framesRecorded_ > 0 ? static_cast<double>(bytesRecorded_) / static_cast<double>(framesRecorded_) : 0.0;
+}
+
+size_t Rewind::encode(const uint8_t* state, const uint8_t* reference) {
+    uint8_t* out = encoded_.data();
+    size_t pos = 0;
+
+    while (pos < snapshotSize_) {
+        // Skip the unchanged bytes, 8 at a time while possible
+        size_t skipStart = pos;
+        while (pos + 8 <= snapshotSize_) {
+            uint64_t a, b;
+            std::memcpy(&a, state + pos, 8);
+            std::memcpy(&b, reference + pos, 8);
+            if (a != b) {
+                break;
+            }
+            pos += 8;
+        }
+        while (pos < snapshotSize_ && state[pos] == reference[pos]) {
+            ++pos;
+        }
+        if (pos == snapshotSize_) {
+            break;
+        }
+
+        // Skips too long for one header go into empty runs
+        for (; pos - skipStart > MAX_RUN; skipStart += MAX_RUN) {
+            uint16_t skip = static_cast<uint16_t>(MAX_RUN);
+            uint16_t count = 0;
+            std::memcpy(out, &skip, 2);
+            std::memcpy(out + 2, &count, 2);
+            out += 4;
+        }
+
+        // The literal run ends at the first MIN_SKIP unchanged bytes in a row, or at MAX_RUN bytes
+        size_t literalStart = pos;
+        size_t literalEnd = pos;
+        size_t unchanged = 0;
+        while (pos < snapshotSize_ && unchanged < MIN_SKIP && pos - literalStart < MAX_RUN) {
+            if (state[pos] == reference[pos]) {
+                ++unchanged;
+            } else {
+                unchanged = 0;
+                literalEnd = pos + 1;
+            }
+            ++pos;
+        }
+        pos = literalEnd;
+
+        uint16_t skip = static_cast<uint16_t>(literalStart - skipStart);
+        uint16_t count = static_cast<uint16_t>(literalEnd - literalStart);
+        std::memcpy(out, &skip, 2);
+        std::memcpy(out + 2, &count, 2);
+        out += 4;
+        for (size_t i = literalStart; i < literalEnd; ++i) {
+            *out++ = state[i] ^ reference[i];
+        }
+    }
+
+    return static_cast<size_t>(out - encoded_.data());
+}
+
+void Rewind::dropOldestKeyframe() {
+    // Frames after the keyframe are encoded against it, so they go with it
+    do {
+        contentBytes_ -= frame(first_).size;
+        ++first_;
+    } while (first_ < next_ && frame(first_).sinceKeyframe != 0);
+
+    if (keyframeSequence_ < first_) {
+        keyframeValid_ = false;
+    }
+}
+
+bool Rewind::allocate(size_t size, unsigned long long keyframe, uint32_t& offset) {
+    if (size > data_.size()) {
+        return false;
+    }
+
+    // Drop the oldest keyframes until the index has a free entry and the data a free range
+    // The keyframe a new delta refers to must stay
+    for (;;) {
+        if (frames() < index_.size()) {
+            size_t capacity = data_.size();
+            if (contentBytes_ == 0) {
+                offset = capacity - head_ >= size ? head_ : 0;
+                break;
+            }
+
+            // Data in use goes from the oldest frame to head_, possibly wrapping around the end
+            uint32_t tail = frame(first_).offset;
+            if (tail < head_) {
+                if (capacity - head_ >= size) {
+                    offset = head_;
+                    break;
+                }
+                if (tail >= size) {
+                    offset = 0;
+                    break;
+                }
+            } else if (tail - head_ >= size) {
+                offset = head_;
+                break;
+            }
+        }
+
+        if (frames() == 0 || first_ == keyframe) {
+            return false;
+        }
+        dropOldestKeyframe();
+    }
+
+    head_ = static_cast<uint32_t>(offset + size);
+    return true;
+}
+
+void Rewind::decodeKeyframe(unsigned long long sequence) {
+    if (keyframeValid_ && keyframeSequence_ == sequence) {
+        return;
+    }
+
+    const Frame& key = frame(sequence);
+    std::fill(keyframe_.begin(), keyframe_.end(), 0);
+    applyRuns(data_.data() + key.offset, key.size, keyframe_.data());
+    keyframeSequence_ = sequence;
+    keyframeValid_ = true;
+}
+
+bool Rewind::record(const Chip8& chip8) {
+    chip8.saveState(snapshot_.data(), snapshot_.size());
+
+    uint32_t offset;
+    size_t size;
+
+    // Encode against the keyframe of the newest frame while it is recent enough
+    if (frames() > 0) {
+        unsigned long long newest = next_ - 1;
+        unsigned long long keyframe = newest - frame(newest).sinceKeyframe;
+        if (next_ - keyframe < keyframeInterval_) {
+            decodeKeyframe(keyframe);
+            size = encode(snapshot_.data(), keyframe_.data());
+            if (allocate(size, keyframe, offset)) {
+                std::memcpy(data_.data() + offset, encoded_.data(), size);
+                frame(next_) = Frame{ offset, static_cast<uint32_t>(size), static_cast<uint32_t>(next_ - keyframe) };
+                contentBytes_ += size;
+                ++next_;
+                ++framesRecorded_;
+                bytesRecorded_ += size + sizeof(Frame);
+                return true;
+            }
+            // No room without dropping that keyframe: start a new one instead
+        }
+    }
+
+    size = encode(snapshot_.data(), zeros_.data());
+    if (!allocate(size, next_, offset)) {
+        return false;
+    }
+    std::memcpy(data_.data() + offset, encoded_.data(), size);
+    frame(next_) = Frame{ offset, static_cast<uint32_t>(size), 0 };
+    contentBytes_ += size;
+
+    // The new keyframe is the reference for the next frames
+    std::swap(keyframe_, snapshot_);
+    keyframeSequence_ = next_;
+    keyframeValid_ = true;
+
+    ++next_;
+    ++framesRecorded_;
+    ++keyframesRecorded_;
+    bytesRecorded_ += size + sizeof(Frame);
+    return true;
+}
+
+bool Rewind::stepBack(Chip8& chip8) {
+    if (frames() == 0) {
+        return false;
+    }
+
+    unsigned long long sequence = next_ - 1;
+    const Frame& newest = frame(sequence);
+    if (newest.sinceKeyframe == 0) {
+        std::fill(snapshot_.begin(), snapshot_.end(), 0);
+    } else {
+        decodeKeyframe(sequence - newest.sinceKeyframe);
+        std::memcpy(snapshot_.data(), keyframe_.data(), snapshotSize_);
+    }
+    applyRuns(data_.data() + newest.offset, newest.size, snapshot_.data());
+
+    uint8_t keys[KEY_COUNT];
+    std::memcpy(keys, chip8.keypad, sizeof(keys));
+    chip8.loadState(snapshot_.data(), snapshot_.size());
+    std::memcpy(chip8.keypad, keys, sizeof(keys));
+
+    contentBytes_ -= newest.size;
+    next_ = sequence;
+    if (frames() > 0) {
+        const Frame& previous = frame(next_ - 1);
+        head_ = previous.offset + previous.size;
+    }
+    if (keyframeSequence_ >= next_) {
+        keyframeValid_ = false;
+    }
+    return true;
+}
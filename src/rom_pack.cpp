@@ -0,0 +1,254 @@
+#include "rom_pack.hpp"
+#include "chip8.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+struct RomPackHeader
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t entrySize;
+    uint32_t count;
+    uint32_t fileSize;
+};
+
+struct RomPackEntry
+{
+    uint32_t nameOffset;
+    uint32_t dataOffset;
+    uint16_t nameLength;
+    uint16_t size;
+    uint32_t checksum;
+};
+
+static_assert(sizeof(RomPackHeader) == 16 && sizeof(RomPackEntry) == 16, "The pack layout is fixed");
+static_assert(XOCHIP_MAX_ROM_SIZE <= UINT16_MAX, "ROM sizes are stored in 16 bits");
+
+uint32_t romChecksum(const uint8_t* data, size_t size) {
+    uint32_t hash = 0x811C9DC5u;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= data[i];
+        hash *= 0x01000193u;
+    }
+    return hash;
+}
+
+RomPack::RomPack() : view_(nullptr), viewSize_(0), count_(0) {
+}
+
+RomPack::~RomPack() {
+    close();
+}
+
+bool RomPack::fail(const std::string& reason) {
+    close();
+    error_ = reason;
+    return false;
+}
+
+bool RomPack::open(const std::string& filename) {
+    close();
+
+    // Map the whole file read-only; the handles are not needed once the view exists
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return fail("can't open " + filename);
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart < static_cast<LONGLONG>(sizeof(RomPackHeader)) || fileSize.QuadPart > UINT32_MAX) {
+        CloseHandle(file);
+        return fail("not a ROM pack: " + filename);
+    }
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    void* view = mapping != nullptr ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (mapping != nullptr) {
+        CloseHandle(mapping);
+    }
+    CloseHandle(file);
+    if (view == nullptr) {
+        return fail("can't map " + filename);
+    }
+    viewSize_ = static_cast<size_t>(fileSize.QuadPart);
+#else
+    int file = ::open(filename.c_str(), O_RDONLY);
+    if (file < 0) {
+        return fail("can't open " + filename);
+    }
+    struct stat status;
+    if (fstat(file, &status) != 0 || status.st_size < static_cast<off_t>(sizeof(RomPackHeader)) || status.st_size > static_cast<off_t>(UINT32_MAX)) {
+        ::close(file);
+        return fail("not a ROM pack: " + filename);
+    }
+    void* view = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_SHARED, file, 0);
+    ::close(file);
+    if (view == MAP_FAILED) {
+        return fail("can't map " + filename);
+    }
+    viewSize_ = static_cast<size_t>(status.st_size);
+#endif
+    view_ = static_cast<const uint8_t*>(view);
+
+    // Everything an entry points to is checked once here, so rom() can trust the index
+    RomPackHeader header;
+    memcpy(&header, view_, sizeof(header));
+    if (header.magic != ROM_PACK_MAGIC || header.version != ROM_PACK_VERSION || header.entrySize != sizeof(RomPackEntry)) {
+        return fail("not a version " + std::to_string(ROM_PACK_VERSION) + " ROM pack: " + filename);
+    }
+    if (header.fileSize != viewSize_ || header.count > (viewSize_ - sizeof(header)) / sizeof(RomPackEntry)) {
+        return fail("truncated ROM pack: " + filename);
+    }
+
+    const RomPackEntry* entries = reinterpret_cast<const RomPackEntry*>(view_ + sizeof(header));
+    for (uint32_t i = 0; i < header.count; ++i) {
+        const RomPackEntry& entry = entries[i];
+        if (entry.nameOffset > viewSize_ || entry.nameLength > viewSize_ - entry.nameOffset
+            || entry.dataOffset > viewSize_ || entry.size > viewSize_ - entry.dataOffset) {
+            return fail("entry " + std::to_string(i) + " lies outside the ROM pack: " + filename);
+        }
+        if (entry.size == 0 || entry.size > XOCHIP_MAX_ROM_SIZE) {
+            return fail("entry " + std::to_string(i) + " doesn't fit in memory: " + filename);
+        }
+
+        // Names must be in strictly increasing order for find()
+        if (i > 0) {
+            const RomPackEntry& previous = entries[i - 1];
+            int order = memcmp(view_ + previous.nameOffset, view_ + entry.nameOffset, std::min(previous.nameLength, entry.nameLength));
+            if (order > 0 || (order == 0 && previous.nameLength >= entry.nameLength)) {
+                return fail("the ROM pack index is not sorted: " + filename);
+            }
+        }
+    }
+
+    count_ = header.count;
+    error_.clear();
+    return true;
+}
+
+void RomPack::close() {
+    if (view_ != nullptr) {
+#ifdef _WIN32
+        UnmapViewOfFile(view_);
+#else
+        munmap(const_cast<uint8_t*>(view_), viewSize_);
+#endif
+    }
+    view_ = nullptr;
+    viewSize_ = 0;
+    count_ = 0;
+}
+
+PackedRom RomPack::rom(size_t index) const {
+    const RomPackEntry& entry = reinterpret_cast<const RomPackEntry*>(view_ + sizeof(RomPackHeader))[index];
+    return PackedRom{ reinterpret_cast<const char*>(view_ + entry.nameOffset), entry.nameLength,
+                      view_ + entry.dataOffset, entry.size, entry.checksum };
+}
+
+bool RomPack::find(const std::string& name, size_t& index) const {
+    size_t low = 0;
+    size_t high = count_;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        PackedRom candidate = rom(middle);
+        int order = memcmp(candidate.name, name.data(), std::min(candidate.nameLength, name.size()));
+        if (order == 0 && candidate.nameLength == name.size()) {
+            index = middle;
+            return true;
+        }
+        if (order < 0 || (order == 0 && candidate.nameLength < name.size())) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return false;
+}
+
+bool RomPack::verify(size_t index) const {
+    PackedRom packed = rom(index);
+    return romChecksum(packed.data, packed.size) == packed.checksum;
+}
+
+bool RomPackBuilder::add(const std::string& name, const uint8_t* data, size_t size) {
+    if (size == 0 || size > XOCHIP_MAX_ROM_SIZE || name.empty() || name.size() > UINT16_MAX || names_.count(name) != 0) {
+        return false;
+    }
+    names_.insert(name);
+
+    // Identical ROMs under different names are common in collections; they share one image
+    uint32_t checksum = romChecksum(data, size);
+    auto range = imagesByChecksum_.equal_range(checksum);
+    for (auto it = range.first; it != range.second; ++it) {
+        const std::vector<uint8_t>& image = images_[it->second];
+        if (image.size() == size && memcmp(image.data(), data, size) == 0) {
+            roms_.push_back(Rom{ name, it->second, checksum });
+            ++duplicates_;
+            return true;
+        }
+    }
+
+    imagesByChecksum_.emplace(checksum, images_.size());
+    roms_.push_back(Rom{ name, images_.size(), checksum });
+    images_.emplace_back(data, data + size);
+    return true;
+}
+
+bool RomPackBuilder::save(const std::string& filename) const {
+    std::vector<const Rom*> sorted;
+    sorted.reserve(roms_.size());
+    for (const Rom& rom : roms_) {
+        sorted.push_back(&rom);
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const Rom* a, const Rom* b) { return a->name < b->name; });
+
+    // Lay the file out: header, index, names, then the images
+    size_t namesOffset = sizeof(RomPackHeader) + sorted.size() * sizeof(RomPackEntry);
+    size_t dataOffset = namesOffset;
+    for (const Rom* rom : sorted) {
+        dataOffset += rom->name.size();
+    }
+    std::vector<size_t> imageOffsets(images_.size());
+    size_t fileSize = dataOffset;
+    for (size_t i = 0; i < images_.size(); ++i) {
+        imageOffsets[i] = fileSize;
+        fileSize += images_[i].size();
+    }
+    if (fileSize > UINT32_MAX) {
+        return false;
+    }
+
+    std::vector<uint8_t> out(fileSize);
+    RomPackHeader header = { ROM_PACK_MAGIC, ROM_PACK_VERSION, static_cast<uint16_t>(sizeof(RomPackEntry)),
+                             static_cast<uint32_t>(sorted.size()), static_cast<uint32_t>(fileSize) };
+    memcpy(out.data(), &header, sizeof(header));
+
+    size_t nameOffset = namesOffset;
+    for (size_t i = 0; i < sorted.size(); ++i) {
+        const Rom& rom = *sorted[i];
+        RomPackEntry entry = { static_cast<uint32_t>(nameOffset), static_cast<uint32_t>(imageOffsets[rom.image]),
+                               static_cast<uint16_t>(rom.name.size()), static_cast<uint16_t>(images_[rom.image].size()), rom.checksum };
+        memcpy(out.data() + sizeof(header) + i * sizeof(entry), &entry, sizeof(entry));
+        memcpy(out.data() + nameOffset, rom.name.data(), rom.name.size());
+        nameOffset += rom.name.size();
+    }
+    for (size_t i = 0; i < images_.size(); ++i) {
+        memcpy(out.data() + imageOffsets[i], images_[i].data(), images_[i].size());
+    }
+
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    file.write(reinterpret_cast<const char*>(out.data()), static_cast<std::streamsize>(out.size()));
+    return static_cast<bool>(file);
+}
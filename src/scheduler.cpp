@@ -0,0 +1,47 @@
+#include "scheduler.hpp"
+#include <algorithm>
+
+Scheduler::Scheduler(Chip8& chip8, unsigned int inputSamplesPerFrame)
+    : chip8_(chip8), inputSamples_(inputSamplesPerFrame), userCycle_(UINT64_MAX)
+{
+}
+
+unsigned long long Scheduler::nextInput(unsigned long long cycle) const {
+    // Input samples split every second into CHIP8_FRAME_RATE * inputSamples_ steps, like frames do
+    if (inputSamples_ == 0) {
+        return UINT64_MAX;
+    }
+    unsigned long long rate = static_cast<unsigned long long>(CHIP8_FRAME_RATE) * inputSamples_;
+    unsigned long long sample = ((cycle + 1) * rate - 1) / CHIP8_CLOCK_SPEED + 1;
+    return sample * CHIP8_CLOCK_SPEED / rate;
+}
+
+unsigned long long Scheduler::nextEvent() const {
+    unsigned long long cycle = chip8_.cycles();
+    unsigned long long next = std::min(frameStartCycle(frameAtCycle(cycle) + 1), nextInput(cycle));
+    return userCycle_ > cycle ? std::min(next, userCycle_) : next;
+}
+
+unsigned int Scheduler::run(unsigned long long endCycle) {
+    unsigned long long cycle = chip8_.cycles();
+    unsigned long long stop = std::min(nextEvent(), endCycle);
+    if (stop <= cycle) {
+        return 0;
+    }
+    chip8_.run(stop - cycle);
+    cycle = stop;
+
+    unsigned int events = 0;
+    if (frameStartCycle(frameAtCycle(cycle)) == cycle) {
+        chip8_.drawFlag = false;
+        events |= EVENT_FRAME;
+    }
+    if (inputSamples_ != 0 && nextInput(cycle - 1) == cycle) {
+        events |= EVENT_INPUT;
+    }
+    if (userCycle_ == cycle) {
+        userCycle_ = UINT64_MAX;
+        events |= EVENT_USER;
+    }
+    return events;
+}
@@ -0,0 +1,127 @@
+#include "thread_pool.hpp"
+
+// Index of the pool worker running on the current thread, or -1 outside the pool
+static thread_local int currentWorker = -1;
+static thread_local const ThreadPool* currentPool = nullptr;
+
+ThreadPool::ThreadPool(unsigned int threadCount)
+    : pending_(0), queued_(0), sleepers_(0), steals_(0), nextWorker_(0), stop_(false)
+{
+    if (threadCount == 0) {
+        threadCount = 1;
+    }
+
+    for (unsigned int i = 0; i < threadCount; ++i) {
+        workers_.emplace_back(new Worker());
+    }
+
+    // Start the threads only once every deque exists, since workers steal from each other
+    for (unsigned int i = 0; i < threadCount; ++i) {
+        workers_[i]->thread = std::thread(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+        stop_ = true;
+    }
+    workAvailable_.notify_all();
+
+    for (auto& worker : workers_) {
+        worker->thread.join();
+    }
+}
+
+void ThreadPool::submit(Task task) {
+    pending_.fetch_add(1, std::memory_order_relaxed);
+
+    // Workers keep their own follow-up tasks local, everything else is spread round robin
+    unsigned int target;
+    if (currentPool == this) {
+        target = static_cast<unsigned int>(currentWorker);
+    } else {
+        target = nextWorker_.fetch_add(1, std::memory_order_relaxed) % size();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(workers_[target]->mutex);
+        workers_[target]->tasks.push_back(std::move(task));
+    }
+
+    // A worker going to sleep counts itself in sleepers_ before it checks queued_, and we count the
+    // task in queued_ before checking sleepers_, so one of the two always sees the other. Only then
+    // is the sleep mutex needed, to order the notification after the sleeper's check.
+    queued_.fetch_add(1);
+    if (sleepers_.load() != 0) {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex_);
+        }
+        workAvailable_.notify_one();
+    }
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(sleepMutex_);
+    allDone_.wait(lock, [this] { return pending_.load() == 0; });
+}
+
+bool ThreadPool::popLocal(unsigned int self, Task& task) {
+    Worker& worker = *workers_[self];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (worker.tasks.empty()) {
+        return false;
+    }
+    task = std::move(worker.tasks.back());
+    worker.tasks.pop_back();
+    queued_.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool ThreadPool::steal(unsigned int self, Task& task) {
+    // Visit the other workers starting next to ourselves, so thieves spread over different victims
+    for (unsigned int i = 1; i < size(); ++i) {
+        Worker& victim = *workers_[(self + i) % size()];
+        std::unique_lock<std::mutex> lock(victim.mutex, std::try_to_lock);
+        if (!lock.owns_lock() || victim.tasks.empty()) {
+            continue;
+        }
+        task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        queued_.fetch_sub(1, std::memory_order_relaxed);
+        steals_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::workerLoop(unsigned int self) {
+    currentWorker = static_cast<int>(self);
+    currentPool = this;
+
+    Task task;
+    while (true) {
+        if (popLocal(self, task) || steal(self, task)) {
+            task();
+            task = nullptr;
+
+            // The last task to finish wakes up wait()
+            if (pending_.fetch_sub(1) == 1) {
+                std::lock_guard<std::mutex> lock(sleepMutex_);
+                allDone_.notify_all();
+            }
+            continue;
+        }
+
+        // Nothing to run or steal: sleep until new work is submitted.
+        // A try_lock in steal() may have skipped a busy victim; queued_ is still non-zero then, so
+        // we look again instead of sleeping.
+        std::unique_lock<std::mutex> lock(sleepMutex_);
+        if (stop_) {
+            return;
+        }
+        sleepers_.fetch_add(1);
+        workAvailable_.wait(lock, [this] { return stop_ || queued_.load() != 0; });
+        sleepers_.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,252 @@
+#include "threaded.hpp"
+
+// Computed goto is a GCC/Clang extension; the build can also turn it off to compare both loops
+#ifndef CHIP8_COMPUTED_GOTO
+#if defined(__GNUC__) || defined(__clang__)
+#define CHIP8_COMPUTED_GOTO 1
+#else
+#define CHIP8_COMPUTED_GOTO 0
+#endif
+#endif
+
+static constexpr Threaded::DecodeTable decodeTable{};
+
+// A few spot checks that the generated table decodes like the interpreter's tables
+static_assert(decodeTable.ops[0x00E0] == Threaded::OP_CLS, "00E0 is CLS");
+static_assert(decodeTable.ops[0x00EE] == Threaded::OP_RET, "00EE is RET");
+static_assert(decodeTable.ops[0x0123] == Threaded::OP_ILLEGAL, "0nnn (SYS) is not implemented");
+static_assert(decodeTable.ops[0x8AB6] == Threaded::OP_SHR, "8xy6 is SHR");
+static_assert(decodeTable.ops[0x8AB8] == Threaded::OP_ILLEGAL, "8xy8 is not an instruction");
+static_assert(decodeTable.ops[0xE59E] == Threaded::OP_SKP, "Ex9E is SKP");
+static_assert(decodeTable.ops[0xF365] == Threaded::OP_LD_VX_MEM, "Fx65 is LD Vx, [I]");
+static_assert(decodeTable.ops[0xF366] == Threaded::OP_ILLEGAL, "Fx66 is not an instruction");
+
+void Threaded::run(Chip8& c, unsigned long long cycles) {
+    if (cycles == 0) {
+        return;
+    }
+
+    uint8_t* V = c.registers;
+    uint16_t opcode;
+
+    // `cycles` counts down the instructions left, including the current one; the cycle counter is
+    // only brought up to date for the timer instructions and when the run ends
+    const unsigned long long end = c.cycleCount + cycles;
+
+// Operands of the current opcode
+#define X ((opcode & 0x0F00u) >> 8)
+#define Y ((opcode & 0x00F0u) >> 4)
+#define KK (opcode & 0x00FFu)
+#define NNN (opcode & 0x0FFFu)
+
+// Same fetch as Chip8::cycle()
+#define FETCH() \
+    opcode = static_cast<uint16_t>((c.memory[c.pc & c.addressMask] << 8) | c.memory[(c.pc + 1) & c.addressMask]); \
+    c.opcode = opcode; \
+    c.pc += 2
+
+// Sets the cycle counter to the current instruction, as Chip8::cycle() sees it
+#define SYNC_CYCLES() c.cycleCount = end - cycles
+
+#if CHIP8_COMPUTED_GOTO
+    // In the same order as Threaded::Op
+    static void* const handlers[OP_COUNT] = {
+        &&op_cls, &&op_ret, &&op_jp, &&op_call, &&op_se_byte, &&op_sne_byte, &&op_se_reg, &&op_ld_byte,
+        &&op_add_byte, &&op_ld_reg, &&op_or, &&op_and, &&op_xor, &&op_add_reg, &&op_sub, &&op_shr,
+        &&op_subn, &&op_shl, &&op_sne_reg, &&op_ld_i, &&op_jp_v0, &&op_rnd, &&op_drw, &&op_skp,
+        &&op_sknp, &&op_ld_vx_dt, &&op_ld_vx_k, &&op_ld_dt, &&op_ld_st, &&op_add_i, &&op_ld_f,
+        &&op_ld_b, &&op_ld_mem_vx, &&op_ld_vx_mem,
+        &&op_illegal
+    };
+
+// Every handler ends with its own copy of the dispatch
+#define HANDLER(op, label) label:
+#define NEXT() \
+    if (--cycles == 0) { c.cycleCount = end; return; } \
+    FETCH(); \
+    goto *handlers[decodeTable.ops[opcode]]
+
+    FETCH();
+    goto *handlers[decodeTable.ops[opcode]];
+#else
+#define HANDLER(op, label) case op:
+#define NEXT() break
+
+    for (;;) {
+        FETCH();
+        switch (decodeTable.ops[opcode]) {
+#endif
+
+    HANDLER(OP_CLS, op_cls)
+        c.op_00E0(); // Marks the cleared rows dirty
+        NEXT();
+
+    HANDLER(OP_RET, op_ret)
+        c.op_00EE(); // Reports stack underflows
+        NEXT();
+
+    HANDLER(OP_JP, op_jp)
+        c.pc = NNN;
+        NEXT();
+
+    HANDLER(OP_CALL, op_call)
+        c.op_2nnn(); // Reports stack overflows
+        NEXT();
+
+    HANDLER(OP_SE_BYTE, op_se_byte)
+        if (V[X] == KK) c.pc += 2;
+        NEXT();
+
+    HANDLER(OP_SNE_BYTE, op_sne_byte)
+        if (V[X] != KK) c.pc += 2;
+        NEXT();
+
+    HANDLER(OP_SE_REG, op_se_reg)
+        if (V[X] == V[Y]) c.pc += 2;
+        NEXT();
+
+    HANDLER(OP_LD_BYTE, op_ld_byte)
+        V[X] = KK;
+        NEXT();
+
+    HANDLER(OP_ADD_BYTE, op_add_byte)
+        V[X] += KK;
+        NEXT();
+
+    HANDLER(OP_LD_REG, op_ld_reg)
+        V[X] = V[Y];
+        NEXT();
+
+    HANDLER(OP_OR, op_or)
+        V[X] |= V[Y];
+        NEXT();
+
+    HANDLER(OP_AND, op_and)
+        V[X] &= V[Y];
+        NEXT();
+
+    HANDLER(OP_XOR, op_xor)
+        V[X] ^= V[Y];
+        NEXT();
+
+    // The flag is written before the result, like in the interpreter, so the results match when x or y is F
+    HANDLER(OP_ADD_REG, op_add_reg)
+        {
+            unsigned int sum = V[X] + V[Y];
+            V[0xF] = sum > 255 ? 1 : 0;
+            V[X] = static_cast<uint8_t>(sum);
+        }
+        NEXT();
+
+    HANDLER(OP_SUB, op_sub)
+        V[0xF] = V[X] > V[Y] ? 1 : 0;
+        V[X] -= V[Y];
+        NEXT();
+
+    HANDLER(OP_SHR, op_shr)
+        V[0xF] = V[X] & 0x1;
+        V[X] >>= 1;
+        NEXT();
+
+    HANDLER(OP_SUBN, op_subn)
+        V[0xF] = V[Y] > V[X] ? 1 : 0;
+        V[X] = static_cast<uint8_t>(V[Y] - V[X]);
+        NEXT();
+
+    HANDLER(OP_SHL, op_shl)
+        V[0xF] = (V[X] & 0x80u) >> 7;
+        V[X] <<= 1;
+        NEXT();
+
+    HANDLER(OP_SNE_REG, op_sne_reg)
+        if (V[X] != V[Y]) c.pc += 2;
+        NEXT();
+
+    HANDLER(OP_LD_I, op_ld_i)
+        c.index = NNN;
+        NEXT();
+
+    HANDLER(OP_JP_V0, op_jp_v0)
+        c.pc = static_cast<uint16_t>(V[0] + NNN);
+        NEXT();
+
+    HANDLER(OP_RND, op_rnd)
+        V[X] = KK & c.randGen.nextByte();
+        NEXT();
+
+    HANDLER(OP_DRW, op_drw)
+        c.op_Dxyn<OriginalQuirks>();
+        NEXT();
+
+    HANDLER(OP_SKP, op_skp)
+        if (c.keypad[V[X] & 0x0F]) c.pc += 2;
+        NEXT();
+
+    HANDLER(OP_SKNP, op_sknp)
+        if (!c.keypad[V[X] & 0x0F]) c.pc += 2;
+        NEXT();
+
+    HANDLER(OP_LD_VX_DT, op_ld_vx_dt)
+        SYNC_CYCLES();
+        V[X] = c.getDelayTimer();
+        NEXT();
+
+    HANDLER(OP_LD_VX_K, op_ld_vx_k)
+        c.op_Fx0A();
+        NEXT();
+
+    HANDLER(OP_LD_DT, op_ld_dt)
+        SYNC_CYCLES();
+        c.setDelayTimer(V[X]);
+        NEXT();
+
+    HANDLER(OP_LD_ST, op_ld_st)
+        SYNC_CYCLES();
+        c.setSoundTimer(V[X]);
+        NEXT();
+
+    HANDLER(OP_ADD_I, op_add_i)
+        c.index += V[X];
+        NEXT();
+
+    HANDLER(OP_LD_F, op_ld_f)
+        c.op_Fx29();
+        NEXT();
+
+    HANDLER(OP_LD_B, op_ld_b)
+        c.op_Fx33();
+        NEXT();
+
+    HANDLER(OP_LD_MEM_VX, op_ld_mem_vx)
+        c.op_Fx55<OriginalQuirks>();
+        NEXT();
+
+    HANDLER(OP_LD_VX_MEM, op_ld_vx_mem)
+        c.op_Fx65<OriginalQuirks>();
+        NEXT();
+
+    HANDLER(OP_ILLEGAL, op_illegal)
+        // Unknown opcodes are ignored, like op_NULL does
+        NEXT();
+
+#if !CHIP8_COMPUTED_GOTO
+        default:
+            break;
+        }
+
+        if (--cycles == 0) {
+            c.cycleCount = end;
+            return;
+        }
+    }
+#endif
+
+#undef X
+#undef Y
+#undef KK
+#undef NNN
+#undef FETCH
+#undef SYNC_CYCLES
+#undef HANDLER
+#undef NEXT
+}
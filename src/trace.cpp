@@ -0,0 +1,191 @@
+#include "trace.hpp"
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+struct TraceHeader
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t recordSize;
+    uint64_t count;
+};
+
+static_assert(sizeof(TraceHeader) == TRACE_HEADER_SIZE, "The header takes the place of one record");
+
+TraceWriter::TraceWriter()
+#ifdef _WIN32
+    : file_(INVALID_HANDLE_VALUE), mapping_(nullptr),
+#else
+    : file_(-1),
+#endif
+      view_(nullptr), chunk_(0), slots_(0), next_(nullptr), end_(nullptr), dropped_(0)
+{
+}
+
+TraceWriter::~TraceWriter() {
+    close();
+}
+
+bool TraceWriter::open(const std::string& filename) {
+    close();
+
+#ifdef _WIN32
+    file_ = CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file_ == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+#else
+    file_ = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (file_ < 0) {
+        return false;
+    }
+#endif
+
+    // The first chunk starts with the header; its count is filled in by close()
+    chunk_ = 0;
+    slots_ = 0;
+    dropped_ = 0;
+    if (!mapNextChunk()) {
+        close();
+        return false;
+    }
+    TraceHeader header = { TRACE_MAGIC, TRACE_VERSION, static_cast<uint16_t>(sizeof(TraceRecord)), 0 };
+    memcpy(view_, &header, sizeof(header));
+    ++next_;
+    return true;
+}
+
+unsigned long long TraceWriter::records() const {
+    // The header takes the first slot
+    unsigned long long slots = slots_ + (view_ != nullptr ? static_cast<unsigned long long>(next_ - static_cast<TraceRecord*>(view_)) : 0);
+    return slots > 0 ? slots - 1 : 0;
+}
+
+bool TraceWriter::mapNextChunk() {
+    // Grows the file by a chunk and maps it in place of the full one
+    unmapChunk();
+    unsigned long long offset = chunk_ * TRACE_CHUNK_SIZE;
+    unsigned long long size = offset + TRACE_CHUNK_SIZE;
+
+#ifdef _WIN32
+    if (file_ == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    // Creating a mapping larger than the file extends it
+    mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READWRITE, static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), nullptr);
+    if (mapping_ == nullptr) {
+        return false;
+    }
+    view_ = MapViewOfFile(mapping_, FILE_MAP_WRITE, static_cast<DWORD>(offset >> 32), static_cast<DWORD>(offset), TRACE_CHUNK_SIZE);
+    if (view_ == nullptr) {
+        CloseHandle(mapping_);
+        mapping_ = nullptr;
+        return false;
+    }
+#else
+    if (file_ < 0 || ftruncate(file_, static_cast<off_t>(size)) != 0) {
+        return false;
+    }
+    void* view = mmap(nullptr, TRACE_CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, file_, static_cast<off_t>(offset));
+    if (view == MAP_FAILED) {
+        return false;
+    }
+    view_ = view;
+#endif
+
+    next_ = static_cast<TraceRecord*>(view_);
+    end_ = next_ + TRACE_CHUNK_SIZE / sizeof(TraceRecord);
+    ++chunk_;
+    return true;
+}
+
+void TraceWriter::unmapChunk() {
+    if (view_ == nullptr) {
+        return;
+    }
+    slots_ += static_cast<unsigned long long>(next_ - static_cast<TraceRecord*>(view_));
+#ifdef _WIN32
+    UnmapViewOfFile(view_);
+    CloseHandle(mapping_);
+    mapping_ = nullptr;
+#else
+    munmap(view_, TRACE_CHUNK_SIZE);
+#endif
+    view_ = nullptr;
+    next_ = nullptr;
+    end_ = nullptr;
+}
+
+void TraceWriter::close() {
+    unsigned long long count = records();
+    bool headerWritten = slots_ != 0 || view_ != nullptr;
+    unmapChunk();
+    slots_ = 0;
+
+    // Trim the unused end of the last chunk and write the record count into the header
+    unsigned long long size = TRACE_HEADER_SIZE + count * sizeof(TraceRecord);
+    uint64_t count64 = count;
+#ifdef _WIN32
+    if (file_ == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    if (headerWritten) {
+        LARGE_INTEGER position;
+        position.QuadPart = static_cast<LONGLONG>(size);
+        SetFilePointerEx(file_, position, nullptr, FILE_BEGIN);
+        SetEndOfFile(file_);
+        position.QuadPart = offsetof(TraceHeader, count);
+        SetFilePointerEx(file_, position, nullptr, FILE_BEGIN);
+        DWORD written;
+        WriteFile(file_, &count64, sizeof(count64), &written, nullptr);
+    }
+    CloseHandle(file_);
+    file_ = INVALID_HANDLE_VALUE;
+#else
+    if (file_ < 0) {
+        return;
+    }
+    if (headerWritten) {
+        // The records are on disk either way; if this fails a reader falls back to the file size
+        bool trimmed = ftruncate(file_, static_cast<off_t>(size)) == 0;
+        ssize_t countWritten = pwrite(file_, &count64, sizeof(count64), offsetof(TraceHeader, count));
+        (void)trimmed;
+        (void)countWritten;
+    }
+    ::close(file_);
+    file_ = -1;
+#endif
+}
+
+bool TraceReader::open(const std::string& filename) {
+    file_.open(filename, std::ios::binary);
+    TraceHeader header;
+    if (!file_ || !file_.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        header.magic != TRACE_MAGIC || header.version != TRACE_VERSION || header.recordSize != sizeof(TraceRecord)) {
+        return false;
+    }
+
+    // A trace that was never closed has no count; it holds as many records as fit, possibly
+    // followed by unused zeroed slots of its last chunk
+    file_.seekg(0, std::ios::end);
+    unsigned long long fit = (static_cast<unsigned long long>(file_.tellg()) - TRACE_HEADER_SIZE) / sizeof(TraceRecord);
+    file_.seekg(TRACE_HEADER_SIZE, std::ios::beg);
+    count_ = header.count != 0 && header.count <= fit ? header.count : fit;
+    read_ = 0;
+    return true;
+}
+
+bool TraceReader::next(TraceRecord& record) {
+    if (read_ == count_ || !file_.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+        return false;
+    }
+    ++read_;
+    return true;
+}
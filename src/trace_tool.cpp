@@ -0,0 +1,141 @@
+#include "trace.hpp"
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+// Trace reader
+// Prints the records of a trace written by chip8headless --trace as text, one instruction per line,
+// optionally only those in a range of addresses or matching an opcode pattern.
+
+static void printUsage(const char* program)
+{
+    std::cerr << "Usage: " << program << " [--pc <From>[-<To>]] [--opcode <Pattern>] [--count] <Trace>\n"
+              << "Addresses are hex. A pattern has four upper-case hex digits; any other character matches any digit,\n"
+              << "e.g. Dxyn, Fx07 or 00EE.\n";
+}
+
+// Parses "200" or "200-2FF" (hex, inclusive)
+static bool parseRange(const std::string& text, uint16_t& from, uint16_t& to)
+{
+    char* end;
+    unsigned long first = std::strtoul(text.c_str(), &end, 16);
+    unsigned long last = first;
+    if (*end == '-')
+    {
+        last = std::strtoul(end + 1, &end, 16);
+    }
+    if (*end != '\0' || end == text.c_str() || first > 0xFFFF || last > 0xFFFF || first > last)
+    {
+        return false;
+    }
+    from = static_cast<uint16_t>(first);
+    to = static_cast<uint16_t>(last);
+    return true;
+}
+
+// Turns a pattern like "Fx07" into a value and a mask of the digits that have to match
+// Lower-case letters are wildcards, so the usual x, y, n and k notation works as is
+static bool parsePattern(const std::string& text, uint16_t& value, uint16_t& mask)
+{
+    if (text.size() != 4)
+    {
+        return false;
+    }
+    value = 0;
+    mask = 0;
+    for (char c : text)
+    {
+        value <<= 4;
+        mask <<= 4;
+        if (std::isxdigit(static_cast<unsigned char>(c)) && !std::islower(static_cast<unsigned char>(c)))
+        {
+            value |= static_cast<uint16_t>(std::strtoul(std::string(1, c).c_str(), nullptr, 16));
+            mask |= 0xF;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    const char* traceFilename = nullptr;
+    uint16_t pcFrom = 0;
+    uint16_t pcTo = 0xFFFF;
+    uint16_t opcodeValue = 0;
+    uint16_t opcodeMask = 0;
+    bool countOnly = false;
+
+    // Parse command-line arguments
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--pc") == 0 && i + 1 < argc && parseRange(argv[i + 1], pcFrom, pcTo))
+        {
+            ++i;
+        }
+        else if (std::strcmp(argv[i], "--opcode") == 0 && i + 1 < argc && parsePattern(argv[i + 1], opcodeValue, opcodeMask))
+        {
+            ++i;
+        }
+        else if (std::strcmp(argv[i], "--count") == 0)
+        {
+            countOnly = true;
+        }
+        else if (traceFilename == nullptr && argv[i][0] != '-')
+        {
+            traceFilename = argv[i];
+        }
+        else
+        {
+            printUsage(argv[0]);
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
+    if (traceFilename == nullptr)
+    {
+        printUsage(argv[0]);
+        std::exit(EXIT_FAILURE);
+    }
+
+    TraceReader reader;
+    if (!reader.open(traceFilename))
+    {
+        std::cerr << "Not a trace file: " << traceFilename << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    // Lines are formatted with snprintf and written in large blocks; traces run to millions of records
+    unsigned long long matched = 0;
+    TraceRecord record;
+    char line[64];
+    while (reader.next(record))
+    {
+        if (record.pc < pcFrom || record.pc > pcTo || (record.opcode & opcodeMask) != opcodeValue)
+        {
+            continue;
+        }
+        ++matched;
+        if (countOnly)
+        {
+            continue;
+        }
+
+        int length = std::snprintf(line, sizeof(line), "%llu %03X %04X I=%03X",
+                                   static_cast<unsigned long long>(record.cycle), record.pc, record.opcode, record.index);
+        if (record.reg != TRACE_NO_REGISTER)
+        {
+            length += std::snprintf(line + length, sizeof(line) - length, " V%X=%02X", record.reg, record.value);
+        }
+        line[length++] = '\n';
+        std::fwrite(line, 1, static_cast<size_t>(length), stdout);
+    }
+
+    if (countOnly)
+    {
+        std::cout << matched << " of " << reader.records() << " records" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,58 @@
+# Cross-engine determinism test, run by CTest
+# Writes the programs chip8_bench generates as ROMs, runs each of them through chip8headless with a
+# fixed seed on every engine, with and without idle-loop skipping, and fails unless every run ends
+# with the interpreter's state checksum.
+#
+# cmake -DHEADLESS=<chip8headless> -DBENCH=<chip8_bench> -DWORK_DIR=<Directory> [-DSEED=<N>] [-DCYCLES=<N>] -P engine_checksums.cmake
+
+if(NOT HEADLESS OR NOT BENCH OR NOT WORK_DIR)
+    message(FATAL_ERROR "HEADLESS, BENCH and WORK_DIR must be set")
+endif()
+if(NOT SEED)
+    set(SEED 7)
+endif()
+if(NOT CYCLES)
+    set(CYCLES 200000)
+endif()
+
+set(engines interpreter threaded cached jit jit-verify aot)
+
+file(REMOVE_RECURSE "${WORK_DIR}")
+file(MAKE_DIRECTORY "${WORK_DIR}")
+execute_process(COMMAND "${BENCH}" --write-roms "${WORK_DIR}" RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "chip8_bench --write-roms failed")
+endif()
+file(GLOB roms "${WORK_DIR}/*.ch8")
+if(NOT roms)
+    message(FATAL_ERROR "No ROMs generated in ${WORK_DIR}")
+endif()
+
+set(failures 0)
+foreach(rom ${roms})
+    get_filename_component(rom_name "${rom}" NAME_WE)
+    set(reference "")
+    foreach(idle_skip "" --no-idle-skip)
+        foreach(engine ${engines})
+            execute_process(COMMAND "${HEADLESS}" --cycles ${CYCLES} --seed ${SEED} --engine ${engine} ${idle_skip} "${rom}"
+                            OUTPUT_VARIABLE output ERROR_VARIABLE errors RESULT_VARIABLE result)
+            string(REGEX MATCH "State checksum: ([0-9a-f]+)" line "${output}")
+            set(checksum "${CMAKE_MATCH_1}")
+            set(run "${rom_name} ${engine} ${idle_skip}")
+            if(NOT result EQUAL 0 OR checksum STREQUAL "")
+                message(SEND_ERROR "${run}: no checksum (exit ${result})\n${errors}")
+                math(EXPR failures "${failures} + 1")
+            elseif(reference STREQUAL "")
+                set(reference "${checksum}")
+                message(STATUS "${rom_name}: ${checksum}")
+            elseif(NOT checksum STREQUAL reference)
+                message(SEND_ERROR "${run}: checksum ${checksum}, expected ${reference}")
+                math(EXPR failures "${failures} + 1")
+            endif()
+        endforeach()
+    endforeach()
+endforeach()
+
+if(failures GREATER 0)
+    message(FATAL_ERROR "${failures} runs ended in a different state")
+endif()